@@ -0,0 +1,179 @@
+﻿// AllocTracker.h — counts of operator new calls per thread, for checking that a steady-state frame allocates nothing
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <algorithm>
+
+#include "Trace.h"
+
+// Every thread that allocates while counting is on takes a slot of its
+// own, named after its trace name, and only it writes there, so counting
+// is a load and a store, as in Trace.h. Off, an allocation costs one
+// relaxed load. The replacements of the global operator new and delete
+// below are definitions, not inline: include this from one translation
+// unit only, or define FIRE_NO_ALLOC_TRACKER to leave the defaults in.
+// Calls to malloc itself (C libraries, the GL driver) are not seen.
+struct AllocSlot {
+    std::atomic<uint64_t> count{ 0 }, bytes{ 0 };   // written by the owner only
+    char name[32] = "";
+};
+
+struct AllocRegistry {
+    static const int Slots = 64;
+    std::atomic<bool> enabled{ false };
+    std::atomic<int> used{ 0 };
+    std::atomic<uint64_t> unslotted{ 0 };   // from threads beyond the last slot
+    AllocSlot slots[Slots];
+};
+
+static inline AllocRegistry& allocRegistry() { static AllocRegistry r; return r; }
+
+static inline void allocStart() { allocRegistry().enabled.store(true, std::memory_order_relaxed); }
+static inline void allocStop() { allocRegistry().enabled.store(false, std::memory_order_relaxed); }
+
+// this thread's slot, claimed on its first allocation while counting; -1
+// before that, -2 when none was left
+static inline int& allocSlotIndex() { static thread_local int slot = -1; return slot; }
+
+static inline void allocRecord(size_t n) {
+    AllocRegistry& r = allocRegistry();
+    if (!r.enabled.load(std::memory_order_relaxed)) return;
+    int& i = allocSlotIndex();
+    if (i == -1) {
+        i = r.used.fetch_add(1, std::memory_order_relaxed);
+        if (i >= AllocRegistry::Slots) {
+            i = -2;
+        } else if (traceThreadLabel()[0]) {
+            std::snprintf(r.slots[i].name, sizeof(r.slots[i].name), "%s", traceThreadLabel());
+        } else {
+            std::snprintf(r.slots[i].name, sizeof(r.slots[i].name), "thread %d", i + 1);
+        }
+    }
+    if (i < 0) { r.unslotted.fetch_add(1, std::memory_order_relaxed); return; }
+    AllocSlot& s = r.slots[i];
+    s.count.store(s.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    s.bytes.store(s.bytes.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// allocations the calling thread made while counting was on
+static inline uint64_t allocThreadCount() {
+    int i = allocSlotIndex();
+    return i >= 0 ? allocRegistry().slots[i].count.load(std::memory_order_relaxed) : 0;
+}
+
+// Allocations per thread since reset(), for the stats: a copy of every
+// slot's counters, taken without allocating.
+class AllocWindow {
+public:
+    void reset() {
+        AllocRegistry& r = allocRegistry();
+        for (int i = 0; i < AllocRegistry::Slots; ++i) {
+            count_[i] = r.slots[i].count.load(std::memory_order_relaxed);
+            bytes_[i] = r.slots[i].bytes.load(std::memory_order_relaxed);
+        }
+        unslotted_ = r.unslotted.load(std::memory_order_relaxed);
+    }
+
+    // e.g. "allocs per frame: main 0.0 (0.0 KB), sim 3.2 (1.1 KB)"; threads
+    // with no allocation in the window are left out
+    void print(FILE* f, int frames) const {
+        AllocRegistry& r = allocRegistry();
+        int used = r.used.load(std::memory_order_relaxed);
+        if (used > AllocRegistry::Slots) used = AllocRegistry::Slots;
+        const double per = frames > 0 ? 1.0 / frames : 0.0;
+        fprintf(f, "allocs per frame:");
+        bool any = false;
+        for (int i = 0; i < used; ++i) {
+            uint64_t n = r.slots[i].count.load(std::memory_order_relaxed) - count_[i];
+            uint64_t b = r.slots[i].bytes.load(std::memory_order_relaxed) - bytes_[i];
+            if (!n && std::strcmp(r.slots[i].name, "main") != 0) continue;
+            fprintf(f, "%s %s %.1f (%.1f KB)", any ? "," : "", r.slots[i].name, n * per, b * per / 1024.0);
+            any = true;
+        }
+        uint64_t rest = r.unslotted.load(std::memory_order_relaxed) - unslotted_;
+        if (rest) fprintf(f, "%s other threads %.1f", any ? "," : "", rest * per);
+        else if (!any) fprintf(f, " none");
+        fprintf(f, "\n");
+    }
+
+private:
+    uint64_t count_[AllocRegistry::Slots] = {}, bytes_[AllocRegistry::Slots] = {};
+    uint64_t unslotted_ = 0;
+};
+
+#ifndef FIRE_NO_ALLOC_TRACKER
+// all the forms (the aligned ones where the language has them), so none
+// falls through to a default that calls malloc directly
+static void* allocNew(std::size_t n) {
+    allocRecord(n);
+    for (;;) {
+        if (void* p = std::malloc(n ? n : 1)) return p;
+        std::new_handler h = std::get_new_handler();
+        if (!h) throw std::bad_alloc();
+        h();
+    }
+}
+
+static void* allocNewNothrow(std::size_t n) noexcept {
+    try { return allocNew(n); } catch (...) { return nullptr; }
+}
+
+void* operator new(std::size_t n) { return allocNew(n); }
+void* operator new[](std::size_t n) { return allocNew(n); }
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return allocNewNothrow(n); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return allocNewNothrow(n); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+#ifdef __cpp_aligned_new
+// over-aligned types (C++17): the block comes from the aligned allocator of
+// the platform and goes back to its matching free
+static void* allocNewAligned(std::size_t n, std::align_val_t al) {
+    allocRecord(n);
+    const std::size_t a = std::max(std::size_t(al), sizeof(void*));
+    for (;;) {
+#ifdef _WIN32
+        if (void* p = _aligned_malloc(n ? n : 1, a)) return p;
+#else
+        void* p = nullptr;
+        if (posix_memalign(&p, a, n ? n : 1) == 0) return p;
+#endif
+        std::new_handler h = std::get_new_handler();
+        if (!h) throw std::bad_alloc();
+        h();
+    }
+}
+
+static void allocFreeAligned(void* p) noexcept {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+static void* allocNewAlignedNothrow(std::size_t n, std::align_val_t al) noexcept {
+    try { return allocNewAligned(n, al); } catch (...) { return nullptr; }
+}
+
+void* operator new(std::size_t n, std::align_val_t al) { return allocNewAligned(n, al); }
+void* operator new[](std::size_t n, std::align_val_t al) { return allocNewAligned(n, al); }
+void* operator new(std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept { return allocNewAlignedNothrow(n, al); }
+void* operator new[](std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept { return allocNewAlignedNothrow(n, al); }
+void operator delete(void* p, std::align_val_t) noexcept { allocFreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { allocFreeAligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { allocFreeAligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { allocFreeAligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { allocFreeAligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { allocFreeAligned(p); }
+#endif
+#endif
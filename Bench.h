@@ -0,0 +1,197 @@
+﻿// Bench.h — headless render benchmark: a GL context without a display, per-pass timing, frame-time statistics
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include "GpuTimers.h"
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+// ---------- context without a display ----------
+// On Linux an EGL context on Mesa's surfaceless platform: no X server, no
+// window, rendering only into framebuffer objects. Mesa picks the GPU, or
+// llvmpipe with LIBGL_ALWAYS_SOFTWARE=1 (or when there is no GPU at all).
+// libEGL is opened at run time, so nothing extra is linked and a machine
+// without it falls back to a hidden GLFW window (as does Windows).
+class HeadlessContext {
+public:
+    HeadlessContext() {}
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+    ~HeadlessContext() { destroy(); }
+
+    // a 3.3 core context made current; false if none could be had this way
+    bool create() {
+#ifdef _WIN32
+        return false;
+#else
+        lib_ = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (!lib_) return false;
+        getProc_ = (GetProc)dlsym(lib_, "eglGetProcAddress");
+        if (!getProc_) { destroy(); return false; }
+        auto getPlatformDisplay = (GetPlatformDisplay)getProc_("eglGetPlatformDisplayEXT");
+        auto initialize = (Initialize)getProc_("eglInitialize");
+        auto bindApi = (BindApi)getProc_("eglBindAPI");
+        auto chooseConfig = (ChooseConfig)getProc_("eglChooseConfig");
+        auto createContext = (CreateContext)getProc_("eglCreateContext");
+        auto makeCurrent = (MakeCurrent)getProc_("eglMakeCurrent");
+        if (!getPlatformDisplay || !initialize || !bindApi || !chooseConfig || !createContext || !makeCurrent) {
+            destroy();
+            return false;
+        }
+        const unsigned kPlatformSurfacelessMesa = 0x31DD;
+        const int kNone = 0x3038, kRenderableType = 0x3040, kOpenGLBit = 0x0008, kSurfaceType = 0x3033;
+        const int kContextMajor = 0x3098, kContextMinor = 0x30FB, kProfileMask = 0x30FD, kCoreProfileBit = 0x1;
+        const unsigned kOpenGLApi = 0x30A2;
+        display_ = getPlatformDisplay(kPlatformSurfacelessMesa, nullptr, nullptr);
+        int major = 0, minor = 0;
+        if (!display_ || !initialize(display_, &major, &minor)) { destroy(); return false; }
+        if (!bindApi(kOpenGLApi)) { destroy(); return false; }
+        const int configAttribs[] = { kSurfaceType, 0, kRenderableType, kOpenGLBit, kNone };
+        void* config = nullptr;
+        int count = 0;
+        if (!chooseConfig(display_, configAttribs, &config, 1, &count) || count == 0) { destroy(); return false; }
+        const int contextAttribs[] = { kContextMajor, 3, kContextMinor, 3, kProfileMask, kCoreProfileBit, kNone };
+        context_ = createContext(display_, config, nullptr, contextAttribs);
+        if (!context_ || !makeCurrent(display_, nullptr, nullptr, context_)) { destroy(); return false; }
+        return true;
+#endif
+    }
+
+    // for gladLoadGLLoader while this context is current
+    static void* proc(const char* name) { return instance().getProc_ ? (void*)instance().getProc_(name) : nullptr; }
+
+    static HeadlessContext& instance() { static HeadlessContext ctx; return ctx; }
+
+    void destroy() {
+#ifndef _WIN32
+        if (getProc_ && display_) {
+            auto makeCurrent = (MakeCurrent)getProc_("eglMakeCurrent");
+            auto destroyContext = (DestroyContext)getProc_("eglDestroyContext");
+            auto terminate = (Terminate)getProc_("eglTerminate");
+            if (context_ && makeCurrent) makeCurrent(display_, nullptr, nullptr, nullptr);
+            if (context_ && destroyContext) destroyContext(display_, context_);
+            if (terminate) terminate(display_);
+        }
+        if (lib_) dlclose(lib_);
+        lib_ = nullptr;
+#endif
+        getProc_ = nullptr;
+        display_ = context_ = nullptr;
+    }
+
+private:
+    // the few EGL entry points, with EGLDisplay/EGLConfig/EGLContext as void*
+    // and EGLint/EGLenum/EGLBoolean as int/unsigned
+    typedef void (*(*GetProc)(const char*))();
+    typedef void* (*GetPlatformDisplay)(unsigned, void*, const intptr_t*);
+    typedef unsigned (*Initialize)(void*, int*, int*);
+    typedef unsigned (*BindApi)(unsigned);
+    typedef unsigned (*ChooseConfig)(void*, const int*, void**, int, int*);
+    typedef void* (*CreateContext)(void*, void*, void*, const int*);
+    typedef unsigned (*MakeCurrent)(void*, void*, void*, void*);
+    typedef unsigned (*DestroyContext)(void*, void*);
+    typedef unsigned (*Terminate)(void*);
+
+    void* lib_ = nullptr;
+    GetProc getProc_ = nullptr;
+    void* display_ = nullptr;
+    void* context_ = nullptr;
+};
+
+// ---------- per-pass and per-frame timing ----------
+// nearest-rank percentile of unsorted samples, p in [0, 100]
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t rank = size_t(std::ceil(p / 100.0 * double(v.size())));
+    return v[std::min(v.size() - 1, rank ? rank - 1 : 0)];
+}
+
+// Wall time of each pass, bracketed by glFinish so a pass's cost is what
+// the GL took to finish it rather than to queue it. The finishes remove the
+// overlap of CPU and GPU work between passes, so a benchmark frame is the
+// sum of its passes; the interactive loop never marks and runs unsynced.
+struct BenchClock {
+    int warmup = 0;                             // frames run before recording
+    std::vector<double> frameMs;
+    std::vector<double> passMs[kFramePasses];
+
+    // room for every frame up front, so recording never allocates mid-run
+    void reserve(int frames) {
+        frameMs.reserve(frames);
+        for (std::vector<double>& v : passMs) v.reserve(frames);
+    }
+
+    void beginFrame() {
+        glFinish();
+        frameStart_ = last_ = std::chrono::steady_clock::now();
+        for (double& p : cur_) p = 0.0;
+    }
+    // the pass that just ended
+    void mark(FramePass pass) {
+        glFinish();
+        auto now = std::chrono::steady_clock::now();
+        cur_[int(pass)] += std::chrono::duration<double, std::milli>(now - last_).count();
+        last_ = now;
+    }
+    void endFrame() {
+        glFinish();
+        auto now = std::chrono::steady_clock::now();
+        if (warmup > 0) { --warmup; return; }
+        frameMs.push_back(std::chrono::duration<double, std::milli>(now - frameStart_).count());
+        for (int p = 0; p < kFramePasses; ++p) passMs[p].push_back(cur_[p]);
+    }
+
+private:
+    std::chrono::steady_clock::time_point frameStart_, last_;
+    double cur_[kFramePasses] = {};
+};
+
+static double mean(const std::vector<double>& v) {
+    double s = 0.0;
+    for (double x : v) s += x;
+    return v.empty() ? 0.0 : s / double(v.size());
+}
+
+// What a benchmark ran with, for the report.
+struct BenchConfig {
+    int frames = 300, warmup = 30, width = 900, height = 1200;
+    float dt = 1.0f / 60.0f;
+    std::string context, renderer, version, scene;
+};
+
+// mean and percentiles of the frames and of every pass, and the GPU's own
+// per-pass times from the timestamp queries, as JSON
+static void writeBenchJson(FILE* f, const BenchConfig& cfg, const BenchClock& clock, const GpuTimers& gpu) {
+    const std::vector<double>& ms = clock.frameMs;
+    fprintf(f, "{\n");
+    fprintf(f, "  \"frames\": %d, \"warmup\": %d, \"width\": %d, \"height\": %d, \"dt\": %.6f,\n",
+            int(ms.size()), cfg.warmup, cfg.width, cfg.height, cfg.dt);
+    fprintf(f, "  \"scene\": \"%s\", \"context\": \"%s\",\n", cfg.scene.c_str(), cfg.context.c_str());
+    fprintf(f, "  \"renderer\": \"%s\", \"version\": \"%s\",\n", cfg.renderer.c_str(), cfg.version.c_str());
+    fprintf(f, "  \"frameMs\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"max\": %.4f },\n",
+            mean(ms), percentile(ms, 50), percentile(ms, 95), percentile(ms, 99),
+            ms.empty() ? 0.0 : *std::min_element(ms.begin(), ms.end()),
+            ms.empty() ? 0.0 : *std::max_element(ms.begin(), ms.end()));
+    fprintf(f, "  \"passMs\": {");
+    for (int p = 0; p < kFramePasses; ++p) {
+        const std::vector<double>& v = clock.passMs[p];
+        fprintf(f, "%s\n    \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f }", p ? "," : "",
+                framePassName(p), mean(v), percentile(v, 50), percentile(v, 95), percentile(v, 99));
+    }
+    fprintf(f, "\n  },\n  \"gpuPassMs\": {");
+    for (int p = 0; p < kFramePasses; ++p)
+        fprintf(f, "%s\n    \"%s\": { \"mean\": %.4f }", p ? "," : "", framePassName(p), gpu.pass(p).overallAverage());
+    fprintf(f, ",\n    \"frame\": { \"mean\": %.4f }\n  },\n  \"gpuFrames\": %lld, \"gpuFramesDropped\": %lld\n}\n",
+            gpu.frame().overallAverage(), gpu.frame().count, gpu.dropped());
+}
@@ -0,0 +1,275 @@
+﻿// BlueNoise.h — void-and-cluster blue-noise textures (CPU, 2D/3D) with an on-disk cache
+// Ulichney, "The void-and-cluster method for dither array generation", 1993.
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "Jobs.h"
+
+// Incremental void-and-cluster state on an N^dims torus.
+// Energy is a truncated gaussian splatted in place whenever a point flips
+// (no FFT re-convolution). Cells are grouped in 64-cell tiles; each tile keeps
+// its tightest cluster / largest void and a segment tree over tiles gives the
+// global pick in O(log tiles), so one step costs ~ kernel taps + a few tiles.
+struct VoidAndCluster {
+    // which picks a flip has to keep exact; a phase that only removes points
+    // only lowers energies, so a tile whose densest point lies outside the
+    // kernel footprint keeps it and needs no rescan (and vice versa)
+    enum Track { Both, ClustersOnly, VoidsOnly };
+
+    int N = 0, dims = 2, count = 0;
+    int R = 1, Rz = 0;
+    int tileB = 8, tilesX = 0, tilesY = 0, tilesZ = 0, tileCount = 0, leaves = 1;
+    std::vector<float> kernel;            // (2Rz+1) x (2R+1) x (2R+1) weights
+    std::vector<unsigned char> bits;
+    std::vector<float> energy;
+    std::vector<int> treeOne, treeZero;   // best cell per subtree, -1 = none
+    std::vector<int> wx, wy, wz;          // scratch: wrapped footprint coords
+    std::vector<int> spanX, spanY, spanZ; // scratch: tiles under the footprint
+    int ones = 0;
+
+    VoidAndCluster(int n, int d, float sigma) : N(n), dims(d) {
+        count = dims == 3 ? N * N * N : N * N;
+        tileB = dims == 3 ? 4 : 8;                       // 64 cells either way
+        tilesX = (N + tileB - 1) / tileB;
+        tilesY = tilesX;
+        tilesZ = dims == 3 ? tilesX : 1;
+        tileCount = tilesX * tilesY * tilesZ;
+        while (leaves < tileCount) leaves <<= 1;
+
+        R = std::max(1, std::min(int(std::ceil(3.0f * sigma)), (N - 1) / 2));
+        Rz = dims == 3 ? R : 0;
+        for (int dz = -Rz; dz <= Rz; ++dz)
+            for (int dy = -R; dy <= R; ++dy)
+                for (int dx = -R; dx <= R; ++dx) {
+                    float r2 = float(dx * dx + dy * dy + dz * dz);
+                    kernel.push_back(std::exp(-r2 / (2.0f * sigma * sigma)));
+                }
+
+        bits.assign(count, 0);
+        energy.assign(count, 0.0f);
+        treeOne.assign(2 * leaves, -1);
+        treeZero.assign(2 * leaves, -1);
+    }
+
+    int wrap(int v) const { return (v % N + N) % N; }
+    int cellIndex(int x, int y, int z) const { return (z * N + y) * N + x; }
+
+    bool denser(int a, int b) const {   // tightest cluster among ones
+        if (a < 0) return false;
+        if (b < 0) return true;
+        return energy[a] > energy[b] || (energy[a] == energy[b] && a < b);
+    }
+    bool emptier(int a, int b) const {  // largest void among zeros
+        if (a < 0) return false;
+        if (b < 0) return true;
+        return energy[a] < energy[b] || (energy[a] == energy[b] && a < b);
+    }
+
+    void rescanTile(int t) {
+        int tx = t % tilesX, ty = (t / tilesX) % tilesY, tz = t / (tilesX * tilesY);
+        int z1 = dims == 3 ? std::min(N, (tz + 1) * tileB) : 1;
+        int bestOne = -1, bestZero = -1;
+        for (int z = tz * tileB; z < z1; ++z)
+            for (int y = ty * tileB; y < std::min(N, (ty + 1) * tileB); ++y)
+                for (int x = tx * tileB; x < std::min(N, (tx + 1) * tileB); ++x) {
+                    int i = cellIndex(x, y, z);
+                    if (bits[i]) { if (denser(i, bestOne)) bestOne = i; }
+                    else if (emptier(i, bestZero)) bestZero = i;
+                }
+        treeOne[leaves + t] = bestOne;
+        treeZero[leaves + t] = bestZero;
+    }
+
+    void pullUp(int node) {
+        int a = treeOne[2 * node], b = treeOne[2 * node + 1];
+        treeOne[node] = denser(b, a) ? b : a;
+        a = treeZero[2 * node]; b = treeZero[2 * node + 1];
+        treeZero[node] = emptier(b, a) ? b : a;
+    }
+
+    // energy from scratch (gather form, parallel) + all tiles + tree
+    void rebuild() {
+        jobs().parallelFor(0, count, [&](int lo, int hi) {
+            for (int i = lo; i < hi; ++i) {
+                int x = i % N, y = (i / N) % N, z = i / (N * N);
+                float e = 0.0f;
+                const float* k = kernel.data();
+                for (int dz = -Rz; dz <= Rz; ++dz)
+                    for (int dy = -R; dy <= R; ++dy)
+                        for (int dx = -R; dx <= R; ++dx, ++k)
+                            if (bits[cellIndex(wrap(x - dx), wrap(y - dy), dims == 3 ? wrap(z - dz) : 0)]) e += *k;
+                energy[i] = e;
+            }
+        }, 1024);
+        jobs().parallelFor(0, tileCount, [&](int lo, int hi) {
+            for (int t = lo; t < hi; ++t) rescanTile(t);
+        }, 16);
+        for (int n = leaves - 1; n >= 1; --n) pullUp(n);
+    }
+
+    bool inFootprint(int i, int x, int y, int z) const {
+        auto near = [&](int a, int b, int r) { int d = std::abs(a - b); return std::min(d, N - d) <= r; };
+        return near(i % N, x, R) && near((i / N) % N, y, R) && (dims != 3 || near(i / (N * N), z, Rz));
+    }
+
+    void flip(int i, Track track = Both) {
+        float sign = bits[i] ? -1.0f : 1.0f;
+        bits[i] ^= 1;
+        ones += bits[i] ? 1 : -1;
+
+        int x = i % N, y = (i / N) % N, z = i / (N * N);
+        wx.clear(); wy.clear(); wz.clear();
+        for (int d = -R; d <= R; ++d) { wx.push_back(wrap(x + d)); wy.push_back(wrap(y + d)); }
+        for (int d = -Rz; d <= Rz; ++d) wz.push_back(dims == 3 ? wrap(z + d) : 0);
+        const float* k = kernel.data();
+        for (int zz : wz)
+            for (int yy : wy) {
+                float* row = &energy[(zz * N + yy) * N];
+                for (int xx : wx) row[xx] += sign * *k++;
+            }
+
+        auto tileSpan = [&](const std::vector<int>& coords, std::vector<int>& out) {
+            out.clear();
+            for (int c : coords) out.push_back(c / tileB);
+            std::sort(out.begin(), out.end());
+            out.erase(std::unique(out.begin(), out.end()), out.end());
+        };
+        tileSpan(wx, spanX);
+        tileSpan(wy, spanY);
+        tileSpan(wz, spanZ);
+        for (int tz : spanZ) for (int ty : spanY) for (int tx : spanX) {
+            int t = (tz * tilesY + ty) * tilesX + tx;
+            int leaf = leaves + t;
+            if (track != Both) {
+                // i itself is in the footprint, so losing the best is covered too
+                int best = track == ClustersOnly ? treeOne[leaf] : treeZero[leaf];
+                if (best < 0 || !inFootprint(best, x, y, z)) continue;
+            }
+            rescanTile(t);
+            for (int n = leaf >> 1; n >= 1; n >>= 1) pullUp(n);
+        }
+    }
+
+    int tightestCluster() const { return treeOne[1]; }
+    int largestVoid() const { return treeZero[1]; }
+};
+
+// Ranks every cell of an N^dims torus (dims = 2 or 3) so that thresholding the
+// rank map at any level gives an evenly spread point set. Returns 0..N^dims-1.
+static std::vector<int> voidAndCluster(int N, int dims, float sigma, unsigned seed) {
+    FIRE_TRACE("voidAndCluster", "bake");
+    VoidAndCluster vac(N, dims, sigma);
+    const int count = vac.count;
+
+    // initial pattern: ~10% random points (same LCG as Perlin3D)
+    unsigned s = seed;
+    int initOnes = std::max(1, count / 10);
+    for (int placed = 0; placed < initOnes; ) {
+        s = s * 1664525u + 1013904223u;
+        int i = int((s >> 8) % unsigned(count));
+        if (!vac.bits[i]) { vac.bits[i] = 1; ++placed; }
+    }
+    vac.ones = initOnes;
+    vac.rebuild();
+
+    // relax: move the tightest cluster into the largest void until stable
+    for (;;) {
+        int c = vac.tightestCluster();
+        vac.flip(c);
+        int v = vac.largestVoid();
+        vac.flip(v);
+        if (v == c) break;
+    }
+
+    std::vector<int> rank(count, 0);
+
+    // Phase 1 (peel the initial pattern, densest first get the lowest ranks)
+    // and phases 2+3 (fill the largest voids up to N^dims) only share the
+    // initial pattern, so they run side by side. For a shift-invariant kernel
+    // the tightest cluster of the zeros is the largest void of the ones, which
+    // folds Ulichney's inverted phase 3 into the same loop as phase 2.
+    // The two phases write disjoint cells of `rank`.
+    const VoidAndCluster initial = vac;
+    jobs().parallelFor(0, 2, [&](int lo, int hi) {
+        for (int phase = lo; phase < hi; ++phase) {
+            VoidAndCluster st = initial;
+            if (phase == 0) {
+                for (int r = initOnes - 1; r >= 0; --r) {
+                    int c = st.tightestCluster();
+                    st.flip(c, VoidAndCluster::ClustersOnly);
+                    rank[c] = r;
+                }
+            } else {
+                for (int r = initOnes; r < count; ++r) {
+                    int v = st.largestVoid();
+                    st.flip(v, VoidAndCluster::VoidsOnly);
+                    rank[v] = r;
+                }
+            }
+        }
+    });
+    return rank;
+}
+
+struct BlueNoiseSpec {
+    int N = 64;
+    int dims = 2;
+    const char* cachePath = nullptr;
+};
+
+// 8-bit blue-noise texture, generated once and cached on disk.
+// Cache layout: "BNVC", int32 dims, int32 N, uint32 seed, float sigma, then N^dims bytes.
+static std::vector<unsigned char> loadOrMakeBlueNoise(const BlueNoiseSpec& spec) {
+    const int N = spec.N, dims = spec.dims;
+    const unsigned seed = 0xB1DEu;
+    const float sigma = 1.5f;
+    const int count = dims == 3 ? N * N * N : N * N;
+    std::vector<unsigned char> tex(count);
+
+    if (FILE* f = spec.cachePath ? std::fopen(spec.cachePath, "rb") : nullptr) {
+        char magic[4] = {}; int32_t d = 0, n = 0; uint32_t sd = 0; float sg = 0.0f;
+        bool ok = std::fread(magic, 1, 4, f) == 4 && std::string(magic, 4) == "BNVC"
+            && std::fread(&d, sizeof(d), 1, f) == 1 && d == dims
+            && std::fread(&n, sizeof(n), 1, f) == 1 && n == N
+            && std::fread(&sd, sizeof(sd), 1, f) == 1 && sd == seed
+            && std::fread(&sg, sizeof(sg), 1, f) == 1 && sg == sigma
+            && std::fread(tex.data(), 1, count, f) == size_t(count);
+        std::fclose(f);
+        if (ok) return tex;
+    }
+
+    std::vector<int> rank = voidAndCluster(N, dims, sigma, seed);
+    for (int i = 0; i < count; ++i)
+        tex[i] = (unsigned char)((long long)rank[i] * 256 / count);
+
+    if (!spec.cachePath) return tex;
+    if (FILE* f = std::fopen(spec.cachePath, "wb")) {
+        int32_t d = dims, n = N; uint32_t sd = seed; float sg = sigma;
+        std::fwrite("BNVC", 1, 4, f);
+        std::fwrite(&d, sizeof(d), 1, f);
+        std::fwrite(&n, sizeof(n), 1, f);
+        std::fwrite(&sd, sizeof(sd), 1, f);
+        std::fwrite(&sg, sizeof(sg), 1, f);
+        std::fwrite(tex.data(), 1, count, f);
+        std::fclose(f);
+    } else {
+        fprintf(stderr, "[WARN] could not write blue-noise cache %s\n", spec.cachePath);
+    }
+    return tex;
+}
+
+// Several textures (e.g. the 2D jitter tile and the 3D dither volume), one
+// after the other: each generator is parallel inside, and a parallelFor
+// nested in a job runs inline, so one job per texture would leave each on
+// a single thread.
+static std::vector<std::vector<unsigned char>> loadOrMakeBlueNoise(const std::vector<BlueNoiseSpec>& specs) {
+    std::vector<std::vector<unsigned char>> out(specs.size());
+    for (size_t i = 0; i < specs.size(); ++i) out[i] = loadOrMakeBlueNoise(specs[i]);
+    return out;
+}
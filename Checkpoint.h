@@ -0,0 +1,247 @@
+﻿// Checkpoint.h — simulation state snapshots in a memory-mapped file, for warm starts
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#undef APIENTRY             // glad's is the same __stdcall; let windows.h define it
+#include <windows.h>
+#undef near
+#undef far
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "Fluid.h"
+#include "Turbulence.h"
+
+// A whole file mapped into memory, read-only or created at a fixed size for
+// writing. The OS pages it in and out, so a checkpoint is written and read
+// with plain memcpys and no staging buffer.
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool openRead(const char* path) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) { close(); return false; }
+        size_ = size_t(size.QuadPart);
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (map_) data_ = static_cast<unsigned char*>(MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0));
+#else
+        fd_ = ::open(path, O_RDONLY);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || st.st_size == 0) { close(); return false; }
+        size_ = size_t(st.st_size);
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        data_ = p == MAP_FAILED ? nullptr : static_cast<unsigned char*>(p);
+#endif
+        if (!data_) { close(); return false; }
+        return true;
+    }
+
+    bool create(const char* path, size_t size) {
+        close();
+        size_ = size;
+        writable_ = true;
+#ifdef _WIN32
+        file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size), nullptr);
+        if (map_) data_ = static_cast<unsigned char*>(MapViewOfFile(map_, FILE_MAP_WRITE, 0, 0, 0));
+#else
+        fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) return false;
+        if (ftruncate(fd_, off_t(size)) != 0) { close(); return false; }
+        void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        data_ = p == MAP_FAILED ? nullptr : static_cast<unsigned char*>(p);
+#endif
+        if (!data_) { close(); return false; }
+        return true;
+    }
+
+    // unmaps; a written file is flushed first
+    void close() {
+#ifdef _WIN32
+        if (data_) {
+            if (writable_) FlushViewOfFile(data_, 0);
+            UnmapViewOfFile(data_);
+        }
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        map_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) {
+            if (writable_) msync(data_, size_, MS_SYNC);
+            munmap(data_, size_);
+        }
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        writable_ = false;
+    }
+
+    unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+    bool writable_ = false;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE, map_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// replaces `to` in one step, so a reader never sees half a checkpoint
+static bool replaceFile(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(from, to) == 0;
+#endif
+}
+
+// The state a running simulation cannot rebuild: the allocated tiles with
+// velocity, density and temperature, the step counter the source noise is
+// seeded from, and for detail its advected coordinates, amplitudes and
+// clock. Everything else (advection sources, curl, pressure) is rewritten
+// every step. Sections are 64-byte aligned: header, tile list, then each
+// field tile after tile, then the dense detail arrays.
+struct CheckpointHeader {
+    char magic[8];                  // "FIRECKPT"
+    uint32_t version, headerBytes;
+    int32_t N, amplify, tiles, pad0;
+    uint32_t frameSeed, resets;
+    float detailTime, weight[2], pad1;
+    uint64_t steps;
+};
+
+static const uint32_t kCheckpointVersion = 1;
+
+static size_t checkpointAlign(size_t x) { return (x + 63) & ~size_t(63); }
+
+// byte offsets of the sections for a simulation with `tiles` allocated
+struct CheckpointLayout {
+    size_t tileList, fields, detail, total;
+    CheckpointLayout(int N, int amplify, int tiles) {
+        tileList = checkpointAlign(sizeof(CheckpointHeader));
+        fields = checkpointAlign(tileList + size_t(tiles) * sizeof(int32_t));
+        size_t fieldBytes = size_t(tiles) * TileMap::B3 * sizeof(float);
+        detail = checkpointAlign(fields + 5 * fieldBytes);
+        total = detail + (amplify ? 7 * size_t(N) * N * N * sizeof(float) : 0);
+    }
+};
+
+// writes `path` through a temporary file; false if either step failed
+static bool saveCheckpoint(const char* path, const FluidSim& sim, const FluidDetail* detail, uint64_t steps) {
+    const std::vector<int>& active = sim.tiles.active;
+    const int amplify = detail ? detail->params.amplify : 0;
+    CheckpointLayout L(sim.N, amplify, int(active.size()));
+    const std::string tmp = std::string(path) + ".tmp";
+    {
+        MappedFile f;
+        if (!f.create(tmp.c_str(), L.total)) return false;
+        unsigned char* base = f.data();
+        CheckpointHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "FIRECKPT", 8);
+        h.version = kCheckpointVersion;
+        h.headerBytes = sizeof(h);
+        h.N = sim.N;
+        h.amplify = amplify;
+        h.tiles = int(active.size());
+        h.frameSeed = sim.frameSeed;
+        h.steps = steps;
+        if (detail) {
+            h.resets = detail->resets;
+            h.detailTime = detail->time;
+            h.weight[0] = detail->weight[0];
+            h.weight[1] = detail->weight[1];
+        }
+        std::memcpy(base, &h, sizeof(h));
+        std::memcpy(base + L.tileList, active.data(), active.size() * sizeof(int32_t));
+        const std::vector<float>* fields[5] = { &sim.u, &sim.v, &sim.w, &sim.density, &sim.temperature };
+        const size_t tileBytes = TileMap::B3 * sizeof(float);
+        for (int k = 0; k < 5; ++k) {
+            unsigned char* dst = base + L.fields + k * active.size() * tileBytes;
+            for (size_t a = 0; a < active.size(); ++a)
+                std::memcpy(dst + a * tileBytes, &(*fields[k])[sim.tiles.base(active[a])], tileBytes);
+        }
+        if (detail) {
+            const size_t bytes = size_t(sim.N) * sim.N * sim.N * sizeof(float);
+            for (int k = 0; k < 6; ++k) std::memcpy(base + L.detail + k * bytes, detail->coords[k].data(), bytes);
+            std::memcpy(base + L.detail + 6 * bytes, detail->amp.data(), bytes);
+        }
+    }
+    return replaceFile(tmp.c_str(), path);
+}
+
+// Restores a checkpoint written for the same grid and detail factor into a
+// freshly made simulation (and detail). Returns the steps it had taken, or
+// -1 with everything untouched if the file is missing or does not fit.
+static long long loadCheckpoint(const char* path, FluidSim& sim, FluidDetail* detail) {
+    MappedFile f;
+    if (!f.openRead(path) || f.size() < sizeof(CheckpointHeader)) return -1;
+    const unsigned char* base = f.data();
+    CheckpointHeader h;
+    std::memcpy(&h, base, sizeof(h));
+    const int amplify = detail ? detail->params.amplify : 0;
+    if (std::memcmp(h.magic, "FIRECKPT", 8) != 0 || h.version != kCheckpointVersion || h.headerBytes != sizeof(h)
+        || h.N != sim.N || h.amplify != amplify || h.tiles < 0 || h.tiles > sim.tiles.T * sim.tiles.T * sim.tiles.T)
+        return -1;
+    CheckpointLayout L(sim.N, amplify, h.tiles);
+    if (f.size() != L.total) return -1;
+    std::vector<int> list(h.tiles);
+    std::memcpy(list.data(), base + L.tileList, list.size() * sizeof(int32_t));
+    std::vector<unsigned char> want(sim.tiles.slot.size(), 0);
+    for (int t : list) {
+        if (t < 0 || t >= int(want.size())) return -1;
+        want[t] = 1;
+    }
+    sim.allocate(want);
+    std::vector<float>* fields[5] = { &sim.u, &sim.v, &sim.w, &sim.density, &sim.temperature };
+    const size_t tileBytes = TileMap::B3 * sizeof(float);
+    for (int k = 0; k < 5; ++k) {
+        const unsigned char* src = base + L.fields + k * list.size() * tileBytes;
+        for (size_t a = 0; a < list.size(); ++a)
+            std::memcpy(&(*fields[k])[sim.tiles.base(list[a])], src + a * tileBytes, tileBytes);
+    }
+    sim.frameSeed = h.frameSeed;
+    if (detail) {
+        const size_t bytes = size_t(sim.N) * sim.N * sim.N * sizeof(float);
+        for (int k = 0; k < 6; ++k) std::memcpy(detail->coords[k].data(), base + L.detail + k * bytes, bytes);
+        std::memcpy(detail->amp.data(), base + L.detail + 6 * bytes, bytes);
+        detail->resets = h.resets;
+        detail->time = h.detailTime;
+        detail->weight[0] = h.weight[0];
+        detail->weight[1] = h.weight[1];
+    }
+    return (long long)h.steps;
+}
@@ -0,0 +1,434 @@
+﻿// Fluid.h — stable-fluids smoke/fire solver on a tile-sparse N^3 grid (CPU, threaded)
+// Stam, "Stable Fluids", SIGGRAPH 1999; Fedkiw et al., "Visual Simulation of Smoke", 2001.
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+#include "Tiles.h"
+#include "Multigrid.h"
+
+enum class PressureSolver { Jacobi, Multigrid };
+enum class Advection { SemiLagrangian, MacCormack };
+
+// Lengths are in domain units ([0,1] across the grid), times in seconds.
+struct FluidParams {
+    float buoyancy = 1.6f;         // upward acceleration per unit temperature
+    float weight = 0.25f;          // downward acceleration per unit density
+    float vorticity = 0.35f;       // confinement strength (grid units)
+    float cooling = 1.2f;          // temperature decay rate, 1/s
+    float dissipation = 0.12f;     // density decay rate, 1/s
+    float emitX = 0.5f, emitY = 0.06f, emitZ = 0.5f;
+    float emitRadius = 0.09f;
+    float emitSpeed = 0.5f;        // upward velocity imposed inside the source
+    float emitJitter = 0.35f;      // random sideways kick inside the source
+    PressureSolver solver = PressureSolver::Multigrid;
+    Advection advection = Advection::MacCormack;
+    int pressureIters = 40;        // Jacobi sweeps per projection
+    int vcycles = 2;               // multigrid V-cycles per projection
+    bool halfPressure = false;     // store the pressure hierarchy as Half (see --report half)
+    bool sparse = true;            // false: keep every tile allocated (dense reference)
+    float activeThreshold = 1e-3f; // density or temperature that keeps a tile alive
+};
+
+// wall-clock per phase, accumulated until reset
+struct FluidTimings {
+    double advect = 0.0, forces = 0.0, project = 0.0;
+    int steps = 0;
+    double total() const { return advect + forces + project; }
+};
+
+// Collocated grid, velocity in cells per second. Walls on x, z and the floor
+// (zero normal velocity, Neumann pressure); the top is open (p = 0 outside).
+// Fields live in 8^3 tiles (Tiles.h). Each step allocates the tiles holding
+// smoke or heat plus a one-tile margin for it to move into; everything else
+// is still air at rest and costs neither memory nor time. Passes run over
+// the allocated tiles on the job pool, stencils read a 10^3 halo, and
+// passes that read neighbours write into a second buffer.
+struct FluidSim {
+    int N = 0;
+    FluidParams params;
+    FluidTimings timings;
+    TileMap tiles;
+    std::vector<float> u, v, w, density, temperature;
+    std::vector<float> u0, v0, w0, density0, temperature0;   // advection sources
+    std::vector<float> hat[5];                                 // MacCormack predictor (u, v, w, density, temperature)
+    std::vector<float> curlX, curlY, curlZ, curlLen;
+    MultigridSolver pressure;                                  // finest level: p, b = -div
+    MultigridSolverT<Half> pressureHalf;                       // used instead with params.halfPressure
+    std::vector<unsigned char> occupied, want;                 // per tile
+    uint32_t frameSeed = 0;
+
+    // n is rounded up to whole tiles
+    explicit FluidSim(int n, const FluidParams& p = FluidParams())
+        : N((n + TileMap::B - 1) / TileMap::B * TileMap::B), params(p), tiles(N), pressure(N), pressureHalf(N) {
+        updateTiles();
+    }
+
+    void step(float dt) {
+        FIRE_TRACE("fluid step", "sim");
+        auto t0 = std::chrono::steady_clock::now();
+        updateTiles();
+        addSources(dt);
+        addForces(dt);
+        enforceWalls();
+        auto t1 = std::chrono::steady_clock::now();
+        project();
+        auto t2 = std::chrono::steady_clock::now();
+        advect(dt);
+        enforceWalls();
+        auto t3 = std::chrono::steady_clock::now();
+        timings.forces += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        timings.project += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        timings.advect += std::chrono::duration<double, std::milli>(t3 - t2).count();
+        ++timings.steps;
+        ++frameSeed;
+    }
+
+    // bytes held by the field pools and the pressure hierarchy
+    size_t bytes() const {
+        size_t total = 0;
+        for (const std::vector<float>* f : { &u, &v, &w, &density, &temperature, &u0, &v0, &w0, &density0,
+                                             &temperature0, &curlX, &curlY, &curlZ, &curlLen })
+            total += f->capacity() * sizeof(float);
+        for (const std::vector<float>& f : hat) total += f.capacity() * sizeof(float);
+        auto levels = [&](const auto& solver) {
+            for (const auto& g : solver.levels)
+                total += (g.p.capacity() + g.b.capacity() + g.r.capacity() + g.prev.capacity()) * sizeof(g.p[0]);
+        };
+        levels(pressure);
+        levels(pressureHalf);
+        return total;
+    }
+
+    // (density, temperature) pairs of tile t, x fastest, for a GL_RG16F brick
+    void packTileRG(int t, Half* out) const {
+        const float* d = &density[tiles.base(t)];
+        const float* h = &temperature[tiles.base(t)];
+        float pair[8];
+        for (int i = 0; i < TileMap::B3; i += 4) {
+            for (int k = 0; k < 4; ++k) { pair[2 * k] = d[i + k]; pair[2 * k + 1] = h[i + k]; }
+            floatToHalf(pair, out + 2 * i, 8);
+        }
+    }
+
+    // ---- passes ----
+
+    bool inEmitter(int tile) const {
+        const FluidParams& P = params;
+        int ox, oy, oz;
+        tiles.tileOrigin(tile, ox, oy, oz);
+        float r = P.emitRadius * N + 1.0f, B = float(TileMap::B);
+        auto gap = [&](float c, int o) { return std::max(0.0f, std::max(o - c, c - (o + B))); };
+        float gx = gap(P.emitX * N, ox), gy = gap(P.emitY * N, oy), gz = gap(P.emitZ * N, oz);
+        return gx * gx + gy * gy + gz * gz < r * r;
+    }
+
+    // allocate the tiles that hold smoke or heat (or the source) and their
+    // 26 neighbours; the rest are dropped
+    void updateTiles() {
+        const int T = tiles.T;
+        occupied.assign(size_t(T) * T * T, 0);
+        want.assign(size_t(T) * T * T, params.sparse ? 0 : 1);
+        float eps = params.activeThreshold;
+        forTiles(tiles, [&](int t, size_t base, int, int, int) {
+            for (int i = 0; i < TileMap::B3; ++i)
+                if (density[base + i] > eps || temperature[base + i] > eps) { occupied[t] = 1; return; }
+        });
+        for (int t = 0; t < T * T * T; ++t) {
+            if (!occupied[t] && !inEmitter(t)) continue;
+            int tx = t % T, ty = t / T % T, tz = t / (T * T);
+            for (int dz = -1; dz <= 1; ++dz)
+                for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        int x = tx + dx, y = ty + dy, z = tz + dz;
+                        if (x >= 0 && x < T && y >= 0 && y < T && z >= 0 && z < T) want[tiles.tileIndex(x, y, z)] = 1;
+                    }
+        }
+        allocate(want);
+    }
+
+    // exactly the flagged tiles, in every pool and the pressure hierarchy
+    void allocate(const std::vector<unsigned char>& flags) {
+        tiles.assign(flags, { &u, &v, &w, &density, &temperature, &u0, &v0, &w0, &density0, &temperature0,
+                              &curlX, &curlY, &curlZ, &curlLen });
+        if (params.halfPressure) { if (pressureHalf.finest().allocate(flags)) pressureHalf.sync(); }
+        else if (pressure.finest().allocate(flags)) pressure.sync();
+        if (params.advection == Advection::MacCormack)   // fully overwritten before it is read
+            for (std::vector<float>& f : hat) f.resize(size_t(tiles.slots) * TileMap::B3);
+    }
+
+    void addSources(float dt) {
+        const FluidParams& P = params;
+        float cx = P.emitX * N, cy = P.emitY * N, cz = P.emitZ * N, r = P.emitRadius * N;
+        float keepD = std::exp(-P.dissipation * dt), keepT = std::exp(-P.cooling * dt);
+        float speed = P.emitSpeed * N, kick = P.emitJitter * N;
+        uint32_t seed = frameSeed * 0x9E3779B9u;
+        const int B = TileMap::B;
+        forTiles(tiles, [&](int t, size_t base, int ox, int oy, int oz) {
+            for (int i = 0; i < TileMap::B3; ++i) { density[base + i] *= keepD; temperature[base + i] *= keepT; }
+            if (!inEmitter(t)) return;
+            for (int lz = 0; lz < B; ++lz)
+                for (int ly = 0; ly < B; ++ly)
+                    for (int lx = 0; lx < B; ++lx) {
+                        int x = ox + lx, y = oy + ly, z = oz + lz;
+                        float dx = x + 0.5f - cx, dy = y + 0.5f - cy, dz = z + 0.5f - cz;
+                        float q = 1.0f - (dx * dx + dy * dy + dz * dz) / (r * r);
+                        if (q <= 0.0f) continue;
+                        size_t i = base + (lz * B + ly) * B + lx;
+                        density[i] = std::max(density[i], q);
+                        temperature[i] = std::max(temperature[i], q);
+                        v[i] = std::max(v[i], speed * q);
+                        uint32_t h = hash32(uint32_t((z * N + y) * N + x) ^ seed);
+                        u[i] += kick * q * (float(h & 0xFFFF) / 32768.0f - 1.0f);
+                        w[i] += kick * q * (float(h >> 16) / 32768.0f - 1.0f);
+                    }
+        });
+    }
+
+    // buoyancy + vorticity confinement
+    void addForces(float dt) {
+        FIRE_TRACE("forces", "sim");
+        const FluidParams& P = params;
+        const int B = TileMap::B;
+        forTiles(tiles, [&](int t, size_t base, int, int, int) {
+            float hu[1000], hv[1000], hw[1000];
+            tiles.gatherHalo(u, t, hu);
+            tiles.gatherHalo(v, t, hv);
+            tiles.gatherHalo(w, t, hw);
+            for (int z = 0; z < B; ++z)
+                for (int y = 0; y < B; ++y)
+                    for (int x = 0; x < B; ++x) {
+                        int h = haloIndex(x, y, z);
+                        float cx = 0.5f * ((hw[h + 10] - hw[h - 10]) - (hv[h + 100] - hv[h - 100]));
+                        float cy = 0.5f * ((hu[h + 100] - hu[h - 100]) - (hw[h + 1] - hw[h - 1]));
+                        float cz = 0.5f * ((hv[h + 1] - hv[h - 1]) - (hu[h + 10] - hu[h - 10]));
+                        size_t i = base + (z * B + y) * B + x;
+                        curlX[i] = cx; curlY[i] = cy; curlZ[i] = cz;
+                        curlLen[i] = std::sqrt(cx * cx + cy * cy + cz * cz);
+                    }
+        });
+        float lift = P.buoyancy * N, sink = P.weight * N, eps = P.vorticity;
+        forTiles(tiles, [&](int t, size_t base, int, int, int) {
+            float hc[1000];
+            tiles.gatherHalo(curlLen, t, hc);
+            for (int z = 0; z < B; ++z)
+                for (int y = 0; y < B; ++y)
+                    for (int x = 0; x < B; ++x) {
+                        int h = haloIndex(x, y, z);
+                        float gx = 0.5f * (hc[h + 1] - hc[h - 1]);
+                        float gy = 0.5f * (hc[h + 10] - hc[h - 10]);
+                        float gz = 0.5f * (hc[h + 100] - hc[h - 100]);
+                        float inv = 1.0f / (std::sqrt(gx * gx + gy * gy + gz * gz) + 1e-5f);
+                        gx *= inv; gy *= inv; gz *= inv;
+                        size_t i = base + (z * B + y) * B + x;
+                        u[i] += dt * eps * (gy * curlZ[i] - gz * curlY[i]);
+                        v[i] += dt * (eps * (gz * curlX[i] - gx * curlZ[i]) + lift * temperature[i] - sink * density[i]);
+                        w[i] += dt * eps * (gx * curlY[i] - gy * curlX[i]);
+                    }
+        });
+    }
+
+    void enforceWalls() {
+        const int B = TileMap::B;
+        forTiles(tiles, [&](int, size_t base, int ox, int oy, int oz) {
+            for (int lz = 0; lz < B; ++lz)
+                for (int ly = 0; ly < B; ++ly) {
+                    size_t row = base + (lz * B + ly) * B;
+                    if (ox == 0) u[row] = 0.0f;
+                    if (ox + B == N) u[row + B - 1] = 0.0f;
+                    if ((oz == 0 && lz == 0) || (oz + B == N && lz == B - 1))
+                        std::fill(w.begin() + row, w.begin() + row + B, 0.0f);
+                    if (oy == 0 && ly == 0) std::fill(v.begin() + row, v.begin() + row + B, 0.0f);
+                }
+        });
+    }
+
+    // b = -div(u) of the current velocity, as the Poisson right-hand side
+    // (g must have the same tiles allocated)
+    template<typename T>
+    void computeDivergence(PoissonGridT<T>& g) {
+        const int B = TileMap::B;
+        forTiles(tiles, [&](int t, size_t, int, int, int) {
+            float hu[1000], hv[1000], hw[1000];
+            tiles.gatherHalo(u, t, hu, Apron::Clamp, 1);   // each component only along its own axis
+            tiles.gatherHalo(v, t, hv, Apron::Clamp, 2);
+            tiles.gatherHalo(w, t, hw, Apron::Clamp, 4);
+            T* b = &g.b[g.tiles.base(t)];
+            for (int z = 0; z < B; ++z)
+                for (int y = 0; y < B; ++y) {
+                    const int h = haloIndex(0, y, z), o = (z * B + y) * B;
+#ifdef FIRE_SSE2
+                    for (int x = 0; x < B; x += 4) {
+                        __m128 div = _mm_sub_ps(_mm_loadu_ps(hu + h + x + 1), _mm_loadu_ps(hu + h + x - 1));
+                        div = _mm_add_ps(div, _mm_sub_ps(_mm_loadu_ps(hv + h + x + 10), _mm_loadu_ps(hv + h + x - 10)));
+                        div = _mm_add_ps(div, _mm_sub_ps(_mm_loadu_ps(hw + h + x + 100), _mm_loadu_ps(hw + h + x - 100)));
+                        store4(b + o + x, _mm_mul_ps(div, _mm_set1_ps(-0.5f)));
+                    }
+#else
+                    for (int x = 0; x < B; ++x) {
+                        float div = (hu[h + x + 1] - hu[h + x - 1]) + (hv[h + x + 10] - hv[h + x - 10]) + (hw[h + x + 100] - hw[h + x - 100]);
+                        fromFloat(-0.5f * div, b[o + x]);
+                    }
+#endif
+                }
+        });
+    }
+
+    // make the velocity divergence-free: solve lap(p) = div, u -= grad(p)
+    void project() {
+        FIRE_TRACE("project", "sim");
+        if (params.halfPressure) project(pressureHalf);
+        else project(pressure);
+    }
+
+    template<typename T>
+    void project(MultigridSolverT<T>& solver) {
+        PoissonGridT<T>& g = solver.finest();
+        computeDivergence(g);
+        std::fill(g.p.begin(), g.p.end(), T(0));
+        if (params.solver == PressureSolver::Jacobi) {
+            g.prev.resize(g.p.size());
+            for (int it = 0; it < params.pressureIters; ++it) {
+                std::swap(g.p, g.prev);
+                relaxJacobi(g, g.prev);
+            }
+        } else {
+            for (int c = 0; c < params.vcycles; ++c) solver.vcycle();
+        }
+        subtractGradient(g);
+    }
+
+    // u -= grad(p); walls mirror the cell, above the top and in unallocated tiles p = 0
+    template<typename T>
+    void subtractGradient(const PoissonGridT<T>& g) {
+        const int B = TileMap::B;
+        forTiles(tiles, [&](int t, size_t base, int, int, int) {
+            float hp[1000];
+            g.tiles.gatherHalo(g.p, t, hp, Apron::OpenTop);
+            for (int z = 0; z < B; ++z)
+                for (int y = 0; y < B; ++y) {
+                    const float* c = hp + haloIndex(0, y, z);
+                    const size_t o = base + (z * B + y) * B;
+#ifdef FIRE_SSE2
+                    const __m128 half = _mm_set1_ps(0.5f);
+                    for (int x = 0; x < B; x += 4) {
+                        __m128 gx = _mm_sub_ps(_mm_loadu_ps(c + x + 1), _mm_loadu_ps(c + x - 1));
+                        __m128 gy = _mm_sub_ps(_mm_loadu_ps(c + x + 10), _mm_loadu_ps(c + x - 10));
+                        __m128 gz = _mm_sub_ps(_mm_loadu_ps(c + x + 100), _mm_loadu_ps(c + x - 100));
+                        _mm_storeu_ps(&u[o + x], _mm_sub_ps(_mm_loadu_ps(&u[o + x]), _mm_mul_ps(half, gx)));
+                        _mm_storeu_ps(&v[o + x], _mm_sub_ps(_mm_loadu_ps(&v[o + x]), _mm_mul_ps(half, gy)));
+                        _mm_storeu_ps(&w[o + x], _mm_sub_ps(_mm_loadu_ps(&w[o + x]), _mm_mul_ps(half, gz)));
+                    }
+#else
+                    for (int x = 0; x < B; ++x) {
+                        u[o + x] -= 0.5f * (c[x + 1] - c[x - 1]);
+                        v[o + x] -= 0.5f * (c[x + 10] - c[x - 10]);
+                        w[o + x] -= 0.5f * (c[x + 100] - c[x - 100]);
+                    }
+#endif
+                }
+        });
+    }
+
+    // trilinear footprint of a position in cells, clamped to the grid: pool
+    // offsets of the 8 corners and their weights (unallocated corners weigh 0)
+    struct Footprint {
+        size_t o[8];
+        float wt[8];
+        unsigned holes;     // bit k: corner k is unallocated (o[k] is a dummy)
+        float corner(const float* f, int k) const { return (holes >> k & 1) ? 0.0f : f[o[k]]; }
+    };
+    void footprint(float px, float py, float pz, Footprint& fp) const {
+        const float hi = float(N - 1);
+        px = std::min(std::max(px, 0.0f), hi);
+        py = std::min(std::max(py, 0.0f), hi);
+        pz = std::min(std::max(pz, 0.0f), hi);
+        int ix = std::min(int(px), N - 2), iy = std::min(int(py), N - 2), iz = std::min(int(pz), N - 2);
+        float fx = px - ix, fy = py - iy, fz = pz - iz;
+        float gx = 1.0f - fx, gy = 1.0f - fy, gz = 1.0f - fz;
+        fp.holes = 0;
+        if ((ix & 7) < 7 && (iy & 7) < 7 && (iz & 7) < 7) {   // all 8 corners in one tile
+            int s = tiles.slot[tiles.tileAt(ix, iy, iz)];
+            size_t o = s < 0 ? 0 : size_t(s) * TileMap::B3 + TileMap::local(ix, iy, iz);
+            for (int k = 0; k < 8; ++k) {
+                fp.o[k] = o + (k & 1) + ((k >> 1) & 1) * TileMap::B + (k >> 2) * TileMap::B * TileMap::B;
+                fp.wt[k] = s < 0 ? 0.0f : ((k & 1) ? fx : gx) * ((k & 2) ? fy : gy) * ((k & 4) ? fz : gz);
+            }
+            if (s < 0) fp.holes = 0xFF;
+            return;
+        }
+        for (int k = 0; k < 8; ++k) {
+            int cx = ix + (k & 1), cy = iy + ((k >> 1) & 1), cz = iz + (k >> 2);
+            int s = tiles.slot[tiles.tileAt(cx, cy, cz)];
+            fp.o[k] = s < 0 ? 0 : size_t(s) * TileMap::B3 + TileMap::local(cx, cy, cz);
+            fp.wt[k] = s < 0 ? 0.0f : ((k & 1) ? fx : gx) * ((k & 2) ? fy : gy) * ((k & 4) ? fz : gz);
+            if (s < 0) fp.holes |= 1u << k;
+        }
+    }
+
+    // Semi-Lagrangian: trace each cell back along its velocity and resample
+    // all five fields with one set of trilinear weights.
+    // MacCormack (Selle et al., "An Unconditionally Stable MacCormack Method",
+    // 2008): trace the semi-Lagrangian result forward again, add back half of
+    // the round-trip error, and clamp to the corners the backward trace read
+    // so the correction cannot overshoot. Second order where the fields are
+    // smooth, about 2.5x the work.
+    void advect(float dt) {
+        FIRE_TRACE("advect", "sim");
+        std::swap(u, u0); std::swap(v, v0); std::swap(w, w0);
+        std::swap(density, density0); std::swap(temperature, temperature0);
+        const bool mac = params.advection == Advection::MacCormack;
+        const float* const src[5] = { u0.data(), v0.data(), w0.data(), density0.data(), temperature0.data() };
+        float* const dst[5] = { u.data(), v.data(), w.data(), density.data(), temperature.data() };
+        float* pred[5];
+        for (int f = 0; f < 5; ++f) pred[f] = mac ? hat[f].data() : dst[f];
+        const int B = TileMap::B;
+        forTiles(tiles, [&](int, size_t base, int ox, int oy, int oz) {
+            Footprint fp;
+            for (int lz = 0; lz < B; ++lz)
+                for (int ly = 0; ly < B; ++ly)
+                    for (int lx = 0; lx < B; ++lx) {
+                        size_t i = base + (lz * B + ly) * B + lx;
+                        footprint(ox + lx - dt * src[0][i], oy + ly - dt * src[1][i], oz + lz - dt * src[2][i], fp);
+                        float a0 = 0.0f, a1 = 0.0f, a2 = 0.0f, a3 = 0.0f, a4 = 0.0f;
+                        for (int k = 0; k < 8; ++k) {
+                            float wt = fp.wt[k];
+                            size_t o = fp.o[k];
+                            a0 += wt * src[0][o]; a1 += wt * src[1][o]; a2 += wt * src[2][o];
+                            a3 += wt * src[3][o]; a4 += wt * src[4][o];
+                        }
+                        pred[0][i] = a0; pred[1][i] = a1; pred[2][i] = a2; pred[3][i] = a3; pred[4][i] = a4;
+                    }
+        });
+        if (!mac) return;
+        forTiles(tiles, [&](int, size_t base, int ox, int oy, int oz) {
+            Footprint back, fwd;
+            for (int lz = 0; lz < B; ++lz)
+                for (int ly = 0; ly < B; ++ly)
+                    for (int lx = 0; lx < B; ++lx) {
+                        size_t i = base + (lz * B + ly) * B + lx;
+                        float x = float(ox + lx), y = float(oy + ly), z = float(oz + lz);
+                        float du = dt * src[0][i], dv = dt * src[1][i], dw = dt * src[2][i];
+                        footprint(x - du, y - dv, z - dw, back);
+                        footprint(x + du, y + dv, z + dw, fwd);
+                        for (int f = 0; f < 5; ++f) {
+                            const float* s = src[f];
+                            const float* p = pred[f];
+                            float lo = back.corner(s, 0), hi = lo, trip = 0.0f;
+                            if (!back.holes)
+                                for (int k = 1; k < 8; ++k) { lo = std::min(lo, s[back.o[k]]); hi = std::max(hi, s[back.o[k]]); }
+                            else
+                                for (int k = 1; k < 8; ++k) { lo = std::min(lo, back.corner(s, k)); hi = std::max(hi, back.corner(s, k)); }
+                            for (int k = 0; k < 8; ++k) trip += fwd.wt[k] * p[fwd.o[k]];
+                            dst[f][i] = std::min(std::max(p[i] + 0.5f * (s[i] - trip), lo), hi);
+                        }
+                    }
+        });
+    }
+};
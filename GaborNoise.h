@@ -0,0 +1,124 @@
+﻿// GaborNoise.h — sparse-convolution Gabor noise volume (anisotropic streaks)
+// Lagae et al., "Procedural Noise using Sparse Gabor Convolution", SIGGRAPH 2009.
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+
+struct GaborParams {
+    int cells = 8;                 // impulse grid cells across the volume (= kernel radius)
+    float frequency = 1.5f;        // cosine cycles per cell
+    float angle = 0.0f;            // frequency direction in the xy plane; 0 = x, i.e. vertical streaks
+    float spread = 0.2f;           // random deviation of the direction per impulse (radians)
+    unsigned seed = 7;
+};
+
+// Periodic N^3 Gabor noise, zero mean, unit variance.
+// Every cell of a cells^3 grid holds 8 impulses (deterministic per wrapped
+// cell, so the volume tiles); the gaussian envelope is cut at one cell, so a
+// voxel only sees the impulses of its 27 neighbouring cells, which are laid
+// out SoA and evaluated 4 at a time. z-slabs run in parallel.
+static std::vector<float> bakeGaborVolume(int N, const GaborParams& gp) {
+    FIRE_TRACE("bakeGaborVolume", "bake");
+    const int C = gp.cells, K = 8;
+    const float kPiA2 = 2.9957323f;               // pi*a^2: envelope = 0.05 at one cell
+    const float omega = 6.28318531f * gp.frequency;
+
+    // SoA impulse table, [cell][attribute][K]
+    enum { PX, PY, PZ, WX, WY, WZ, PHASE, WEIGHT, ATTRS };
+    std::vector<float> imp(size_t(C) * C * C * ATTRS * K);
+    for (int c = 0; c < C * C * C; ++c) {
+        uint32_t s = uint32_t(c) * 747796405u + gp.seed * 2891336453u + 1u;
+        auto uniform = [&]() {   // PCG-style hash stream per cell
+            s = s * 747796405u + 2891336453u;
+            uint32_t w = ((s >> ((s >> 28) + 4)) ^ s) * 277803737u;
+            return float((w >> 22) ^ w) / 4294967296.0f;
+        };
+        float* dst = &imp[size_t(c) * ATTRS * K];
+        for (int k = 0; k < K; ++k) {
+            float th = gp.angle + gp.spread * (2.0f * uniform() - 1.0f);
+            float tilt = 0.5f * gp.spread * (2.0f * uniform() - 1.0f);
+            dst[PX * K + k] = uniform();
+            dst[PY * K + k] = uniform();
+            dst[PZ * K + k] = uniform();
+            dst[WX * K + k] = omega * std::cos(th) * std::cos(tilt);
+            dst[WY * K + k] = omega * std::sin(th) * std::cos(tilt);
+            dst[WZ * K + k] = omega * std::sin(tilt);
+            dst[PHASE * K + k] = 6.28318531f * uniform();
+            dst[WEIGHT * K + k] = 2.0f * uniform() - 1.0f;
+        }
+    }
+
+    std::vector<float> vol(size_t(N) * N * N);
+    const float toCell = float(C) / float(N);
+    auto wrap = [C](int v) { return (v % C + C) % C; };
+
+    std::vector<double> sums(size_t(N) * 2, 0.0);
+    jobs().parallelFor(0, N, [&](int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            double s1 = 0.0, s2 = 0.0;
+            for (int y = 0; y < N; ++y)
+                for (int x = 0; x < N; ++x) {
+                    float p[3] = { (x + 0.5f) * toCell, (y + 0.5f) * toCell, (z + 0.5f) * toCell };
+                    int cx = (int)p[0], cy = (int)p[1], cz = (int)p[2];
+                    float sum = 0.0f;
+#ifdef FIRE_SSE2
+                    __m128 acc = _mm_setzero_ps();
+#endif
+                    for (int dz = -1; dz <= 1; ++dz)
+                    for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        const float* cell = &imp[size_t((wrap(cz + dz) * C + wrap(cy + dy)) * C + wrap(cx + dx)) * ATTRS * K];
+                        // voxel relative to this (unwrapped) cell's origin
+                        float rx = p[0] - float(cx + dx), ry = p[1] - float(cy + dy), rz = p[2] - float(cz + dz);
+#ifdef FIRE_SSE2
+                        const __m128 vx = _mm_set1_ps(rx), vy = _mm_set1_ps(ry), vz = _mm_set1_ps(rz);
+                        for (int k = 0; k < K; k += 4) {
+                            __m128 ddx = _mm_sub_ps(vx, _mm_loadu_ps(cell + PX * K + k));
+                            __m128 ddy = _mm_sub_ps(vy, _mm_loadu_ps(cell + PY * K + k));
+                            __m128 ddz = _mm_sub_ps(vz, _mm_loadu_ps(cell + PZ * K + k));
+                            __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ddx, ddx), _mm_mul_ps(ddy, ddy)), _mm_mul_ps(ddz, ddz));
+                            __m128 inside = _mm_cmplt_ps(r2, _mm_set1_ps(1.0f));
+                            if (_mm_movemask_ps(inside) == 0) continue;
+                            __m128 env = exp_ps(_mm_mul_ps(r2, _mm_set1_ps(-kPiA2)));
+                            __m128 arg = _mm_add_ps(_mm_loadu_ps(cell + PHASE * K + k),
+                                _mm_add_ps(_mm_add_ps(_mm_mul_ps(ddx, _mm_loadu_ps(cell + WX * K + k)),
+                                                      _mm_mul_ps(ddy, _mm_loadu_ps(cell + WY * K + k))),
+                                           _mm_mul_ps(ddz, _mm_loadu_ps(cell + WZ * K + k))));
+                            __m128 g = _mm_mul_ps(_mm_mul_ps(env, cos_ps(arg)), _mm_loadu_ps(cell + WEIGHT * K + k));
+                            acc = _mm_add_ps(acc, _mm_and_ps(g, inside));
+                        }
+#else
+                        for (int k = 0; k < K; ++k) {
+                            float ddx = rx - cell[PX * K + k], ddy = ry - cell[PY * K + k], ddz = rz - cell[PZ * K + k];
+                            float r2 = ddx * ddx + ddy * ddy + ddz * ddz;
+                            if (r2 >= 1.0f) continue;
+                            float arg = cell[PHASE * K + k] + ddx * cell[WX * K + k] + ddy * cell[WY * K + k] + ddz * cell[WZ * K + k];
+                            sum += cell[WEIGHT * K + k] * std::exp(-kPiA2 * r2) * std::cos(arg);
+                        }
+#endif
+                    }
+#ifdef FIRE_SSE2
+                    sum += hsum_ps(acc);
+#endif
+                    vol[(size_t(z) * N + y) * N + x] = sum;
+                    s1 += sum; s2 += double(sum) * sum;
+                }
+            sums[2 * z] = s1; sums[2 * z + 1] = s2;
+        }
+    });
+
+    double s1 = 0.0, s2 = 0.0;
+    for (int z = 0; z < N; ++z) { s1 += sums[2 * z]; s2 += sums[2 * z + 1]; }
+    double count = double(N) * N * N, mean = s1 / count, var = s2 / count - mean * mean;
+    float inv = var > 0.0 ? float(1.0 / std::sqrt(var)) : 0.0f;
+    jobs().parallelFor(0, N, [&](int z0, int z1) {
+        for (size_t i = size_t(z0) * N * N; i < size_t(z1) * N * N; ++i) vol[i] = (vol[i] - float(mean)) * inv;
+    });
+    return vol;
+}
@@ -0,0 +1,110 @@
+﻿// GpuTimers.h — per-pass GPU times from timestamp queries read back frames later, with rolling statistics
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+// The passes a frame is split into, in order.
+enum class FramePass { Upload, Fire, Smoke, Resolve, Composite, Count };
+
+static const int kFramePasses = int(FramePass::Count);
+
+static const char* framePassName(int p) {
+    static const char* names[] = { "upload", "fire", "smoke", "resolve", "composite" };
+    return names[p];
+}
+
+// The last Window samples, for averages and peaks that follow the scene,
+// plus a plain sum over everything since reset() for a run's total.
+struct RollingStats {
+    static const int Window = 120;
+    float samples[Window] = {};
+    int filled = 0, next = 0;
+    double sum = 0.0;
+    long long count = 0;
+
+    void push(float x) {
+        samples[next] = x;
+        next = (next + 1) % Window;
+        if (filled < Window) ++filled;
+        sum += x;
+        ++count;
+    }
+    float average() const {
+        float s = 0.0f;
+        for (int i = 0; i < filled; ++i) s += samples[i];
+        return filled ? s / float(filled) : 0.0f;
+    }
+    float peak() const {
+        float m = 0.0f;
+        for (int i = 0; i < filled; ++i) m = std::max(m, samples[i]);
+        return m;
+    }
+    double overallAverage() const { return count ? sum / double(count) : 0.0; }
+    void reset() { *this = RollingStats(); }
+};
+
+// A GL_TIMESTAMP query at the start of the frame and after every pass,
+// in a ring of Latency frames. A frame's stamps are read only once the GL
+// says the last of them is available, oldest frame first, so reading
+// never waits on the GPU. A frame still in flight when its slot comes
+// round again is dropped rather than waited for. finish() reads back every
+// frame still pending, waiting if need be, for when no frame loop is left
+// to stall (the end of a benchmark, or the end of its warm-up).
+class GpuTimers {
+public:
+    static const int Latency = 4;
+    static const int Stamps = kFramePasses + 1;
+
+    void init() { glGenQueries(Latency * Stamps, &queries_[0][0]); }
+    void release() { glDeleteQueries(Latency * Stamps, &queries_[0][0]); }
+
+    void beginFrame() {
+        collect();
+        slot_ = int(frame_ % Latency);
+        if (pending_[slot_]) { pending_[slot_] = false; ++dropped_; }
+        glQueryCounter(queries_[slot_][0], GL_TIMESTAMP);
+    }
+    // the pass that was just submitted
+    void mark(FramePass pass) { glQueryCounter(queries_[slot_][int(pass) + 1], GL_TIMESTAMP); }
+    void endFrame() {
+        pending_[slot_] = true;
+        ++frame_;
+    }
+    void finish() { collect(true); }
+
+    // milliseconds per pass and for the whole frame, over the frames read back
+    const RollingStats& pass(int p) const { return pass_[p]; }
+    const RollingStats& frame() const { return total_; }
+    long long dropped() const { return dropped_; }
+
+    void reset() {
+        for (RollingStats& s : pass_) s.reset();
+        total_.reset();
+        dropped_ = 0;
+    }
+
+private:
+    void collect(bool wait = false) {
+        for (long long f = std::max(0LL, frame_ - Latency); f < frame_; ++f) {
+            int s = int(f % Latency);
+            if (!pending_[s]) continue;
+            GLuint ready = wait ? 1 : 0;
+            if (!wait) glGetQueryObjectuiv(queries_[s][Stamps - 1], GL_QUERY_RESULT_AVAILABLE, &ready);
+            if (!ready) break;   // later frames are not done either
+            GLuint64 t[Stamps];
+            for (int i = 0; i < Stamps; ++i) glGetQueryObjectui64v(queries_[s][i], GL_QUERY_RESULT, &t[i]);
+            for (int p = 0; p < kFramePasses; ++p) pass_[p].push(float(double(t[p + 1] - t[p]) * 1e-6));
+            total_.push(float(double(t[Stamps - 1] - t[0]) * 1e-6));
+            pending_[s] = false;
+        }
+    }
+
+    GLuint queries_[Latency][Stamps] = {};
+    bool pending_[Latency] = {};
+    long long frame_ = 0, dropped_ = 0;
+    int slot_ = 0;
+    RollingStats pass_[kFramePasses], total_;
+};
@@ -0,0 +1,120 @@
+﻿// Hud.h — on-screen overlay: text and bars drawn on the CPU into a small image shown as one texture
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <vector>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+#include "GpuTimers.h"
+
+// 3x5 pixel glyphs, one row per 3 bits from the top, for the characters of
+// kHudChars; anything else draws as a space and lowercase as uppercase
+static const char* kHudChars = " %-./0123456789:ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const uint16_t kHudGlyphs[] = {
+    0x0000, 0x52A5, 0x01C0, 0x0002, 0x12A4, 0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF,
+    0x7252, 0x7BEF, 0x7BCF, 0x0410, 0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B, 0x5BED,
+    0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D, 0x2B6A, 0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492,
+    0x5B6F, 0x5B6A, 0x5BFD, 0x5AAD, 0x5A92, 0x72A7,
+};
+
+// RGBA8, premultiplied, first row at the top. Text is drawn at twice the
+// glyph size: 6x10 pixels on an 8x14 cell.
+struct Hud {
+    static const int Scale = 2, Advance = 4 * Scale, LineHeight = 7 * Scale;
+    int w = 0, h = 0;
+    std::vector<uint32_t> px;
+    GLuint tex = 0;
+
+    void init(int width, int height) {
+        w = width; h = height;
+        px.assign(size_t(w) * h, 0);
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, px.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    void release() {
+        if (tex) glDeleteTextures(1, &tex);
+        tex = 0;
+    }
+
+    static uint32_t rgba(int r, int g, int b, int a = 255) {
+        // premultiplied, bytes in memory order R, G, B, A
+        return uint32_t(r * a / 255) | uint32_t(g * a / 255) << 8 | uint32_t(b * a / 255) << 16 | uint32_t(a) << 24;
+    }
+
+    void fill(int x, int y, int fw, int fh, uint32_t c) {
+        for (int j = std::max(0, y); j < std::min(h, y + fh); ++j)
+            for (int i = std::max(0, x); i < std::min(w, x + fw); ++i) px[size_t(j) * w + i] = c;
+    }
+
+    void text(int x, int y, const char* s, uint32_t c) {
+        for (; *s; ++s, x += Advance) {
+            const char* at = std::strchr(kHudChars, std::toupper((unsigned char)*s));
+            uint16_t g = at ? kHudGlyphs[at - kHudChars] : 0;
+            for (int row = 0; row < 5; ++row)
+                for (int col = 0; col < 3; ++col)
+                    if (g >> (14 - 3 * row - col) & 1) fill(x + col * Scale, y + row * Scale, Scale, Scale, c);
+        }
+    }
+
+    void upload() {
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, px.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+
+static uint32_t framePassColor(int p) {
+    static const uint32_t colors[] = { Hud::rgba(150, 150, 150), Hud::rgba(255, 140, 40), Hud::rgba(120, 180, 255),
+                                       Hud::rgba(110, 220, 120), Hud::rgba(200, 130, 255) };
+    return colors[p];
+}
+
+// The GPU time of every pass (average and peak over the last frames read
+// back), the whole frame on the GPU and on the CPU, and a bar stacking
+// the pass averages against a 60 Hz budget (doubled until they fit).
+static void drawTimingHud(Hud& hud, const GpuTimers& gpu, const RollingStats& cpuFrame) {
+    const uint32_t text = Hud::rgba(230, 230, 230), dim = Hud::rgba(150, 150, 150);
+    hud.fill(0, 0, hud.w, hud.h, Hud::rgba(0, 0, 0, 170));
+    char line[64];
+    int x = 6, y = 6;
+    hud.text(x, y, "GPU MS          AVG    MAX", dim);
+    y += Hud::LineHeight;
+    for (int p = 0; p < kFramePasses; ++p) {
+        hud.fill(x, y, 2 * Hud::Scale, 5 * Hud::Scale, framePassColor(p));
+        snprintf(line, sizeof(line), "%-10s %6.2f %6.2f", framePassName(p), gpu.pass(p).average(), gpu.pass(p).peak());
+        hud.text(x + 2 * Hud::Advance, y, line, text);
+        y += Hud::LineHeight;
+    }
+    snprintf(line, sizeof(line), "  %-10s %6.2f %6.2f", "frame", gpu.frame().average(), gpu.frame().peak());
+    hud.text(x, y, line, text);
+    y += Hud::LineHeight;
+    snprintf(line, sizeof(line), "  %-10s %6.2f %6.2f", "cpu", cpuFrame.average(), cpuFrame.peak());
+    hud.text(x, y, line, text);
+    y += Hud::LineHeight + 2;
+
+    float budget = 1000.0f / 60.0f;
+    while (gpu.frame().average() > budget) budget *= 2.0f;
+    const int barW = hud.w - 2 * x, barH = 8;
+    hud.fill(x, y, barW, barH, Hud::rgba(40, 40, 40, 220));
+    float at = 0.0f;
+    for (int p = 0; p < kFramePasses; ++p) {
+        float len = gpu.pass(p).average() / budget * barW;
+        hud.fill(x + int(at), y, std::max(0, int(at + len) - int(at)), barH, framePassColor(p));
+        at += len;
+    }
+    y += barH + 4;
+    snprintf(line, sizeof(line), "BAR %.1f MS", budget);
+    hud.text(x, y, line, dim);
+}
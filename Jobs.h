@@ -0,0 +1,125 @@
+﻿// Jobs.h — small fork-join worker pool for slab-parallel CPU kernels
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include "Trace.h"
+
+// Persistent workers + the calling thread split a range into chunks.
+// parallelFor() blocks until every chunk is done. Calls coming from inside a
+// job run inline, so kernels can nest without deadlocking.
+class JobPool {
+public:
+    explicit JobPool(int threads = 0) { start(threads); }
+    ~JobPool() { stop(); }
+
+    int threads() const { return int(workers_.size()) + 1; }
+
+    // 0 = one per hardware thread (FIRE_THREADS overrides)
+    void resize(int threads) {
+        std::lock_guard<std::mutex> submit(submitMutex_);
+        stop();
+        start(threads);
+    }
+
+    // fn(lo, hi) over [begin, end); chunks are at least `grain` items
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& fn, int grain = 1) {
+        int n = end - begin;
+        if (n <= 0) return;
+        if (insideJob() || workers_.empty() || n <= grain) { fn(begin, end); return; }
+
+        std::lock_guard<std::mutex> submit(submitMutex_);
+        Task task;
+        task.fn = &fn; task.begin = begin; task.end = end;
+        task.label = traceCurrent();
+        task.chunks = std::min((n + grain - 1) / grain, threads() * 4);
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            task_ = &task;
+            ++generation_;
+        }
+        wake_.notify_all();
+        runChunks(task);
+        // every claimed chunk belongs to a worker that is still counted active
+        std::unique_lock<std::mutex> lk(mutex_);
+        done_.wait(lk, [&] { return active_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    struct Task {
+        const std::function<void(int, int)>* fn = nullptr;
+        int begin = 0, end = 0, chunks = 0;
+        const char* label = nullptr;   // the submitter's trace scope, for the chunks' events
+        std::atomic<int> next{ 0 };
+    };
+
+    static bool& insideJob() { static thread_local bool inside = false; return inside; }
+
+    void start(int threads) {
+        if (threads <= 0) {
+            const char* env = std::getenv("FIRE_THREADS");
+            threads = env ? std::atoi(env) : int(std::thread::hardware_concurrency());
+        }
+        threads = std::max(1, threads);
+        quit_ = false;
+        for (int i = 1; i < threads; ++i) workers_.emplace_back([this, i] { traceThreadName("worker %d", i); workerLoop(); });
+    }
+
+    void stop() {
+        { std::lock_guard<std::mutex> lk(mutex_); quit_ = true; }
+        wake_.notify_all();
+        for (std::thread& t : workers_) t.join();
+        workers_.clear();
+    }
+
+    static void runChunks(Task& t) {
+        bool wasInside = insideJob();
+        insideJob() = true;
+        int n = t.end - t.begin;
+        for (int c; (c = t.next.fetch_add(1)) < t.chunks; ) {
+            int lo = t.begin + int((long long)n * c / t.chunks);
+            int hi = t.begin + int((long long)n * (c + 1) / t.chunks);
+            TraceScope chunk(t.label ? t.label : "job", "job");
+            (*t.fn)(lo, hi);
+        }
+        insideJob() = wasInside;
+    }
+
+    void workerLoop() {
+        unsigned seen = 0;
+        for (;;) {
+            Task* t;
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                wake_.wait(lk, [&] { return quit_ || (task_ && generation_ != seen); });
+                if (quit_) return;
+                seen = generation_;
+                t = task_;
+                ++active_;
+            }
+            runChunks(*t);
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                if (--active_ == 0) done_.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex submitMutex_, mutex_;
+    std::condition_variable wake_, done_;
+    Task* task_ = nullptr;
+    int active_ = 0;
+    unsigned generation_ = 0;
+    bool quit_ = false;
+};
+
+static JobPool& jobs() { static JobPool pool; return pool; }
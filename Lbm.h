@@ -0,0 +1,343 @@
+﻿// Lbm.h — D3Q19 lattice-Boltzmann smoke: in-place AA-pattern streaming, SoA populations, SSE collision
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+#include "Tiles.h"
+
+struct LbmParams {
+    float tau = 0.53f;             // BGK relaxation time; viscosity (tau - 1/2) / 3, lattice units
+    float buoyancy = 1.5e-3f;      // upward force per unit temperature, lattice units
+    float weight = 3e-5f;          // downward force per unit density
+    float cooling = 1.2f;          // temperature decay rate, 1/s
+    float dissipation = 0.12f;     // density decay rate, 1/s
+    float emitX = 0.5f, emitY = 0.06f, emitZ = 0.5f;   // same source as FluidParams
+    float emitRadius = 0.09f;
+    float emitJitter = 0.02f;      // random sideways velocity given to the source, lattice units
+    float stepsPerSecond = 120.0f; // lattice steps per simulated second, taken in pairs
+    float maxSpeed = 0.25f;        // the equilibrium velocity is clamped to this (stability)
+};
+
+// wall-clock per phase, accumulated until reset
+struct LbmTimings {
+    double lattice = 0.0, scalars = 0.0;
+    long long updates = 0;         // lattice cell updates
+    int steps = 0;                 // step() calls
+    double total() const { return lattice + scalars; }
+    double mlups() const { return lattice > 0.0 ? updates / (lattice * 1000.0) : 0.0; }
+};
+
+// D3Q19 with BGK collision on an N^3 box: walls on x, z and the floor
+// (bounce-back), the top open to still air at rest density. The 19
+// populations are structure of arrays over an (N+2)^3 grid with a
+// one-cell ghost shell, and streamed in place with the AA pattern (Bailey
+// et al., "Accelerating lattice Boltzmann fluid flow simulations using
+// graphics processors", 2009), so one copy of the lattice is all the
+// memory there is:
+//   even step: read f_i(x) from slot i of x, collide, write f*_i to slot
+//              opp(i) of x
+//   odd step:  read f_i(x) from slot opp(i) of x - e_i, collide, write f*_i
+//              to slot i of x + e_i
+// Every slot is read and written by one cell only, so slabs run in
+// parallel with no second buffer and no barrier inside a step. Stream and
+// collide are one pass either way. The boundaries only touch the ghost
+// shell: before an odd step each ghost link gets the value the fluid cell
+// will read from it, after it the fluid cell gets back what it sent into
+// the ghost. Smoke density and temperature are passive scalars carried by
+// the lattice velocity (semi-Lagrangian, once per step()); temperature
+// and density push back through a body force (velocity shift).
+struct LbmSim {
+    static const int Q = 19;
+    int N = 0, P = 0;                   // edge, padded edge
+    size_t cells = 0;                   // P^3
+    LbmParams params;
+    LbmTimings timings;
+    std::vector<float> f;               // Q x cells
+    std::vector<float> ux, uy, uz;      // velocity of the last lattice step, lattice units
+    std::vector<float> density, temperature, scratch;
+    uint32_t frameSeed = 0;
+    int parity = 0;                     // 0: the next lattice step is even
+
+    explicit LbmSim(int n) : N((std::max(16, n) + 7) / 8 * 8), P(N + 2), cells(size_t(P) * P * P) {
+        f.resize(Q * cells);
+        for (int i = 0; i < Q; ++i) std::fill(f.begin() + i * cells, f.begin() + (i + 1) * cells, weight(i));
+        for (std::vector<float>* v : { &ux, &uy, &uz, &density, &temperature, &scratch }) v->assign(cells, 0.0f);
+        for (int i = 0; i < Q; ++i) offset[i] = (dir(i, 2) * P + dir(i, 1)) * P + dir(i, 0);
+        findLinks();
+    }
+
+    size_t index(int x, int y, int z) const { return (size_t(z) * P + y) * P + x; }   // padded coordinates
+
+    // lattice steps for dt seconds, always an even count so the populations
+    // end up in their own slots; then sources and the smoke
+    void step(float dt) {
+        FIRE_TRACE("lbm step", "sim");
+        const int pairs = std::max(1, int(dt * params.stepsPerSecond * 0.5f + 0.5f));
+        auto t0 = std::chrono::steady_clock::now();
+        addSources();
+        for (int k = 0; k < 2 * pairs; ++k) latticeStep(k == 2 * pairs - 1);
+        auto t1 = std::chrono::steady_clock::now();
+        advectScalars(dt, float(2 * pairs));
+        auto t2 = std::chrono::steady_clock::now();
+        timings.lattice += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        timings.scalars += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        timings.updates += 2LL * pairs * N * N * N;
+        ++timings.steps;
+        ++frameSeed;
+    }
+
+    // one stream-collide pass over the whole lattice; `store` keeps the velocity
+    void latticeStep(bool store) {
+        if (parity) fillGhosts();
+        jobs().parallelFor(1, N + 1, [&](int lo, int hi) {
+            DenormalGuard ftz;
+            for (int z = lo; z < hi; ++z)
+                for (int y = 1; y <= N; ++y) {
+                    if (parity) streamCollideRow<true>(index(1, y, z), store);
+                    else streamCollideRow<false>(index(1, y, z), store);
+                }
+        });
+        if (parity) drainGhosts();
+        parity ^= 1;
+    }
+
+    // (density, temperature) pairs of texture brick b, x fastest, for a GL_RG16F brick
+    void packBrickRG(int b, Half* out) const {
+        const int B = TileMap::B, T = N / B;
+        const int ox = b % T * B, oy = b / T % T * B, oz = b / (T * T) * B;
+        float pair[2 * TileMap::B];
+        for (int z = 0; z < B; ++z)
+            for (int y = 0; y < B; ++y) {
+                size_t c = index(ox + 1, oy + y + 1, oz + z + 1);
+                for (int x = 0; x < B; ++x) { pair[2 * x] = density[c + x]; pair[2 * x + 1] = temperature[c + x]; }
+                floatToHalf(pair, out + (z * B + y) * B * 2, 2 * B);
+            }
+    }
+
+    // texture bricks holding smoke or heat, ascending
+    void smokeBricks(std::vector<int>& out) const {
+        const int B = TileMap::B, T = N / B;
+        std::vector<unsigned char> live(size_t(T) * T * T, 0);
+        jobs().parallelFor(0, T * T * T, [&](int lo, int hi) {
+            for (int b = lo; b < hi; ++b) {
+                const int ox = b % T * B, oy = b / T % T * B, oz = b / (T * T) * B;
+                for (int z = 0; z < B && !live[b]; ++z)
+                    for (int y = 0; y < B && !live[b]; ++y) {
+                        size_t c = index(ox + 1, oy + y + 1, oz + z + 1);
+                        for (int x = 0; x < B; ++x)
+                            if (density[c + x] > 1e-3f || temperature[c + x] > 1e-3f) { live[b] = 1; break; }
+                    }
+            }
+        });
+        out.clear();
+        for (int b = 0; b < T * T * T; ++b) if (live[b]) out.push_back(b);
+    }
+
+    // bytes of populations per cell with this scheme, and with two lattices
+    static size_t bytesPerCell() { return Q * sizeof(float); }
+    static size_t bytesPerCellTwoLattice() { return 2 * Q * sizeof(float); }
+
+    static int dir(int i, int axis) {
+        static const int E[Q][3] = {
+            { 0, 0, 0 },
+            { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+            { 1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { -1, 1, 0 },
+            { 1, 0, 1 }, { -1, 0, -1 }, { 1, 0, -1 }, { -1, 0, 1 },
+            { 0, 1, 1 }, { 0, -1, -1 }, { 0, 1, -1 }, { 0, -1, 1 } };
+        return E[i][axis];
+    }
+    static int opposite(int i) { return i == 0 ? 0 : (i & 1) ? i + 1 : i - 1; }
+    static float weight(int i) { return i == 0 ? 1.0f / 3.0f : i <= 6 ? 1.0f / 18.0f : 1.0f / 36.0f; }
+
+private:
+    // a fluid cell next to the ghost shell: population i reaches `fluid`
+    // from `ghost` = fluid - e_i
+    struct Link { size_t ghost, fluid; int i; bool open; };
+    std::vector<Link> links;
+    long offset[Q];                     // e_i as an index offset
+
+    void findLinks() {
+        for (int z = 0; z < P; ++z)
+            for (int y = 0; y < P; ++y)
+                for (int x = 0; x < P; ++x) {
+                    if (x > 0 && x <= N && y > 0 && y <= N && z > 0 && z <= N) continue;
+                    for (int i = 1; i < Q; ++i) {
+                        int fx = x + dir(i, 0), fy = y + dir(i, 1), fz = z + dir(i, 2);
+                        if (fx < 1 || fx > N || fy < 1 || fy > N || fz < 1 || fz > N) continue;
+                        links.push_back({ index(x, y, z), index(fx, fy, fz), i, y == P - 1 });
+                    }
+                }
+    }
+
+    // population i at rest density moving with the cell's velocity
+    float equilibrium(int i, size_t c) const {
+        const float u[3] = { ux[c], uy[c], uz[c] };
+        float eu = dir(i, 0) * u[0] + dir(i, 1) * u[1] + dir(i, 2) * u[2];
+        return weight(i) * (1.0f + 3.0f * eu + 4.5f * eu * eu - 1.5f * (u[0] * u[0] + u[1] * u[1] + u[2] * u[2]));
+    }
+
+    // before an odd step: what the fluid cell reads from slot opp(i) of the ghost
+    void fillGhosts() {
+        for (const Link& l : links) {
+            const int o = opposite(l.i);
+            f[o * cells + l.ghost] = l.open ? equilibrium(l.i, l.fluid)
+                                            : f[l.i * cells + l.fluid];   // bounce-back: what it sent, f*_opp(i), sits in slot i
+        }
+    }
+    // after it: the fluid cell's population i comes back from what it
+    // wrote into the ghost's slot opp(i)
+    void drainGhosts() {
+        for (const Link& l : links)
+            f[l.i * cells + l.fluid] = l.open ? equilibrium(l.i, l.fluid) : f[opposite(l.i) * cells + l.ghost];
+    }
+
+    template<bool Odd>
+    void streamCollideRow(size_t row, bool store) {
+        const LbmParams& Pm = params;
+        const float omega = 1.0f / Pm.tau;
+        float* F = f.data();
+        const size_t C = cells;
+        int x = 0;
+#ifdef FIRE_SSE2
+        const __m128 om = _mm_set1_ps(omega), tau = _mm_set1_ps(Pm.tau), one = _mm_set1_ps(1.0f);
+        const __m128 beta = _mm_set1_ps(Pm.buoyancy), kappa = _mm_set1_ps(Pm.weight);
+        const __m128 vmax2 = _mm_set1_ps(Pm.maxSpeed * Pm.maxSpeed);
+        for (; x + 4 <= N; x += 4) {
+            const size_t c = row + x;
+            __m128 fi[Q];
+            for (int i = 0; i < Q; ++i)
+                fi[i] = _mm_loadu_ps(Odd ? F + opposite(i) * C + c - offset[i] : F + i * C + c);
+            __m128 rho = fi[0], mx = _mm_setzero_ps(), my = mx, mz = mx;
+            for (int i = 1; i < Q; ++i) {
+                rho = _mm_add_ps(rho, fi[i]);
+                if (dir(i, 0)) mx = dir(i, 0) > 0 ? _mm_add_ps(mx, fi[i]) : _mm_sub_ps(mx, fi[i]);
+                if (dir(i, 1)) my = dir(i, 1) > 0 ? _mm_add_ps(my, fi[i]) : _mm_sub_ps(my, fi[i]);
+                if (dir(i, 2)) mz = dir(i, 2) > 0 ? _mm_add_ps(mz, fi[i]) : _mm_sub_ps(mz, fi[i]);
+            }
+            const __m128 inv = _mm_div_ps(one, rho);
+            __m128 u = _mm_mul_ps(mx, inv), v = _mm_mul_ps(my, inv), w = _mm_mul_ps(mz, inv);
+            // buoyancy as a velocity shift of the equilibrium; the fluid
+            // moves with half the force added
+            __m128 fy = _mm_sub_ps(_mm_mul_ps(beta, _mm_loadu_ps(&temperature[c])), _mm_mul_ps(kappa, _mm_loadu_ps(&density[c])));
+            __m128 dv = _mm_mul_ps(fy, inv);
+            if (store) {
+                _mm_storeu_ps(&ux[c], u);
+                _mm_storeu_ps(&uy[c], _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(0.5f), dv)));
+                _mm_storeu_ps(&uz[c], w);
+            }
+            v = _mm_add_ps(v, _mm_mul_ps(tau, dv));
+            __m128 u2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)), _mm_mul_ps(w, w));
+            __m128 over = _mm_cmpgt_ps(u2, vmax2);
+            if (_mm_movemask_ps(over)) {
+                __m128 s = _mm_sqrt_ps(_mm_div_ps(vmax2, _mm_max_ps(u2, vmax2)));
+                u = _mm_mul_ps(u, s); v = _mm_mul_ps(v, s); w = _mm_mul_ps(w, s);
+                u2 = _mm_min_ps(u2, vmax2);
+            }
+            const __m128 base = _mm_sub_ps(one, _mm_mul_ps(_mm_set1_ps(1.5f), u2));
+            for (int i = 0; i < Q; ++i) {
+                __m128 eu = _mm_setzero_ps();
+                if (dir(i, 0)) eu = dir(i, 0) > 0 ? _mm_add_ps(eu, u) : _mm_sub_ps(eu, u);
+                if (dir(i, 1)) eu = dir(i, 1) > 0 ? _mm_add_ps(eu, v) : _mm_sub_ps(eu, v);
+                if (dir(i, 2)) eu = dir(i, 2) > 0 ? _mm_add_ps(eu, w) : _mm_sub_ps(eu, w);
+                __m128 poly = _mm_add_ps(base, _mm_mul_ps(eu, _mm_add_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(4.5f), eu))));
+                __m128 feq = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(weight(i)), rho), poly);
+                __m128 out = _mm_add_ps(fi[i], _mm_mul_ps(om, _mm_sub_ps(feq, fi[i])));
+                _mm_storeu_ps(Odd ? F + i * C + c + offset[i] : F + opposite(i) * C + c, out);
+            }
+        }
+#endif
+        for (; x < N; ++x) {
+            const size_t c = row + x;
+            float fi[Q], rho = 0.0f, m[3] = { 0, 0, 0 };
+            for (int i = 0; i < Q; ++i) {
+                fi[i] = Odd ? F[opposite(i) * C + c - offset[i]] : F[i * C + c];
+                rho += fi[i];
+                for (int a = 0; a < 3; ++a) m[a] += dir(i, a) * fi[i];
+            }
+            float u[3] = { m[0] / rho, m[1] / rho, m[2] / rho };
+            const float dv = (Pm.buoyancy * temperature[c] - Pm.weight * density[c]) / rho;
+            if (store) { ux[c] = u[0]; uy[c] = u[1] + 0.5f * dv; uz[c] = u[2]; }
+            u[1] += Pm.tau * dv;
+            float u2 = u[0] * u[0] + u[1] * u[1] + u[2] * u[2];
+            if (u2 > Pm.maxSpeed * Pm.maxSpeed) {
+                float s = Pm.maxSpeed / std::sqrt(u2);
+                for (float& a : u) a *= s;
+                u2 = Pm.maxSpeed * Pm.maxSpeed;
+            }
+            for (int i = 0; i < Q; ++i) {
+                float eu = dir(i, 0) * u[0] + dir(i, 1) * u[1] + dir(i, 2) * u[2];
+                float feq = weight(i) * rho * (1.0f + 3.0f * eu + 4.5f * eu * eu - 1.5f * u2);
+                float out = fi[i] + omega * (feq - fi[i]);
+                if (Odd) F[i * C + c + offset[i]] = out;
+                else F[opposite(i) * C + c] = out;
+            }
+        }
+    }
+
+    // Smoke and heat in the source, and a random sideways kick there. The
+    // populations are in their own slots between steps, so the kick is
+    // the first-order change of the equilibrium: f_i += 3 w_i rho e_i . du.
+    void addSources() {
+        const LbmParams& Pm = params;
+        const float cx = Pm.emitX * N, cy = Pm.emitY * N, cz = Pm.emitZ * N, r = Pm.emitRadius * N;
+        const uint32_t seed = frameSeed * 0x9E3779B9u;
+        const int x0 = std::max(0, int(cx - r)), x1 = std::min(N - 1, int(cx + r));
+        const int y0 = std::max(0, int(cy - r)), y1 = std::min(N - 1, int(cy + r));
+        const int z0 = std::max(0, int(cz - r)), z1 = std::min(N - 1, int(cz + r));
+        for (int z = z0; z <= z1; ++z)
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x) {
+                    float dx = x + 0.5f - cx, dy = y + 0.5f - cy, dz = z + 0.5f - cz;
+                    float q = 1.0f - (dx * dx + dy * dy + dz * dz) / (r * r);
+                    if (q <= 0.0f) continue;
+                    size_t c = index(x + 1, y + 1, z + 1);
+                    density[c] = std::max(density[c], q);
+                    temperature[c] = std::max(temperature[c], q);
+                    uint32_t h = hash32(uint32_t((z * N + y) * N + x) ^ seed);
+                    float du[3] = { Pm.emitJitter * q * (float(h & 0xFFFF) / 32768.0f - 1.0f), 0.0f,
+                                    Pm.emitJitter * q * (float(h >> 16) / 32768.0f - 1.0f) };
+                    float rho = 0.0f;
+                    for (int i = 0; i < Q; ++i) rho += f[i * cells + c];
+                    for (int i = 1; i < Q; ++i)
+                        f[i * cells + c] += 3.0f * weight(i) * rho * (dir(i, 0) * du[0] + dir(i, 2) * du[2]);
+                }
+    }
+
+    // density and temperature back along the velocity over `steps` lattice
+    // steps (trilinear), then decayed; the ghost shell stays 0
+    void advectScalars(float dt, float steps) {
+        const float keepD = std::exp(-params.dissipation * dt), keepT = std::exp(-params.cooling * dt);
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<float>& q = pass ? temperature : density;
+            const float keep = pass ? keepT : keepD;
+            jobs().parallelFor(1, N + 1, [&](int lo, int hi) {
+                DenormalGuard ftz;
+                for (int z = lo; z < hi; ++z)
+                    for (int y = 1; y <= N; ++y)
+                        for (int x = 1; x <= N; ++x) {
+                            size_t c = index(x, y, z);
+                            float px = std::min(std::max(x - steps * ux[c], 0.0f), float(N + 1) - 1e-3f);
+                            float py = std::min(std::max(y - steps * uy[c], 0.0f), float(N + 1) - 1e-3f);
+                            float pz = std::min(std::max(z - steps * uz[c], 0.0f), float(N + 1) - 1e-3f);
+                            int ix = int(px), iy = int(py), iz = int(pz);
+                            float fx = px - ix, fy = py - iy, fz = pz - iz;
+                            const float* s = &q[index(ix, iy, iz)];
+                            const size_t sy = P, sz = size_t(P) * P;
+                            float a = s[0] + fx * (s[1] - s[0]);
+                            float b = s[sy] + fx * (s[sy + 1] - s[sy]);
+                            float d = s[sz] + fx * (s[sz + 1] - s[sz]);
+                            float e = s[sz + sy] + fx * (s[sz + sy + 1] - s[sz + sy]);
+                            float lo2 = a + fy * (b - a), hi2 = d + fy * (e - d);
+                            scratch[c] = keep * (lo2 + fz * (hi2 - lo2));
+                        }
+            });
+            q.swap(scratch);
+        }
+    }
+};
@@ -1,19 +1,36 @@
 ﻿// main.cpp — Animated Fire & Smoke with 3D Perlin Noise (OpenGL + GLFW + GLAD)
-// g++ main.cpp glad.c -lglfw -ldl -std=c++17 -O2   (Linux/Mac)
+// g++ main.cpp glad.c -lglfw -ldl -pthread -std=c++17 -O2   (Linux/Mac)
 // cl /std:c++17 main.cpp glad.obj glfw3.lib opengl32.lib gdi32.lib user32.lib (Windows)
 
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <array>
 #include <chrono>
 #include <algorithm>
+#include <memory>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include "BlueNoise.h"
+#include "Noise.h"
+#include "GaborNoise.h"
+#include "Fluid.h"
+#include "Turbulence.h"
+#include "Upload.h"
+#include "SimThread.h"
+#include "Reports.h"
+#include "GpuTimers.h"
+#include "Hud.h"
+#include "Bench.h"
+#include "Pacing.h"
+#include "Startup.h"
+#include "AllocTracker.h"
+
 // ---------- tiny helpers ----------
 template<typename T>
 static T clamp01(T v) { return v < T(0) ? T(0) : (v > T(1) ? T(1) : v); } // avoids std::clamp hassle
@@ -64,72 +81,12 @@ static GLuint makeProgram(const char* vsSrc, const char* fsSrc) {
     return p;
 }
 
-// ---------- 3D Perlin noise (CPU) ----------
-static float fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
-static float lerp(float a, float b, float t) { return a + (b - a) * t; }
-
-static float grad(int hash, float x, float y, float z) {
-    int h = hash & 15;
-    float u = h < 8 ? x : y;
-    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
-    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
-}
-
-struct Perlin3D {
-    std::array<int, 512> p;
-    Perlin3D(unsigned seed = 1337) {
-        std::vector<int> perm(256);
-        for (int i = 0; i < 256; ++i) perm[i] = i;
-        // simple LCG shuffle
-        unsigned s = seed;
-        for (int i = 255; i > 0; --i) {
-            s = s * 1664525u + 1013904223u;
-            int j = s % (i + 1);
-            std::swap(perm[i], perm[j]);
-        }
-        for (int i = 0; i < 512; ++i) p[i] = perm[i & 255];
-    }
-    float noise(float x, float y, float z) const {
-        int X = (int)floorf(x) & 255, Y = (int)floorf(y) & 255, Z = (int)floorf(z) & 255;
-        x -= floorf(x); y -= floorf(y); z -= floorf(z);
-        float u = fade(x), v = fade(y), w = fade(z);
-        int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
-        int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
-
-        float res = lerp(
-            lerp(lerp(grad(p[AA], x, y, z),
-                grad(p[BA], x - 1, y, z), u),
-                lerp(grad(p[AB], x, y - 1, z),
-                    grad(p[BB], x - 1, y - 1, z), u), v),
-            lerp(lerp(grad(p[AA + 1], x, y, z - 1),
-                grad(p[BA + 1], x - 1, y, z - 1), u),
-                lerp(grad(p[AB + 1], x, y - 1, z - 1),
-                    grad(p[BB + 1], x - 1, y - 1, z - 1), u), v),
-            w);
-        // bring to [0,1]
-        return 0.5f * (res + 1.0f);
-    }
-};
-
-static GLuint make3DNoiseTex(int N, int octaves, float lacunarity, float gain, unsigned seed) {
-    Perlin3D per(seed);
-    std::vector<unsigned char> vox(N * N * N);
-    float invN = 1.0f / float(N);
-    for (int z = 0; z < N; ++z) {
-        for (int y = 0; y < N; ++y) {
-            for (int x = 0; x < N; ++x) {
-                float fx = x * invN, fy = y * invN, fz = z * invN;
-                // fBm
-                float f = 0.0f, amp = 1.0f, freq = 1.0f;
-                for (int o = 0; o < octaves; ++o) {
-                    f += amp * per.noise(fx * freq * 8.0f, fy * freq * 8.0f, fz * freq * 8.0f);
-                    freq *= lacunarity; amp *= gain;
-                }
-                f = clamp01(f / 1.5f); // normalize a bit
-                vox[(z * N + y) * N + x] = (unsigned char)std::round(f * 255.0f);
-            }
-        }
-    }
+// ---------- 3D noise texture ----------
+// RG8 texels from bakeNoiseTexels (Noise.h): R = fBm, G = Gabor streaks
+static GLuint make3DNoiseTex(int N, int octaves, float lacunarity, float gain, unsigned seed,
+                             const std::vector<unsigned char>& dither, int ditherN,
+                             NoiseBasis basis = NoiseBasis::Perlin) {
+    std::vector<unsigned char> vox = bakeNoiseTexels(N, octaves, lacunarity, gain, seed, dither, ditherN, basis);
     GLuint tex; glGenTextures(1, &tex);
     glBindTexture(GL_TEXTURE_3D, tex);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -138,11 +95,115 @@ static GLuint make3DNoiseTex(int N, int octaves, float lacunarity, float gain, u
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, N, N, N, 0, GL_RED, GL_UNSIGNED_BYTE, vox.data());
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RG8, N, N, N, 0, GL_RG, GL_UNSIGNED_BYTE, vox.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return tex;
+}
+
+// ---------- simulated field (Fluid.h): R = density, G = temperature ----------
+static GLuint makeFieldTex(int N) {
+    GLuint tex; glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_3D, tex);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    // half floats: density and temperature live in [0, ~1] and the ray
+    // marcher filters them, so 11 bits of mantissa are plenty and the
+    // per-frame brick traffic halves
+    std::vector<Half> zero(size_t(N) * N * N * 2, 0);   // tiles are uploaded only while allocated
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RG16F, N, N, N, 0, GL_RG, GL_HALF_FLOAT, zero.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return tex;
+}
+
+// Pixel-unpack buffers the planned texels are staged in: glTexSubImage3D
+// from a buffer returns at once and the driver copies on its own time.
+// Frames rotate through three so a buffer is not rewritten while an upload
+// from it may still be in flight.
+struct UploadRing {
+    GLuint pbo[3] = {};
+    size_t size[3] = {};
+    int next = 0;
+};
+
+static void streamBricks(GLuint tex, BrickUploader& up, UploadRing& ring) {
+    up.plan();
+    if (up.regions.empty()) return;
+    const size_t bytes = up.bytes();
+    int k = ring.next;
+    ring.next = (k + 1) % 3;
+    if (!ring.pbo[k]) glGenBuffers(1, &ring.pbo[k]);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.pbo[k]);
+    if (ring.size[k] < bytes) {
+        ring.size[k] = bytes;
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(bytes), nullptr, GL_STREAM_DRAW);
+    }
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(bytes),
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    check(dst != nullptr, "mapping the upload buffer failed");
+    up.write(dst);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindTexture(GL_TEXTURE_3D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    const int B = TileMap::B;
+    for (const BrickUploader::Region& r : up.regions)
+        glTexSubImage3D(GL_TEXTURE_3D, 0, r.x * B, r.y * B, r.z * B, r.w * B, r.h * B, r.d * B,
+                        GL_RG, GL_HALF_FLOAT, (const void*)r.offset);
     glBindTexture(GL_TEXTURE_3D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// ---------- blue noise (ray start jitter, volume dithering) ----------
+static const int BLUE_NOISE_SIZE = 64;     // 2D tile, must match "& 63" in FRAG_SMOKE
+static const int BLUE_NOISE_3D_SIZE = 32;
+
+static GLuint makeBlueNoiseTex(const std::vector<unsigned char>& bn) {
+    GLuint tex; glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, bn.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
     return tex;
 }
 
+// ---------- offscreen color target (smoke accumulation) ----------
+struct ColorTarget {
+    GLuint fbo = 0, tex = 0;
+    int w = 0, h = 0;
+};
+
+static ColorTarget makeColorTarget(int w, int h) {
+    ColorTarget t; t.w = w; t.h = h;
+    glGenTextures(1, &t.tex);
+    glBindTexture(GL_TEXTURE_2D, t.tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glGenFramebuffers(1, &t.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, t.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t.tex, 0);
+    check(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "Smoke target incomplete");
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return t;
+}
+
+static void destroyColorTarget(ColorTarget& t) {
+    if (t.fbo) glDeleteFramebuffers(1, &t.fbo);
+    if (t.tex) glDeleteTextures(1, &t.tex);
+    t = ColorTarget();
+}
+
 // ---------- fullscreen-ish quad (vertical billboard) ----------
 static GLuint makeUnitQuadVAO() {
     float vboData[] = {
@@ -196,6 +257,9 @@ static const char* FRAG_FIRE = R"(#version 330 core
 out vec4 FragColor;
 in vec2 vUV;
 uniform sampler3D uNoise;
+uniform sampler3D uField;     // симуляция: R = плотность, G = температура
+uniform float uUseField;      // 1 = брать температуру из симуляции вместо шума
+uniform vec4  uFieldMap;      // uv билборда -> xy симуляции: uv * xy + zw
 uniform float uTime, uScale, uSpeed, uSoftEdge, uIntensity;
 
 vec3 fireColor(float t){
@@ -235,6 +299,8 @@ void main(){
     float z = uTime * uSpeed;
     vec3 p = vec3((uv.x + wobble) * uScale, uv.y * uScale, z);
     float n = texture(uNoise, p).r;
+    if (uUseField > 0.5)
+        n = texture(uField, vec3(uv * uFieldMap.xy + uFieldMap.zw, 0.5)).g;
 
     float baseBoost = smoothstep(0.0, 0.28, 1.0 - uv.y);
     float t = clamp(n*1.18 + baseBoost*0.32, 0.0, 1.0);
@@ -252,18 +318,28 @@ static const char* FRAG_SMOKE = R"(#version 330 core
 out vec4 FragColor;
 in vec2 vUV;
 uniform sampler3D uNoise;
+uniform sampler2D uBlueNoise;
 uniform float uTime;
 uniform float uScale;
 uniform float uSpeed;
 uniform float uSoftEdge;
 uniform float uOpacity;
+uniform float uDepth;   // толщина столба дыма в координатах шума
+uniform int   uSteps;   // шагов вдоль луча
+uniform float uJitter;  // 0 = без джиттера, 1 = blue-noise джиттер
+uniform int   uFrame;
+uniform float uStreaks; // доля анизотропных полос (канал G, Gabor)
+uniform sampler3D uField;
+uniform float uUseField;
+uniform vec4  uFieldMap;
+uniform float uFieldDepth; // толщина луча в координатах симуляции
 
 void main(){
     vec2 uv = vUV;
 
     // лёгкая волна (оставляем как было)
-    float wave = sin(uv.y * 8.0 + uTime * 0.8) * 0.1 +
-                 sin(uv.y * 3.5 + uTime * 0.4) * 0.05;
+    float wave = (sin(uv.y * 8.0 + uTime * 0.8) * 0.1 +
+                  sin(uv.y * 3.5 + uTime * 0.4) * 0.05) * (1.0 - uUseField);
 
     float dx = abs(uv.x - 0.5 - wave);
     float halfW = 0.35;
@@ -271,43 +347,336 @@ void main(){
 
     // ✔ Правильная маска (без инвертированных краёв) — никакой чёрной линии по центру
     float mask = 1.0 - smoothstep(halfW - edge, halfW, dx);
+    mask = mix(mask, 1.0, uUseField);   // у симуляции своя форма
 
     // движение шума
     float z = uTime * uSpeed;
     vec3 p = vec3(uv.x * uScale + wave, uv.y * uScale, z);
-    float n = texture(uNoise, p).r;
 
     // ослабление и осветление кверху
     float fadeUp = smoothstep(0.0, 1.0, uv.y);
-    float density = clamp(n * 1.2 - 0.25 + (1.0 - fadeUp) * 0.15, 0.0, 1.0);
+
+    // луч сквозь столб по глубине; старт сдвигается blue noise,
+    // повёрнутым золотым сечением каждый кадр (для временного накопления)
+    float bn = texelFetch(uBlueNoise, ivec2(gl_FragCoord.xy) & 63, 0).r;
+    float jitter = mix(0.5, fract(bn + float(uFrame) * 0.61803398875), uJitter);
+    float dt = 1.0 / float(uSteps);
+    float density = 0.0;
+    vec2 q = uv * uFieldMap.xy + uFieldMap.zw;
+    for (int i = 0; i < uSteps; ++i) {
+        if (uUseField > 0.5) {
+            // дым = остывший газ: горячая часть светится как огонь
+            float s = (float(i) + jitter) * dt - 0.5;
+            vec2 f = texture(uField, vec3(q, 0.5 + s * uFieldDepth)).rg;
+            density += clamp((f.r - f.g) * 5.0, 0.0, 1.0);
+            continue;
+        }
+        vec2 ng = texture(uNoise, p + vec3(0.0, 0.0, (float(i) + jitter) * dt * uDepth)).rg;
+        float n = mix(ng.r, ng.r + (ng.g - 0.5), uStreaks);
+        density += clamp(n * 1.2 - 0.25 + (1.0 - fadeUp) * 0.15, 0.0, 1.0);
+    }
+    density *= dt;
 
     float a = mask * density * uOpacity;
     vec3  c = mix(vec3(0.2), vec3(0.55), fadeUp) * density;
 
-    FragColor = vec4(c, a);
+    FragColor = vec4(c * a, a);   // premultiplied, composited later
+}
+)";
+
+// fullscreen triangle from gl_VertexID (no attributes)
+static const char* VERT_FULLSCREEN = R"(#version 330 core
+out vec2 vUV;
+void main(){
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    vUV = pos;
+    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// temporal accumulation: reproject history through the smoke billboard
+// transform of the previous frame, clamp to the current 3x3 neighbourhood, blend
+static const char* FRAG_RESOLVE = R"(#version 330 core
+out vec4 FragColor;
+in vec2 vUV;
+uniform sampler2D uCurrent;
+uniform sampler2D uHistory;
+uniform float uBlend;      // вес текущего кадра
+uniform vec4  uCurXform;   // aspect, height, width, offset.y   (offset.x = 0)
+uniform vec4  uPrevXform;
+uniform float uTime, uPrevTime;
+uniform float uWave;       // 0, когда дым из симуляции (без волны)
+
+float wave(float y, float t){
+    return (sin(y * 8.0 + t * 0.8) * 0.1 + sin(y * 3.5 + t * 0.4) * 0.05) * uWave;
+}
+
+void main(){
+    vec2 ndc = vUV * 2.0 - 1.0;
+
+    // экран -> uv билборда (обратное к VERT)
+    vec2 uv;
+    uv.x = ndc.x * uCurXform.x / uCurXform.z + 0.5;
+    uv.y = ((ndc.y + 1.0) * 0.5 - uCurXform.w) / uCurXform.y;
+
+    // дым привязан к линии волны — следуем за ней
+    uv.x += wave(uv.y, uPrevTime) - wave(uv.y, uTime);
+
+    // uv -> экран прошлого кадра
+    vec2 prevNdc;
+    prevNdc.x = (uv.x - 0.5) * uPrevXform.z / uPrevXform.x;
+    prevNdc.y = -1.0 + (uv.y * uPrevXform.y + uPrevXform.w) * 2.0;
+    vec2 prevUV = prevNdc * 0.5 + 0.5;
+
+    ivec2 ip = ivec2(gl_FragCoord.xy);
+    ivec2 maxI = textureSize(uCurrent, 0) - 1;
+    vec4 cur = texelFetch(uCurrent, ip, 0);
+    vec4 lo = cur, hi = cur;
+    for (int y = -1; y <= 1; ++y)
+    for (int x = -1; x <= 1; ++x) {
+        vec4 s = texelFetch(uCurrent, clamp(ip + ivec2(x, y), ivec2(0), maxI), 0);
+        lo = min(lo, s); hi = max(hi, s);
+    }
+
+    vec4 hist = texture(uHistory, prevUV);
+    bool offscreen = any(lessThan(prevUV, vec2(0.0))) || any(greaterThan(prevUV, vec2(1.0)));
+    hist = offscreen ? cur : clamp(hist, lo, hi);
+
+    FragColor = mix(hist, cur, uBlend);
+}
+)";
+
+static const char* FRAG_COMPOSITE = R"(#version 330 core
+out vec4 FragColor;
+in vec2 vUV;
+uniform sampler2D uSmoke;
+void main(){
+    FragColor = texture(uSmoke, vUV);
+}
+)";
+
+// the timing overlay (Hud.h): a quad over uRect (NDC x0, y0, x1, y1), image top row at the top
+static const char* VERT_HUD = R"(#version 330 core
+out vec2 vUV;
+uniform vec4 uRect;
+void main(){
+    vec2 c = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vUV = vec2(c.x, 1.0 - c.y);
+    gl_Position = vec4(mix(uRect.xy, uRect.zw, c), 0.0, 1.0);
+}
+)";
+
+static const char* FRAG_HUD = R"(#version 330 core
+out vec4 FragColor;
+in vec2 vUV;
+uniform sampler2D uHud;
+void main(){
+    FragColor = texture(uHud, vUV);
 }
 )";
 
 // ---------- main ----------
-int main() {
-    check(glfwInit() != 0, "GLFW init failed");
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+int main(int argc, char** argv) {
+    // --report <topic>: headless measurements, see Reports.h
+    // --noise perlin|wavelet|spectral: basis of the fBm volume
+    // --fluid <N>: start with the N^3 smoke simulation, N rounded up to 8 (F toggles it)
+    // --detail <a>: render the simulation with procedural detail at a (2, 4 or 8)
+    //               times its resolution; implies --fluid, 32^3 unless given
+    // --vortex <N>: vortex-particle smoke splatted into an N^3 field instead of
+    //               the grid simulation (F toggles it too; no checkpoint)
+    // --lbm <N>: the same with the N^3 lattice-Boltzmann smoke
+    // --sim-rate <Hz>: simulation steps per second, on a thread of its own
+    // --upload-budget <KB>: field texture bytes streamed per frame at most (0: no limit)
+    // --checkpoint <file>: where the simulation state is saved every 5 s and at
+    //                      exit, and resumed from at start (default per size)
+    // --fresh: start the simulation from scratch even if a checkpoint exists
+    // --bench <frames>: render that many frames offscreen without a display
+    //                   (see Bench.h), then print frame-time percentiles and
+    //                   per-pass costs as JSON and exit
+    // --bench-size <W>x<H>, --bench-dt <s>, --bench-warmup <frames>: the
+    //                   resolution, the animation time step, and the frames
+    //                   run before recording (default 900x1200, 1/60, 30)
+    // --bench-json <file>: write the JSON there instead of stdout
+    // --trace <file>: write a Chrome trace (chrome://tracing, ui.perfetto.dev)
+    //                 of the CPU side of --trace-frames frames (default 120),
+    //                 from startup or from frame --trace-start; P captures the
+    //                 next ones at any time (to trace.json without --trace)
+    // --hitch-trace <prefix>: trace every frame and keep the ones presented a
+    //                 refresh or more late as <prefix>-<frame>.json (first 8)
+    // --startup-json <file>: the startup phases and the time to the first frame
+    //                 as JSON, besides the table printed once it is presented
+    // --alloc-check: count allocations per frame and thread (AllocTracker.h),
+    //                 with the stats; a benchmark fails if any frame after the
+    //                 warm-up allocates on the render thread
+    NoiseBasis basis = NoiseBasis::Perlin;
+    int fluidN = 64, detailAmp = 0, uploadBudgetKB = 2048;
+    float simRate = 30.0f;
+    std::string checkpoint;
+    bool fresh = false;
+    bool useFluid = false, fluidGiven = false, vortex = false, lbm = false;
+    BenchConfig benchCfg;
+    int benchFrames = 0;
+    std::string benchJson;
+    std::string tracePath;
+    int traceFrom = 0, traceFrames = 120;
+    std::string hitchTrace;
+    std::string startupJson;
+    bool allocCheck = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--report") == 0 && i + 1 < argc) return runReport(argv[i + 1]);
+        if (std::strcmp(argv[i], "--noise") == 0 && i + 1 < argc) {
+            const char* b = argv[++i];
+            basis = std::strcmp(b, "wavelet") == 0 ? NoiseBasis::Wavelet
+                  : std::strcmp(b, "spectral") == 0 ? NoiseBasis::Spectral : NoiseBasis::Perlin;
+        }
+        if (std::strcmp(argv[i], "--fluid") == 0 && i + 1 < argc) {
+            fluidN = std::max(16, std::atoi(argv[++i]));
+            useFluid = fluidGiven = true;
+        }
+        if (std::strcmp(argv[i], "--detail") == 0 && i + 1 < argc) {
+            int a = std::atoi(argv[++i]);
+            detailAmp = a >= 8 ? 8 : a >= 4 ? 4 : 2;
+            useFluid = true;
+        }
+        if (std::strcmp(argv[i], "--vortex") == 0 && i + 1 < argc) {
+            fluidN = std::max(16, std::atoi(argv[++i]));
+            useFluid = vortex = true;
+        }
+        if (std::strcmp(argv[i], "--lbm") == 0 && i + 1 < argc) {
+            fluidN = std::max(16, std::atoi(argv[++i]));
+            useFluid = lbm = true;
+        }
+        if (std::strcmp(argv[i], "--sim-rate") == 0 && i + 1 < argc) simRate = std::max(1.0f, float(std::atof(argv[++i])));
+        if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) checkpoint = argv[++i];
+        if (std::strcmp(argv[i], "--fresh") == 0) fresh = true;
+        if (std::strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc) uploadBudgetKB = std::max(0, std::atoi(argv[++i]));
+        if (std::strcmp(argv[i], "--bench") == 0 && i + 1 < argc) benchFrames = std::max(1, std::atoi(argv[++i]));
+        if (std::strcmp(argv[i], "--bench-size") == 0 && i + 1 < argc) {
+            int bw = 0, bh = 0;
+            if (std::sscanf(argv[++i], "%dx%d", &bw, &bh) == 2 && bw > 0 && bh > 0) { benchCfg.width = bw; benchCfg.height = bh; }
+        }
+        if (std::strcmp(argv[i], "--bench-dt") == 0 && i + 1 < argc) benchCfg.dt = std::max(1e-4f, float(std::atof(argv[++i])));
+        if (std::strcmp(argv[i], "--bench-warmup") == 0 && i + 1 < argc) benchCfg.warmup = std::max(0, std::atoi(argv[++i]));
+        if (std::strcmp(argv[i], "--bench-json") == 0 && i + 1 < argc) benchJson = argv[++i];
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) tracePath = argv[++i];
+        if (std::strcmp(argv[i], "--trace-start") == 0 && i + 1 < argc) traceFrom = std::max(0, std::atoi(argv[++i]));
+        if (std::strcmp(argv[i], "--trace-frames") == 0 && i + 1 < argc) traceFrames = std::max(1, std::atoi(argv[++i]));
+        if (std::strcmp(argv[i], "--hitch-trace") == 0 && i + 1 < argc) hitchTrace = argv[++i];
+        if (std::strcmp(argv[i], "--startup-json") == 0 && i + 1 < argc) startupJson = argv[++i];
+        if (std::strcmp(argv[i], "--alloc-check") == 0) allocCheck = true;
+    }
+    const bool bench = benchFrames > 0;
+
+    // a capture from the start also covers the context, the bakes and the shaders
+    traceThreadName("main");
+    int traceUntil = -1;
+    if (!tracePath.empty() && traceFrom == 0) {
+        traceStart();
+        traceUntil = traceFrames;
+    }
+    StartupTimeline startup(bench ? "egl context" : "glfwInit");
+
+    // a benchmark renders without a window where it can, and into a hidden
+    // one where it cannot
+    GLFWwindow* win = nullptr;
+    FramePacing pacing;   // present intervals against the refresh period, with the stats
+    if (bench && HeadlessContext::instance().create()) {
+        benchCfg.context = "egl-surfaceless";
+        startup.next("gladLoadGLLoader");
+        check(gladLoadGLLoader((GLADloadproc)HeadlessContext::proc) != 0, "GLAD init failed");
+    } else {
+        if (bench) startup.next("glfwInit");   // after the headless attempt
+        check(glfwInit() != 0, "GLFW init failed");
+        startup.next("window");
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 #if __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
-    GLFWwindow* win = glfwCreateWindow(900, 1200, "Animated Fire & Smoke (Perlin 3D)", nullptr, nullptr);
-    check(win != nullptr, "Window creation failed");
-    glfwMakeContextCurrent(win);
-    check(gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) != 0, "GLAD init failed");
-    glfwSwapInterval(1);
+        if (bench) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        win = glfwCreateWindow(900, 1200, "Animated Fire & Smoke (Perlin 3D)", nullptr, nullptr);
+        check(win != nullptr, "Window creation failed");
+        glfwMakeContextCurrent(win);
+        startup.next("gladLoadGLLoader");
+        check(gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) != 0, "GLAD init failed");
+        glfwSwapInterval(bench ? 0 : 1);
+        if (const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor())) pacing.setRefresh(mode->refreshRate);
+        benchCfg.context = "glfw-hidden";
+    }
 
     // resources
-    GLuint tex3d = make3DNoiseTex(96, /*octaves*/5, /*lacunarity*/2.01f, /*gain*/0.52f, /*seed*/42);
+    startup.next("blue noise");
+    std::vector<std::vector<unsigned char>> blue = loadOrMakeBlueNoise({
+        { BLUE_NOISE_SIZE, 2, "bluenoise2d_64.bin" },
+        { BLUE_NOISE_3D_SIZE, 3, "bluenoise3d_32.bin" } });
+    startup.next("make3DNoiseTex");
+    GLuint tex3d = make3DNoiseTex(96, /*octaves*/5, /*lacunarity*/2.01f, /*gain*/0.52f, /*seed*/42,
+                                  blue[1], BLUE_NOISE_3D_SIZE, basis);
+    startup.next("makeUnitQuadVAO");
     GLuint vao = makeUnitQuadVAO();
+    startup.next("makeProgram fire");
     GLuint progFire = makeProgram(VERT, FRAG_FIRE);
+    startup.next("makeProgram smoke");
     GLuint progSmoke = makeProgram(VERT, FRAG_SMOKE);
+    startup.next("makeProgram resolve");
+    GLuint progResolve = makeProgram(VERT_FULLSCREEN, FRAG_RESOLVE);
+    startup.next("makeProgram composite");
+    GLuint progComposite = makeProgram(VERT_FULLSCREEN, FRAG_COMPOSITE);
+    startup.next("makeProgram hud");
+    GLuint progHud = makeProgram(VERT_HUD, FRAG_HUD);
+    startup.next("blue noise texture");
+    GLuint blueNoise = makeBlueNoiseTex(blue[0]);
+    startup.next("setup");
+
+    // the simulation is created on first use and runs on its own thread;
+    // each frame uploads the newest step it finished
+    std::unique_ptr<SimThread> sim;
+    GLuint fieldTex = 0;
+    std::unique_ptr<BrickUploader> uploader;
+    UploadRing uploadRing;
+    bool fWasDown = false;
+
+    // rates and GPU times, printed every few seconds (the simulation's while it exists)
+    auto statsT = std::chrono::steady_clock::now();
+    long long statsSteps = 0;
+    double statsBusy = 0.0;
+    size_t statsBytes = 0, statsCalls = 0;
+    int statsFrames = 0, statsShown = 0;
+
+    // smoke is raymarched into its own target and accumulated over frames
+    ColorTarget smokeCur, smokeHist[2];
+    int histIdx = 0;
+    bool histValid = false;
+
+    // a benchmark draws the frame into a target of its own size instead of
+    // the window, on a fixed time step, and times every pass
+    ColorTarget benchTarget;
+    BenchClock benchClock;
+    benchClock.warmup = benchCfg.warmup;
+    if (bench) {
+        benchTarget = makeColorTarget(benchCfg.width, benchCfg.height);
+        benchCfg.frames = benchFrames;
+        benchClock.reserve(benchFrames);
+        benchCfg.renderer = (const char*)glGetString(GL_RENDERER);
+        benchCfg.version = (const char*)glGetString(GL_VERSION);
+        benchCfg.scene = vortex ? "vortex" : lbm ? "lbm" : detailAmp ? "detail" : useFluid ? "fluid" : "procedural";
+    }
+    const GLuint outFbo = benchTarget.fbo;
+
+    // GPU time per pass from timestamp queries, shown in the overlay (H
+    // toggles it) and with the stats every few seconds
+    GpuTimers gpuTimers;
+    gpuTimers.init();
+    Hud hud;
+    hud.init(224, 148);
+    bool showHud = true, hWasDown = false;
+    RollingStats cpuFrame;
+    auto hudT = std::chrono::steady_clock::now(), frameT = hudT;
+    auto passDone = [&](FramePass pass) {
+        gpuTimers.mark(pass);
+        if (bench) benchClock.mark(pass);
+    };
 
     // state
     glEnable(GL_BLEND);
@@ -323,36 +692,201 @@ int main() {
 
     float fireIntensity = 2.0f;
     float smokeOpacity = 0.55f;
+    float smokeDepth = 0.35f;
+    float smokeStreaks = 0.6f;
+    float fieldDepth = 0.25f;
+
+    // T toggles temporal accumulation: 8 jittered steps + history vs. 32 plain steps
+    bool temporal = true;
+    bool tWasDown = false;
+    const int stepsTemporal = 8, stepsFull = 32;
+    const float historyBlend = 0.1f;
+    int frame = 0;
+    float prevTime = 0.0f;
+    float prevXform[4] = { 1.0f, smokeHeight, smokeWidth, 0.05f };
 
     auto t0 = std::chrono::high_resolution_clock::now();
+    bool pWasDown = false;
+    int hitchFrame = -1, hitchDumps = 0, lastDump = -2;
+    bool firstFrameOpen = false;
+    // frames that allocated on this thread, counted from the end of the
+    // warm-up in a benchmark and from here otherwise
+    AllocWindow allocWindow;
+    long long allocFrames = 0, allocCount = 0;
+    int allocFirst = -1;
+    uint64_t allocWorst = 0;
+    auto finishTrace = [&]() {
+        traceStop();
+        long long n = traceWrite(tracePath.c_str());
+        if (n < 0) fprintf(stderr, "cannot write %s\n", tracePath.c_str());
+        else fprintf(bench ? stderr : stdout, "trace: %lld events written to %s\n", n, tracePath.c_str());
+        traceUntil = -1;
+    };
+    startup.end();   // reopened inside the first frame, so its trace event nests in that frame's
+
+    while (bench ? frame < benchCfg.warmup + benchFrames : !glfwWindowShouldClose(win)) {
+        // a capture ends after its frames and is written out at once
+        if (traceUntil >= 0 && frame >= traceUntil) {
+            finishTrace();
+        } else if (traceUntil < 0 && traceFrom > 0 && frame == traceFrom && !tracePath.empty()) {
+            traceStart();
+            traceUntil = frame + traceFrames;
+        }
+        // hitch capture: each frame is a capture of its own, written out
+        // (now that its events are closed) if it was presented late
+        if (!hitchTrace.empty() && !bench && traceUntil < 0) {
+            if (hitchFrame >= 0) {
+                traceStop();
+                std::string path = hitchTrace + "-" + std::to_string(hitchFrame) + ".json";
+                if (traceWrite(path.c_str()) < 0) fprintf(stderr, "cannot write %s\n", path.c_str());
+                else printf("hitch at frame %d (%.1f ms): trace written to %s\n", hitchFrame, pacing.lastIntervalMs(), path.c_str());
+                lastDump = frame;
+                ++hitchDumps;
+                hitchFrame = -1;
+            }
+            if (hitchDumps < 8) traceStart();
+            else traceStop();
+        }
+        if (!bench) pacing.beginFrame();
+        if (allocCheck && frame == (bench ? benchCfg.warmup : 0)) {
+            allocStart();
+            allocWindow.reset();
+        }
+        const int allocFrame = frame;
+        const uint64_t allocBase = allocThreadCount();
+        FIRE_TRACE("frame");
+        // once only: a window that starts minimized loops here without
+        // counting frames, and all of that is time to the first frame
+        if (frame == 0 && !firstFrameOpen) {
+            startup.next("first frame");
+            firstFrameOpen = true;
+        }
+        TraceScope phase(bench ? "bench sync" : "poll events");
 
-    while (!glfwWindowShouldClose(win)) {
-        glfwPollEvents();
-        if (glfwGetKey(win, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(win, 1);
-
-        // quick controls
-        if (glfwGetKey(win, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS)  smokeScale = std::max(0.5f, smokeScale - 0.01f);
-        if (glfwGetKey(win, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS) smokeScale = std::min(6.0f, smokeScale + 0.01f);
-        if (glfwGetKey(win, GLFW_KEY_MINUS) == GLFW_PRESS)         fireScale = std::max(0.8f, fireScale - 0.01f);
-        if (glfwGetKey(win, GLFW_KEY_EQUAL) == GLFW_PRESS)         fireScale = std::min(6.0f, fireScale + 0.01f);
-        if (glfwGetKey(win, GLFW_KEY_W) == GLFW_PRESS)             smokeSpeed = std::min(0.8f, smokeSpeed + 0.001f);
-        if (glfwGetKey(win, GLFW_KEY_S) == GLFW_PRESS)             smokeSpeed = std::max(0.02f, smokeSpeed - 0.001f);
-        if (glfwGetKey(win, GLFW_KEY_D) == GLFW_PRESS)             fireSpeed = std::min(2.0f, fireSpeed + 0.005f);
-        if (glfwGetKey(win, GLFW_KEY_A) == GLFW_PRESS)             fireSpeed = std::max(0.05f, fireSpeed - 0.005f);
-        if (glfwGetKey(win, GLFW_KEY_1) == GLFW_PRESS)             fireHeight = std::max(0.3f, fireHeight - 0.005f);
-        if (glfwGetKey(win, GLFW_KEY_2) == GLFW_PRESS)             fireHeight = std::min(0.9f, fireHeight + 0.005f);
-
-        int w, h; glfwGetFramebufferSize(win, &w, &h);
+        if (bench) {
+            benchClock.beginFrame();
+        } else {
+            glfwPollEvents();
+            if (glfwGetKey(win, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(win, 1);
+
+            // quick controls
+            if (glfwGetKey(win, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS)  smokeScale = std::max(0.5f, smokeScale - 0.01f);
+            if (glfwGetKey(win, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS) smokeScale = std::min(6.0f, smokeScale + 0.01f);
+            if (glfwGetKey(win, GLFW_KEY_MINUS) == GLFW_PRESS)         fireScale = std::max(0.8f, fireScale - 0.01f);
+            if (glfwGetKey(win, GLFW_KEY_EQUAL) == GLFW_PRESS)         fireScale = std::min(6.0f, fireScale + 0.01f);
+            if (glfwGetKey(win, GLFW_KEY_W) == GLFW_PRESS)             smokeSpeed = std::min(0.8f, smokeSpeed + 0.001f);
+            if (glfwGetKey(win, GLFW_KEY_S) == GLFW_PRESS)             smokeSpeed = std::max(0.02f, smokeSpeed - 0.001f);
+            if (glfwGetKey(win, GLFW_KEY_D) == GLFW_PRESS)             fireSpeed = std::min(2.0f, fireSpeed + 0.005f);
+            if (glfwGetKey(win, GLFW_KEY_A) == GLFW_PRESS)             fireSpeed = std::max(0.05f, fireSpeed - 0.005f);
+            if (glfwGetKey(win, GLFW_KEY_1) == GLFW_PRESS)             fireHeight = std::max(0.3f, fireHeight - 0.005f);
+            if (glfwGetKey(win, GLFW_KEY_2) == GLFW_PRESS)             fireHeight = std::min(0.9f, fireHeight + 0.005f);
+            bool tDown = glfwGetKey(win, GLFW_KEY_T) == GLFW_PRESS;
+            if (tDown && !tWasDown) { temporal = !temporal; histValid = false; }
+            tWasDown = tDown;
+            bool fDown = glfwGetKey(win, GLFW_KEY_F) == GLFW_PRESS;
+            if (fDown && !fWasDown) { useFluid = !useFluid; histValid = false; }
+            fWasDown = fDown;
+            bool hDown = glfwGetKey(win, GLFW_KEY_H) == GLFW_PRESS;
+            if (hDown && !hWasDown) showHud = !showHud;
+            hWasDown = hDown;
+            bool pDown = glfwGetKey(win, GLFW_KEY_P) == GLFW_PRESS;
+            if (pDown && !pWasDown && traceUntil < 0) {
+                if (tracePath.empty()) tracePath = "trace.json";
+                traceStart();
+                traceUntil = frame + traceFrames;
+            }
+            pWasDown = pDown;
+        }
+        phase.next("targets");
+
+        int w = benchCfg.width, h = benchCfg.height;
+        if (!bench) glfwGetFramebufferSize(win, &w, &h);
+        if (w <= 0 || h <= 0) { glfwSwapBuffers(win); pacing.skip(); continue; } // minimized
+        if (w != smokeCur.w || h != smokeCur.h) {
+            destroyColorTarget(smokeCur);
+            destroyColorTarget(smokeHist[0]);
+            destroyColorTarget(smokeHist[1]);
+            smokeCur = makeColorTarget(w, h);
+            smokeHist[0] = makeColorTarget(w, h);
+            smokeHist[1] = makeColorTarget(w, h);
+            histValid = false;
+        }
+        gpuTimers.beginFrame();
+        glBindFramebuffer(GL_FRAMEBUFFER, outFbo);
         glViewport(0, 0, w, h);
         glClearColor(0.02f, 0.02f, 0.03f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
         auto t1 = std::chrono::high_resolution_clock::now();
-        float time = std::chrono::duration<float>(t1 - t0).count();
+        float time = bench ? frame * benchCfg.dt : std::chrono::duration<float>(t1 - t0).count();
 
         float aspect = (h == 0) ? 1.0f : float(w) / float(h);
 
+        phase.next("sim upload");
+        if (useFluid && !sim) {
+            if (vortex) {
+                sim.reset(new SimThread(fluidN, VortexParams(), simRate));
+            } else if (lbm) {
+                sim.reset(new SimThread(fluidN, LbmParams(), simRate));
+            } else {
+                int n = detailAmp && !fluidGiven ? 32 : fluidN;
+                if (checkpoint.empty() && !bench)   // a benchmark starts fresh and leaves no file behind
+                    checkpoint = "fluid" + std::to_string((n + 7) / 8 * 8) + (detailAmp ? "x" + std::to_string(detailAmp) : "") + ".ckpt";
+                sim.reset(new SimThread(n, detailAmp, simRate, checkpoint, !fresh, int(5 * simRate)));
+                if (sim->resumedSteps() >= 0) printf("resumed %s after %lld steps\n", checkpoint.c_str(), sim->resumedSteps());
+            }
+            fieldTex = makeFieldTex(sim->textureSize());
+            uploader.reset(new BrickUploader(sim->textureSize() / TileMap::B, size_t(uploadBudgetKB) * 1024));
+        }
+        if (sim) sim->setPaused(!useFluid);
+        if (useFluid) {
+            if (const FieldFrame* f = sim->latest()) {
+                offerFrame(*uploader, *f);
+                ++statsShown;
+            }
+            streamBricks(fieldTex, *uploader, uploadRing);   // also whatever an earlier budget held back
+        }
+        passDone(FramePass::Upload);
+        phase.next("stats");
+        if (!bench) {   // a benchmark keeps stdout for its JSON
+            ++statsFrames;
+            if (std::chrono::steady_clock::now() - statsT > std::chrono::seconds(5)) {
+                double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - statsT).count();
+                printf("gpu %.2f ms per frame:", gpuTimers.frame().average());
+                for (int p = 0; p < kFramePasses; ++p) printf(" %s %.2f", framePassName(p), gpuTimers.pass(p).average());
+                printf(" (last %d frames read back, %lld dropped)\n", gpuTimers.frame().filled, gpuTimers.dropped());
+                pacing.print(stdout);
+                pacing.reset();
+                if (allocCheck) {
+                    allocWindow.print(stdout, statsFrames);
+                    allocWindow.reset();
+                }
+                if (sim) {
+                    long long steps = sim->steps() - statsSteps;
+                    printf("sim %.1f steps/s (%.1f ms each), render %.1f fps showing %.1f new steps/s, "
+                           "upload %.1f KB in %.1f calls per frame, %zu bricks waiting\n",
+                           steps / secs, steps ? (sim->busyMs() - statsBusy) / steps : 0.0, statsFrames / secs, statsShown / secs,
+                           (uploader->totalBytes - statsBytes) / 1024.0 / statsFrames,
+                           double(uploader->totalCalls - statsCalls) / statsFrames, uploader->deferred);
+                    if (sim->saves()) printf("checkpoint %s: %d saved, last took %.1f ms\n", checkpoint.c_str(), sim->saves(), sim->lastSaveMs());
+                    statsSteps = sim->steps();
+                    statsBusy = sim->busyMs();
+                    statsBytes = uploader->totalBytes;
+                    statsCalls = uploader->totalCalls;
+                }
+                statsT = std::chrono::steady_clock::now();
+                statsFrames = statsShown = 0;
+            }
+        }
+        // the cube of the simulation spans the smoke billboard; the fire
+        // billboard shares its bottom edge and centre
+        phase.next("fire uniforms");
+        float fireMap[4] = { fireWidth / smokeWidth, fireHeight / smokeHeight, 0.5f - 0.5f * fireWidth / smokeWidth, 0.0f };
+        float smokeMap[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+
         glBindVertexArray(vao);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_3D, fieldTex);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_3D, tex3d);
 
@@ -365,36 +899,202 @@ int main() {
         glUniform1f(glGetUniformLocation(progFire, "uSpeed"), fireSpeed);
         glUniform1f(glGetUniformLocation(progFire, "uSoftEdge"), 0.25f);
         glUniform1f(glGetUniformLocation(progFire, "uIntensity"), fireIntensity);
+        glUniform1i(glGetUniformLocation(progFire, "uField"), 3);
+        glUniform1f(glGetUniformLocation(progFire, "uUseField"), useFluid ? 1.0f : 0.0f);
+        glUniform4fv(glGetUniformLocation(progFire, "uFieldMap"), 1, fireMap);
         glUniform1f(glGetUniformLocation(progFire, "uAspect"), aspect);
         glUniform1f(glGetUniformLocation(progFire, "uHeight"), fireHeight);
         glUniform1f(glGetUniformLocation(progFire, "uWidth"), fireWidth);
         glUniform2f(glGetUniformLocation(progFire, "uOffset"), 0.0f, 0.05f);
+        phase.next("fire draw");
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        passDone(FramePass::Fire);
 
-        // --- SMOKE (alpha blended over) ---
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        // --- SMOKE (raymarched offscreen, premultiplied) ---
+        phase.next("smoke uniforms");
+        glBindFramebuffer(GL_FRAMEBUFFER, smokeCur.fbo);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_BLEND);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, blueNoise);
         glUseProgram(progSmoke);
         glUniform1i(glGetUniformLocation(progSmoke, "uNoise"), 0);
+        glUniform1i(glGetUniformLocation(progSmoke, "uBlueNoise"), 1);
         glUniform1f(glGetUniformLocation(progSmoke, "uTime"), time);
         glUniform1f(glGetUniformLocation(progSmoke, "uScale"), smokeScale);
         glUniform1f(glGetUniformLocation(progSmoke, "uSpeed"), smokeSpeed);
         glUniform1f(glGetUniformLocation(progSmoke, "uSoftEdge"), 0.35f);
         glUniform1f(glGetUniformLocation(progSmoke, "uOpacity"), smokeOpacity);
+        glUniform1f(glGetUniformLocation(progSmoke, "uDepth"), smokeDepth);
+        glUniform1i(glGetUniformLocation(progSmoke, "uSteps"), temporal ? stepsTemporal : stepsFull);
+        glUniform1f(glGetUniformLocation(progSmoke, "uJitter"), temporal ? 1.0f : 0.0f);
+        glUniform1i(glGetUniformLocation(progSmoke, "uFrame"), frame);
+        glUniform1f(glGetUniformLocation(progSmoke, "uStreaks"), smokeStreaks);
+        glUniform1i(glGetUniformLocation(progSmoke, "uField"), 3);
+        glUniform1f(glGetUniformLocation(progSmoke, "uUseField"), useFluid ? 1.0f : 0.0f);
+        glUniform4fv(glGetUniformLocation(progSmoke, "uFieldMap"), 1, smokeMap);
+        glUniform1f(glGetUniformLocation(progSmoke, "uFieldDepth"), fieldDepth);
         glUniform1f(glGetUniformLocation(progSmoke, "uAspect"), aspect);
         glUniform1f(glGetUniformLocation(progSmoke, "uHeight"), smokeHeight);
         glUniform1f(glGetUniformLocation(progSmoke, "uWidth"), smokeWidth);
         glUniform2f(glGetUniformLocation(progSmoke, "uOffset"), 0.0f, 0.05f);
+        phase.next("smoke draw");
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        passDone(FramePass::Smoke);
+
+        // --- temporal resolve into the next history buffer ---
+        phase.next("resolve");
+        GLuint smokeTex = smokeCur.tex;
+        if (temporal) {
+            float curXform[4] = { aspect, smokeHeight, smokeWidth, 0.05f };
+            ColorTarget& dst = smokeHist[histIdx ^ 1];
+            glBindFramebuffer(GL_FRAMEBUFFER, dst.fbo);
+            glUseProgram(progResolve);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, smokeCur.tex);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, smokeHist[histIdx].tex);
+            glUniform1i(glGetUniformLocation(progResolve, "uCurrent"), 1);
+            glUniform1i(glGetUniformLocation(progResolve, "uHistory"), 2);
+            glUniform1f(glGetUniformLocation(progResolve, "uBlend"), histValid ? historyBlend : 1.0f);
+            glUniform4fv(glGetUniformLocation(progResolve, "uCurXform"), 1, curXform);
+            glUniform4fv(glGetUniformLocation(progResolve, "uPrevXform"), 1, prevXform);
+            glUniform1f(glGetUniformLocation(progResolve, "uTime"), time);
+            glUniform1f(glGetUniformLocation(progResolve, "uPrevTime"), prevTime);
+            glUniform1f(glGetUniformLocation(progResolve, "uWave"), useFluid ? 0.0f : 1.0f);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            histIdx ^= 1;
+            histValid = true;
+            std::copy(curXform, curXform + 4, prevXform);
+            smokeTex = dst.tex;
+        }
+        passDone(FramePass::Resolve);
+        prevTime = time;
+        ++frame;
+
+        // --- SMOKE composite (alpha blended over the fire) ---
+        phase.next("composite");
+        glBindFramebuffer(GL_FRAMEBUFFER, outFbo);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        glUseProgram(progComposite);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, smokeTex);
+        glUniform1i(glGetUniformLocation(progComposite, "uSmoke"), 1);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glActiveTexture(GL_TEXTURE0);
+
+        passDone(FramePass::Composite);
+        gpuTimers.endFrame();
+
+        // --- timing overlay, redrawn a few times a second ---
+        phase.next("hud");
+        auto now = std::chrono::steady_clock::now();
+        cpuFrame.push(std::chrono::duration<float, std::milli>(now - frameT).count());
+        frameT = now;
+        if (showHud && !bench) {
+            if (now - hudT > std::chrono::milliseconds(250)) {
+                drawTimingHud(hud, gpuTimers, cpuFrame);
+                hud.upload();
+                hudT = now;
+            }
+            const float margin = 8.0f;
+            float rect[4] = { -1.0f + 2.0f * margin / w, 1.0f - 2.0f * (margin + hud.h) / h,
+                              -1.0f + 2.0f * (margin + hud.w) / w, 1.0f - 2.0f * margin / h };
+            glUseProgram(progHud);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, hud.tex);
+            glUniform1i(glGetUniformLocation(progHud, "uHud"), 1);
+            glUniform4fv(glGetUniformLocation(progHud, "uRect"), 1, rect);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        phase.next(bench ? "bench finish" : "swap");
+        if (startup.running()) startup.next(bench ? "first finish" : "first glfwSwapBuffers");
+        if (bench) {
+            if (frame == benchCfg.warmup) {   // the frames before are warm-up, read back and discarded
+                gpuTimers.finish();
+                gpuTimers.reset();
+            }
+            benchClock.endFrame();
+        } else {
+            pacing.beforeSwap();
+            glfwSwapBuffers(win);
+            // the frame after a dump pays for writing it and is not kept
+            if (pacing.presented() && !hitchTrace.empty() && traceUntil < 0 && frame != lastDump + 1) hitchFrame = frame - 1;
+        }
+        if (uint64_t n = allocThreadCount() - allocBase) {
+            if (allocFirst < 0) allocFirst = allocFrame;
+            ++allocFrames;
+            allocCount += (long long)n;
+            allocWorst = std::max(allocWorst, n);
+        }
+        if (startup.running()) {
+            startup.end();
+            startup.print(bench ? stderr : stdout);
+            if (!startupJson.empty()) {
+                if (FILE* f = std::fopen(startupJson.c_str(), "w")) {
+                    startup.writeJson(f);
+                    std::fclose(f);
+                } else {
+                    fprintf(stderr, "cannot write %s\n", startupJson.c_str());
+                }
+            }
+        }
+    }
+
+    allocStop();   // what the reports below allocate is not the frames'
+    if (traceUntil >= 0) finishTrace();   // closed before the capture was over
 
-        glfwSwapBuffers(win);
+    if (bench) {
+        const std::vector<double>& ms = benchClock.frameMs;
+        fprintf(stderr, "bench: %d frames at %dx%d on %s (%s): mean %.2f ms, p50 %.2f, p95 %.2f, p99 %.2f\n",
+                int(ms.size()), benchCfg.width, benchCfg.height, benchCfg.renderer.c_str(), benchCfg.context.c_str(),
+                mean(ms), percentile(ms, 50), percentile(ms, 95), percentile(ms, 99));
+        gpuTimers.finish();   // the last frames' stamps are still in the ring
+        FILE* f = benchJson.empty() ? stdout : std::fopen(benchJson.c_str(), "w");
+        if (f) {
+            writeBenchJson(f, benchCfg, benchClock, gpuTimers);
+            if (f != stdout) std::fclose(f);
+        } else {
+            fprintf(stderr, "cannot write %s\n", benchJson.c_str());
+        }
+        destroyColorTarget(benchTarget);
+    }
+    int status = 0;
+    if (allocCheck) {
+        FILE* f = bench ? stderr : stdout;
+        if (allocFrames) fprintf(f, "alloc check: %lld frames allocated on the render thread (%lld allocations, "
+                                    "up to %llu in one frame, first in frame %d)\n",
+                                 allocFrames, allocCount, (unsigned long long)allocWorst, allocFirst);
+        else fprintf(f, "alloc check: no frame allocated on the render thread\n");
+        if (bench) {
+            allocWindow.print(f, benchFrames);
+            if (allocFrames) status = 1;
+        }
     }
 
     glDeleteProgram(progFire);
     glDeleteProgram(progSmoke);
+    glDeleteProgram(progResolve);
+    glDeleteProgram(progComposite);
+    glDeleteProgram(progHud);
+    gpuTimers.release();
+    hud.release();
+    glDeleteTextures(1, &blueNoise);
+    destroyColorTarget(smokeCur);
+    destroyColorTarget(smokeHist[0]);
+    destroyColorTarget(smokeHist[1]);
     glDeleteVertexArrays(1, &vao);
     glDeleteTextures(1, &tex3d);
+    if (fieldTex) glDeleteTextures(1, &fieldTex);
+    for (GLuint pbo : uploadRing.pbo) if (pbo) glDeleteBuffers(1, &pbo);
 
-    glfwDestroyWindow(win);
-    glfwTerminate();
-    return 0;
+    if (win) {
+        glfwDestroyWindow(win);
+        glfwTerminate();
+    }
+    return status;
 }
@@ -0,0 +1,355 @@
+﻿// Multigrid.h — geometric multigrid for the fluid pressure Poisson problem (CPU, tile-sparse)
+// Briggs, Henson, McCormick, "A Multigrid Tutorial", 2nd ed., 2000.
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+#include "Tiles.h"
+
+// Cell-centred 7-point problem  diag * p - sum(neighbours) = b  over the
+// allocated tiles of an n^3 grid, matching FluidSim: walls on x, z and the
+// floor drop out of the stencil (Neumann); above the open top and in
+// unallocated tiles is air at p = 0 (Dirichlet). Every neighbour that is not
+// an unknown reads 0 and the boundary lives in the per-cell diagonal, which
+// is 0 for coarse cells that only cover air (they stay at p = 0).
+// b carries the h^2 factor of its level. p, b and r are stored as T (float
+// or Half, see Simd.h); the diagonals stay float.
+template<typename T>
+struct PoissonGridT {
+    int n = 0;                          // the domain; the tiles round it up to whole tiles
+    // p = 0 sits one fine cell beyond the last unknown; on a coarser level
+    // that is d < 1 spacings away and the linearly extrapolated ghost leaves
+    // 1/d (instead of 1) on the diagonal per Dirichlet face
+    float dirichletWeight = 1.0f;
+    TileMap tiles;
+    std::vector<T> p, b, r;
+    std::vector<T> prev;                // Jacobi's second buffer, sized by the caller
+    std::vector<float> diag, invDiag;
+
+    explicit PoissonGridT(int size = 0) : n(size), tiles((size + TileMap::B - 1) / TileMap::B * TileMap::B) {}
+
+    // true if the tile set changed (MultigridSolver::sync() then rebuilds the diagonals)
+    bool allocate(const std::vector<unsigned char>& want) {
+        before = tiles.slot;
+        bool changed = tiles.assign(want, { &diag, &invDiag });
+        tiles.released.clear();
+        for (std::vector<T>* f : { &p, &b, &r }) {
+            f->resize(size_t(tiles.slots) * TileMap::B3);
+            for (int t : tiles.active)
+                if (before[t] < 0) std::fill(f->begin() + tiles.base(t), f->begin() + tiles.base(t) + TileMap::B3, T(0));
+        }
+        return changed;
+    }
+    bool allocateAll() { return allocate(std::vector<unsigned char>(size_t(tiles.T) * tiles.T * tiles.T, 1)); }
+
+private:
+    std::vector<int> before;            // scratch for allocate()
+};
+
+using PoissonGrid = PoissonGridT<float>;
+
+// fn(tile, poolBase, ox, oy, oz) over the allocated tiles
+template<typename Fn>
+static void forTiles(const TileMap& tm, Fn fn) {
+    jobs().parallelFor(0, int(tm.active.size()), [&](int a0, int a1) {
+        DenormalGuard ftz;
+        for (int a = a0; a < a1; ++a) {
+            int t = tm.active[a], ox, oy, oz;
+            tm.tileOrigin(t, ox, oy, oz);
+            fn(t, tm.base(t), ox, oy, oz);
+        }
+    });
+}
+
+// Each tile is a cache block: its 8^3 cells plus a gathered apron fit in
+// L1, so every stencil below reads neighbours from the 10^3 halo and streams
+// each pool exactly once. With SSE2 a row of 8 cells is two vectors and every
+// neighbour an unaligned load. Half pools are widened in the halo gather and
+// by load4()/store4(), so the arithmetic is the same for both storages.
+
+// p = (neighbours + b) * invDiag over tile t, neighbours from `src`. With
+// colour >= 0 only cells with (x + y + z) % 2 == colour change (B is even, so
+// local parity is global parity): the apron holds only the other colour,
+// the row is computed whole, and only the cells of `colour` are stored.
+template<typename T>
+static void relaxTile(PoissonGridT<T>& g, int t, size_t base, const std::vector<T>& src, int colour) {
+    const int B = TileMap::B;
+    float h[1000];
+    g.tiles.gatherHalo(src, t, h, Apron::Zero, 7, colour < 0 ? -1 : 1 - colour);
+    const T* b = &g.b[base];
+    const float* inv = &g.invDiag[base];
+    T* p = &g.p[base];
+    for (int z = 0; z < B; ++z)
+        for (int y = 0; y < B; ++y) {
+            const float* c = h + haloIndex(0, y, z);
+            const int o = (z * B + y) * B;
+#ifdef FIRE_SSE2
+            const int first = (y + z + colour) & 1;   // lane of the first cell of `colour`
+            for (int x = 0; x < B; x += 4) {
+                __m128 s = _mm_add_ps(_mm_loadu_ps(c + x - 1), _mm_loadu_ps(c + x + 1));
+                s = _mm_add_ps(s, _mm_add_ps(_mm_loadu_ps(c + x - 10), _mm_loadu_ps(c + x + 10)));
+                s = _mm_add_ps(s, _mm_add_ps(_mm_loadu_ps(c + x - 100), _mm_loadu_ps(c + x + 100)));
+                __m128 v = _mm_mul_ps(_mm_add_ps(s, load4(b + o + x)), _mm_loadu_ps(inv + o + x));
+                if (colour < 0) {
+                    store4(p + o + x, v);
+                } else {
+                    // two scalar stores, converted the way store4 converts
+                    T lanes[4];
+                    store4(lanes, v);
+                    p[o + x + first] = lanes[first];
+                    p[o + x + first + 2] = lanes[first + 2];
+                }
+            }
+#else
+            for (int x = colour < 0 ? 0 : (y + z + colour) & 1; x < B; x += colour < 0 ? 1 : 2)
+                fromFloat((c[x - 1] + c[x + 1] + c[x - 10] + c[x + 10] + c[x - 100] + c[x + 100] + toFloat(b[o + x])) * inv[o + x], p[o + x]);
+#endif
+        }
+}
+
+// one Jacobi sweep: g.p from `prev` (the caller swaps; same slots)
+template<typename T>
+static void relaxJacobi(PoissonGridT<T>& g, const std::vector<T>& prev) {
+    forTiles(g.tiles, [&](int t, size_t base, int, int, int) { relaxTile(g, t, base, prev, -1); });
+}
+
+// red-black Gauss-Seidel: cells of one colour only read the other colour,
+// so each half-sweep is tile-parallel and updates in place. A tile reads
+// only the other colour from its neighbours and writes only its own cells
+// of this one, so no cell is read and written at once.
+template<typename T>
+static void relaxRedBlack(PoissonGridT<T>& g, int sweeps) {
+    for (int s = 0; s < sweeps; ++s)
+        for (int colour = 0; colour < 2; ++colour)
+            forTiles(g.tiles, [&](int t, size_t base, int, int, int) { relaxTile(g, t, base, g.p, colour); });
+}
+
+// The same sweeps as relaxRedBlack(), temporally blocked: half-sweep k runs
+// one layer of tiles (in z) behind half-sweep k - 1, so all of them pass over
+// the grid together while the few layers in flight stay in cache. Half-sweep
+// k on layer z needs k - 1 done on z + 1 and has to precede k + 1 on z - 1;
+// running the half-sweeps of a step in order gives both.
+template<typename T>
+static void relaxRedBlackWavefront(PoissonGridT<T>& g, int sweeps) {
+    const TileMap& tm = g.tiles;
+    const int halves = 2 * sweeps, plane = tm.T * tm.T;
+    auto first = [&](int z) {   // active is ascending, so a layer is one run of it
+        return int(std::lower_bound(tm.active.begin(), tm.active.end(), z * plane) - tm.active.begin());
+    };
+    for (int step = 0; step < tm.T + halves - 1; ++step)
+        for (int k = 0; k < halves; ++k) {
+            int z = step - k;
+            if (z < 0 || z >= tm.T) continue;
+            jobs().parallelFor(first(z), first(z + 1), [&](int a0, int a1) {
+                DenormalGuard ftz;
+                for (int a = a0; a < a1; ++a) relaxTile(g, tm.active[a], tm.base(tm.active[a]), g.p, k & 1);
+            });
+        }
+}
+
+// fills g.r and returns its RMS over the allocated cells
+template<typename T>
+static double computeResidual(PoissonGridT<T>& g) {
+    const int B = TileMap::B;
+    std::vector<double> sums(g.tiles.slots, 0.0);   // per slot, free ones stay 0
+    forTiles(g.tiles, [&](int t, size_t base, int, int, int) {
+        float h[1000];
+        g.tiles.gatherHalo(g.p, t, h, Apron::Zero);
+        const T* b = &g.b[base];
+        const float* diag = &g.diag[base];
+        const float* inv = &g.invDiag[base];
+        T* r = &g.r[base];
+        double acc = 0.0;
+        for (int z = 0; z < B; ++z)
+            for (int y = 0; y < B; ++y) {
+                const float* c = h + haloIndex(0, y, z);
+                const int o = (z * B + y) * B;
+#ifdef FIRE_SSE2
+                __m128 sq = _mm_setzero_ps();
+                for (int x = 0; x < B; x += 4) {
+                    __m128 s = _mm_add_ps(_mm_loadu_ps(c + x - 1), _mm_loadu_ps(c + x + 1));
+                    s = _mm_add_ps(s, _mm_add_ps(_mm_loadu_ps(c + x - 10), _mm_loadu_ps(c + x + 10)));
+                    s = _mm_add_ps(s, _mm_add_ps(_mm_loadu_ps(c + x - 100), _mm_loadu_ps(c + x + 100)));
+                    __m128 v = _mm_sub_ps(_mm_add_ps(load4(b + o + x), s),
+                                          _mm_mul_ps(_mm_loadu_ps(diag + o + x), _mm_loadu_ps(c + x)));
+                    v = _mm_and_ps(v, _mm_cmpneq_ps(_mm_loadu_ps(inv + o + x), _mm_setzero_ps()));   // not an unknown: 0
+                    store4(r + o + x, v);
+                    sq = _mm_add_ps(sq, _mm_mul_ps(v, v));
+                }
+                acc += hsum_ps(sq);
+#else
+                for (int x = 0; x < B; ++x) {
+                    float sum = c[x - 1] + c[x + 1] + c[x - 10] + c[x + 10] + c[x - 100] + c[x + 100];
+                    float v = inv[o + x] != 0.0f ? toFloat(b[o + x]) - (diag[o + x] * c[x] - sum) : 0.0f;
+                    fromFloat(v, r[o + x]);
+                    acc += double(v) * v;
+                }
+#endif
+            }
+        sums[g.tiles.slot[t]] = acc;
+    });
+    double total = 0.0;
+    for (double s : sums) total += s;
+    return std::sqrt(total / std::max(1.0, double(g.tiles.active.size()) * TileMap::B3));
+}
+
+// V-cycles over a hierarchy halved while the size stays even and above one
+// tile; a level that is not a whole number of tiles (52, 26, 6, ...) is
+// padded with cells outside the domain, which are never unknowns. A coarse
+// tile is allocated when any of its 2^3 fine tiles is. Restriction averages
+// 2^3 children, prolongation is cell-centred trilinear. Gauss-Seidel needs
+// sweeps in proportion to the squared edge to converge, so the coarsest
+// level gets 96 at 8 cells and more for an odd edge it stopped at (13 for
+// N = 104).
+template<typename T>
+struct MultigridSolverT {
+    typedef PoissonGridT<T> Grid;
+    std::vector<Grid> levels;
+    std::vector<unsigned char> want;    // scratch for sync()
+    int preSmooth = 2, postSmooth = 2, coarseSweeps = 96;   // set from the coarsest edge
+    // smooth with relaxRedBlackWavefront(); pays off once a level outgrows
+    // the last-level cache, which none of ours do here (see --report stencil)
+    bool wavefront = false;
+
+    explicit MultigridSolverT(int n = 0) {
+        if (n <= 0) return;
+        levels.emplace_back(n);
+        float d = 1.0f;   // distance of the Dirichlet boundary, in spacings of the level
+        while (n % 2 == 0 && n > TileMap::B) {
+            n /= 2;
+            d = (d + 0.5f) * 0.5f;
+            levels.emplace_back(n);
+            levels.back().dirichletWeight = 1.0f / d;
+        }
+        coarseSweeps = std::max(16, 96 * n * n / (TileMap::B * TileMap::B));
+    }
+
+    Grid& finest() { return levels.front(); }
+
+    // rebuild the coarse tile sets and every diagonal after the finest tile set changed
+    void sync() {
+        const int B = TileMap::B;
+        for (size_t l = 0; l < levels.size(); ++l) {
+            Grid& g = levels[l];
+            if (l > 0) {
+                const TileMap& f = levels[l - 1].tiles;
+                want.assign(size_t(g.tiles.T) * g.tiles.T * g.tiles.T, 0);
+                for (int t : f.active) {
+                    int ox, oy, oz;
+                    f.tileOrigin(t, ox, oy, oz);
+                    want[g.tiles.tileAt(ox / 2, oy / 2, oz / 2)] = 1;
+                }
+                g.allocate(want);
+            }
+            // unknowns: cells of allocated tiles that cover an unknown of the finer level
+            const Grid* fine = l > 0 ? &levels[l - 1] : nullptr;
+            auto unknown = [&](int x, int y, int z) {
+                if (x >= g.n || y >= g.n || z >= g.n || g.tiles.slot[g.tiles.tileAt(x, y, z)] < 0) return false;
+                if (!fine) return true;
+                for (int c = 0; c < 8; ++c)
+                    if (fine->tiles.fetch(fine->invDiag, 2 * x + (c & 1), 2 * y + (c >> 1 & 1), 2 * z + (c >> 2)) != 0.0f)
+                        return true;
+                return false;
+            };
+            const float air = 1.0f - g.dirichletWeight;   // diagonal lost per Dirichlet face
+            forTiles(g.tiles, [&](int, size_t base, int ox, int oy, int oz) {
+                for (int lz = 0; lz < B; ++lz)
+                    for (int ly = 0; ly < B; ++ly)
+                        for (int lx = 0; lx < B; ++lx) {
+                            int x = ox + lx, y = oy + ly, z = oz + lz;
+                            size_t i = base + (lz * B + ly) * B + lx;
+                            if (!unknown(x, y, z)) { g.diag[i] = 0.0f; g.invDiag[i] = 0.0f; continue; }
+                            float d = 6.0f;
+                            const int nb[6][3] = { { x - 1, y, z }, { x + 1, y, z }, { x, y - 1, z },
+                                                   { x, y + 1, z }, { x, y, z - 1 }, { x, y, z + 1 } };
+                            for (const int* c : nb) {
+                                if (c[1] >= g.n) d -= air;                     // open top
+                                else if (c[0] < 0 || c[0] >= g.n || c[1] < 0 || c[2] < 0 || c[2] >= g.n) d -= 1.0f;   // wall
+                                else if (!unknown(c[0], c[1], c[2])) d -= air;
+                            }
+                            g.diag[i] = d;
+                            g.invDiag[i] = 1.0f / d;
+                        }
+            });
+        }
+    }
+
+    void vcycle(size_t l = 0) {
+        Grid& g = levels[l];
+        if (l + 1 == levels.size()) { smooth(g, coarseSweeps); return; }
+        smooth(g, preSmooth);
+        computeResidual(g);
+        Grid& c = levels[l + 1];
+        restrictResidual(g, c);
+        std::fill(c.p.begin(), c.p.end(), T(0));
+        vcycle(l + 1);
+        prolongAdd(c, g);
+        smooth(g, postSmooth);
+    }
+
+    void smooth(Grid& g, int sweeps) const {
+        if (wavefront) relaxRedBlackWavefront(g, sweeps);
+        else relaxRedBlack(g, sweeps);
+    }
+
+    // coarse b = (2h)^2 f = 4 * mean of the fine residuals (which carry h^2)
+    static void restrictResidual(const Grid& f, Grid& c) {
+        const int B = TileMap::B;
+        forTiles(c.tiles, [&](int, size_t base, int ox, int oy, int oz) {
+            for (int lz = 0; lz < B; ++lz)
+                for (int ly = 0; ly < B; ++ly)
+                    for (int lx = 0; lx < B; ++lx) {
+                        int x = 2 * (ox + lx), y = 2 * (oy + ly), z = 2 * (oz + lz);
+                        float s = 0.0f;
+                        // children share one fine tile; padding beyond the domain has none
+                        int st = x < f.n && y < f.n && z < f.n ? f.tiles.slot[f.tiles.tileAt(x, y, z)] : -1;
+                        if (st >= 0) {
+                            const T* r = &f.r[size_t(st) * TileMap::B3 + TileMap::local(x, y, z)];
+                            for (int dz = 0; dz < 2; ++dz)
+                                for (int dy = 0; dy < 2; ++dy)
+                                    s += toFloat(r[(dz * B + dy) * B]) + toFloat(r[(dz * B + dy) * B + 1]);
+                        }
+                        fromFloat(0.5f * s, c.b[base + (lz * B + ly) * B + lx]);   // 4 * s / 8
+                    }
+        });
+    }
+
+    // fine cell 2k sits 3/4 of the way from coarse k-1 to k, 2k+1 a quarter
+    // from k to k+1; air and out-of-domain coarse cells read 0
+    static void prolongAdd(const Grid& c, Grid& f) {
+        const int B = TileMap::B;
+        auto taps = [&](int xf, int& i0, int& i1, float& w1) {
+            int k = xf >> 1;
+            if (xf & 1) { i0 = k; i1 = std::min(k + 1, c.n - 1); w1 = 0.25f; }
+            else        { i0 = std::max(k - 1, 0); i1 = k; w1 = 0.75f; }
+        };
+        forTiles(f.tiles, [&](int, size_t base, int ox, int oy, int oz) {
+            for (int lz = 0; lz < B; ++lz) {
+                int z0, z1; float wz;
+                taps(oz + lz, z0, z1, wz);
+                for (int ly = 0; ly < B; ++ly) {
+                    int y0, y1; float wy;
+                    taps(oy + ly, y0, y1, wy);
+                    for (int lx = 0; lx < B; ++lx) {
+                        size_t i = base + (lz * B + ly) * B + lx;
+                        if (f.invDiag[i] == 0.0f) continue;
+                        int x0, x1; float wx;
+                        taps(ox + lx, x0, x1, wx);
+                        auto lerpX = [&](int yy, int zz) {
+                            return c.tiles.fetch(c.p, x0, yy, zz) * (1.0f - wx) + c.tiles.fetch(c.p, x1, yy, zz) * wx;
+                        };
+                        float a = lerpX(y0, z0) * (1.0f - wy) + lerpX(y1, z0) * wy;
+                        float b = lerpX(y0, z1) * (1.0f - wy) + lerpX(y1, z1) * wy;
+                        fromFloat(toFloat(f.p[i]) + a * (1.0f - wz) + b * wz, f.p[i]);
+                    }
+                }
+            }
+        });
+    }
+};
+
+using MultigridSolver = MultigridSolverT<float>;
@@ -0,0 +1,381 @@
+﻿// Noise.h — CPU noise bases (Perlin, wavelet) and the fBm volume bake
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <array>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+#include "SpectralNoise.h"
+#include "GaborNoise.h"
+
+// ---------- 3D Perlin noise (CPU) ----------
+static float fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
+static float lerp(float a, float b, float t) { return a + (b - a) * t; }
+
+static float grad(int hash, float x, float y, float z) {
+    int h = hash & 15;
+    float u = h < 8 ? x : y;
+    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+struct Perlin3D {
+    std::array<int, 512> p;
+    Perlin3D(unsigned seed = 1337) {
+        std::vector<int> perm(256);
+        for (int i = 0; i < 256; ++i) perm[i] = i;
+        // simple LCG shuffle
+        unsigned s = seed;
+        for (int i = 255; i > 0; --i) {
+            s = s * 1664525u + 1013904223u;
+            int j = s % (i + 1);
+            std::swap(perm[i], perm[j]);
+        }
+        for (int i = 0; i < 512; ++i) p[i] = perm[i & 255];
+    }
+    float noise(float x, float y, float z) const {
+        int X = (int)floorf(x) & 255, Y = (int)floorf(y) & 255, Z = (int)floorf(z) & 255;
+        x -= floorf(x); y -= floorf(y); z -= floorf(z);
+        float u = fade(x), v = fade(y), w = fade(z);
+        int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
+        int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
+
+        float res = lerp(
+            lerp(lerp(grad(p[AA], x, y, z),
+                grad(p[BA], x - 1, y, z), u),
+                lerp(grad(p[AB], x, y - 1, z),
+                    grad(p[BB], x - 1, y - 1, z), u), v),
+            lerp(lerp(grad(p[AA + 1], x, y, z - 1),
+                grad(p[BA + 1], x - 1, y, z - 1), u),
+                lerp(grad(p[AB + 1], x, y - 1, z - 1),
+                    grad(p[BB + 1], x - 1, y - 1, z - 1), u), v),
+            w);
+        // bring to [0,1]
+        return 0.5f * (res + 1.0f);
+    }
+
+#ifdef FIRE_SSE2
+    // noise() at four points: the lattice hashing stays scalar, the rest is SSE2
+    __m128 noise4(__m128 x, __m128 y, __m128 z) const {
+        __m128 fx = floor_ps(x), fy = floor_ps(y), fz = floor_ps(z);
+        alignas(16) int X[4], Y[4], Z[4], h[8][4];
+        const __m128i wrap = _mm_set1_epi32(255);
+        _mm_store_si128((__m128i*)X, _mm_and_si128(_mm_cvttps_epi32(fx), wrap));
+        _mm_store_si128((__m128i*)Y, _mm_and_si128(_mm_cvttps_epi32(fy), wrap));
+        _mm_store_si128((__m128i*)Z, _mm_and_si128(_mm_cvttps_epi32(fz), wrap));
+        for (int l = 0; l < 4; ++l) {
+            int A = p[X[l]] + Y[l], AA = p[A] + Z[l], AB = p[A + 1] + Z[l];
+            int B = p[X[l] + 1] + Y[l], BA = p[B] + Z[l], BB = p[B + 1] + Z[l];
+            h[0][l] = p[AA]; h[1][l] = p[BA]; h[2][l] = p[AB]; h[3][l] = p[BB];
+            h[4][l] = p[AA + 1]; h[5][l] = p[BA + 1]; h[6][l] = p[AB + 1]; h[7][l] = p[BB + 1];
+        }
+        x = _mm_sub_ps(x, fx); y = _mm_sub_ps(y, fy); z = _mm_sub_ps(z, fz);
+        const __m128 one = _mm_set1_ps(1.0f);
+        __m128 x1 = _mm_sub_ps(x, one), y1 = _mm_sub_ps(y, one), z1 = _mm_sub_ps(z, one);
+        auto fade4 = [](__m128 t) {
+            __m128 q = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(-15.0f));
+            q = _mm_add_ps(_mm_mul_ps(t, q), _mm_set1_ps(10.0f));
+            return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), q);
+        };
+        auto lerp4 = [](__m128 a, __m128 b, __m128 t) { return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t)); };
+        __m128 u = fade4(x), v = fade4(y), w = fade4(z);
+        __m128 res = lerp4(
+            lerp4(lerp4(grad4(h[0], x, y, z), grad4(h[1], x1, y, z), u),
+                  lerp4(grad4(h[2], x, y1, z), grad4(h[3], x1, y1, z), u), v),
+            lerp4(lerp4(grad4(h[4], x, y, z1), grad4(h[5], x1, y, z1), u),
+                  lerp4(grad4(h[6], x, y1, z1), grad4(h[7], x1, y1, z1), u), v),
+            w);
+        return _mm_mul_ps(_mm_set1_ps(0.5f), _mm_add_ps(res, one));
+    }
+
+    // grad() per lane: selects by mask, negates by flipping the sign bit
+    static __m128 grad4(const int* hash, __m128 x, __m128 y, __m128 z) {
+        __m128i h = _mm_and_si128(_mm_load_si128((const __m128i*)hash), _mm_set1_epi32(15));
+        auto pick = [](__m128i mask, __m128 a, __m128 b) {
+            __m128 m = _mm_castsi128_ps(mask);
+            return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+        };
+        __m128 u = pick(_mm_cmplt_epi32(h, _mm_set1_epi32(8)), x, y);
+        __m128i xz = _mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14)));
+        __m128 v = pick(_mm_cmplt_epi32(h, _mm_set1_epi32(4)), y, pick(xz, x, z));
+        __m128 su = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+        __m128 sv = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+        return _mm_add_ps(_mm_xor_ps(u, su), _mm_xor_ps(v, sv));
+    }
+#endif
+};
+
+// ---------- 3D wavelet noise (CPU) ----------
+// Cook & DeRose, "Wavelet Noise", SIGGRAPH 2005. A tile of gaussian noise minus
+// its least-squares projection onto the next coarser quadratic B-spline level
+// keeps (almost) only one octave band, so bands can be summed and dropped
+// without aliasing. The tile is periodic with period n.
+struct WaveletNoise3D {
+    int n = 0;
+    std::vector<float> tile;
+    float scale = 1.0f;   // maps the raw noise to Perlin3D's spread
+
+    static int wrap(int x, int n) { int m = x % n; return m < 0 ? m + n : m; }
+
+    // least-squares analysis filter for the quadratic B-spline refinement
+    // {1/4, 3/4, 3/4, 1/4}, centred between taps -1 and 0
+    static void downsample(const float* from, float* to, int n, int stride) {
+        static const float a[32] = {
+            -0.000173f, -0.001526f,  0.000402f,  0.003545f, -0.000935f, -0.008232f,  0.002171f,  0.019120f,
+            -0.005039f, -0.044412f,  0.011655f,  0.103311f, -0.025936f, -0.243780f,  0.033979f,  0.655340f,
+             0.655340f,  0.033979f, -0.243780f, -0.025936f,  0.103311f,  0.011655f, -0.044412f, -0.005039f,
+             0.019120f,  0.002171f, -0.008232f, -0.000935f,  0.003545f,  0.000402f, -0.001526f, -0.000173f };
+        for (int i = 0; i < n / 2; ++i) {
+            float sum = 0.0f;
+            for (int k = -16; k < 16; ++k) sum += a[k + 16] * from[wrap(2 * i + k, n) * stride];
+            to[i * stride] = sum;
+        }
+    }
+
+    static void upsample(const float* from, float* to, int n, int stride) {
+        for (int i = 0; i < n; ++i) {
+            int m = i / 2;
+            float c0 = from[wrap(m, n / 2) * stride], c1 = from[wrap(m + 1, n / 2) * stride];
+            to[i * stride] = (i & 1) ? 0.25f * c0 + 0.75f * c1 : 0.75f * c0 + 0.25f * c1;
+        }
+    }
+
+    WaveletNoise3D(int tileSize = 32, unsigned seed = 1337) {
+        n = tileSize + (tileSize & 1);
+        const int count = n * n * n;
+        std::vector<float> noise(count), temp1(count), temp2(count);
+
+        // gaussian random coefficients (Box-Muller over the Perlin3D LCG)
+        unsigned s = seed;
+        auto uniform = [&]() { s = s * 1664525u + 1013904223u; return ((s >> 8) + 0.5f) / 16777216.0f; };
+        for (int i = 0; i < count; i += 2) {
+            float r = std::sqrt(-2.0f * std::log(uniform())), phi = 6.28318531f * uniform();
+            noise[i] = r * std::cos(phi);
+            if (i + 1 < count) noise[i + 1] = r * std::sin(phi);
+        }
+
+        // coarse projection: down + up along x, then y, then z; every row of
+        // a pass is independent, so rows are spread over the job pool
+        jobs().parallelFor(0, n * n, [&](int lo, int hi) {
+            for (int r = lo; r < hi; ++r) {               // x rows
+                int i = r * n;
+                downsample(&noise[i], &temp1[i], n, 1);
+                upsample(&temp1[i], &temp2[i], n, 1);
+            }
+        });
+        jobs().parallelFor(0, n * n, [&](int lo, int hi) {
+            for (int r = lo; r < hi; ++r) {               // y rows
+                int i = (r / n) * n * n + (r % n);
+                downsample(&temp2[i], &temp1[i], n, n);
+                upsample(&temp1[i], &temp2[i], n, n);
+            }
+        });
+        jobs().parallelFor(0, n * n, [&](int lo, int hi) {
+            for (int r = lo; r < hi; ++r) {               // z rows
+                downsample(&temp2[r], &temp1[r], n, n * n);
+                upsample(&temp1[r], &temp2[r], n, n * n);
+            }
+        });
+
+        // keep the detail band only, then add an odd-shifted copy to even
+        // out the variance between even and odd lattice points
+        for (int i = 0; i < count; ++i) noise[i] -= temp2[i];
+        int offset = n / 2;
+        if (offset % 2 == 0) ++offset;
+        jobs().parallelFor(0, n, [&](int lo, int hi) {
+            for (int z = lo; z < hi; ++z)
+                for (int y = 0; y < n; ++y)
+                    for (int x = 0; x < n; ++x)
+                        temp1[(z * n + y) * n + x] =
+                            noise[(wrap(z + offset, n) * n + wrap(y + offset, n)) * n + wrap(x + offset, n)];
+        });
+        tile.resize(count);
+        for (int i = 0; i < count; ++i) tile[i] = noise[i] + temp1[i];
+
+        // match Perlin3D::noise's spread (~0.14 around 0.5) so the two bases
+        // are interchangeable in the fBm sum; measured on a fixed point set
+        double sum = 0.0, sum2 = 0.0;
+        const int samples = 4096;
+        for (int i = 0; i < samples; ++i) {
+            float x = uniform() * n, y = uniform() * n, z = uniform() * n;
+            float v = this->noise(x, y, z) - 0.5f;
+            sum += v; sum2 += double(v) * v;
+        }
+        double var = sum2 / samples - (sum / samples) * (sum / samples);
+        scale = var > 0.0 ? float(0.14 / std::sqrt(var)) : 1.0f;
+    }
+
+    // periodic quadratic B-spline evaluation, result in [0,1] like Perlin3D
+    float noise(float x, float y, float z) const {
+        const float p[3] = { x, y, z };
+        int mid[3];
+        float w[3][3];
+        for (int i = 0; i < 3; ++i) {
+            mid[i] = (int)std::ceil(p[i] - 0.5f);
+            float t = mid[i] - (p[i] - 0.5f);
+            w[i][0] = t * t * 0.5f;
+            w[i][2] = (1.0f - t) * (1.0f - t) * 0.5f;
+            w[i][1] = 1.0f - w[i][0] - w[i][2];
+        }
+        float res = 0.0f;
+        for (int fz = -1; fz <= 1; ++fz) {
+            int cz = wrap(mid[2] + fz, n);
+            for (int fy = -1; fy <= 1; ++fy) {
+                int cy = wrap(mid[1] + fy, n);
+                const float* row = &tile[(cz * n + cy) * n];
+                float wzy = w[2][fz + 1] * w[1][fy + 1];
+                for (int fx = -1; fx <= 1; ++fx)
+                    res += wzy * w[0][fx + 1] * row[wrap(mid[0] + fx, n)];
+            }
+        }
+        return 0.5f + res * scale;
+    }
+};
+
+// ---------- fBm volume bake ----------
+enum class NoiseBasis { Perlin, Wavelet, Spectral };
+
+// N^3 fBm in [0,1], z-slabs in parallel.
+// Perlin: base lattice of 8 cells across the volume, octaves scaled by
+// lacunarity (not band-limited: octaves above the volume's Nyquist rate alias).
+// Wavelet: each octave is its own periodic tile whose size equals its cell
+// count across the volume (even, nearest to 8 * lacunarity^o), so the volume
+// tiles seamlessly. A band of c cells spans c/4..c/2 cycles, so octaves with
+// more cells than voxels would pass the volume's Nyquist rate and are dropped
+// instead of aliasing.
+// Spectral: the same fBm spectrum written directly into a frequency grid and
+// inverse-FFT'd (see SpectralNoise.h), O(N^3 log N) regardless of octaves;
+// non-power-of-two N is synthesized at the next power of two and resampled.
+static std::vector<float> bakeFbmVolume(int N, int octaves, float lacunarity, float gain, unsigned seed,
+                                        NoiseBasis basis = NoiseBasis::Perlin) {
+    FIRE_TRACE("bakeFbmVolume", "bake");
+    if (basis == NoiseBasis::Spectral) {
+        // fBm amplitude falls as gain per lacunarity step: amp ~ f^-H with
+        // H = log(1/gain)/log(lacunarity); per-bin 3D amplitude is f^-(H + 3/2)
+        float H = std::log(1.0f / gain) / std::log(lacunarity);
+        float kMax = 8.0f * std::pow(lacunarity, float(octaves - 1)) * 2.0f;
+        int M = 1;
+        while (M < N) M <<= 1;
+        std::vector<float> spec = synthesizeSpectralVolume(M, H + 1.5f, 4.0f, kMax, seed);
+
+        // same mean and spread as the octave sum of Perlin3D (0.5 +- 0.14 each)
+        float sumAmp = 0.0f, sumAmp2 = 0.0f, amp = 1.0f;
+        for (int o = 0; o < octaves; ++o) { sumAmp += amp; sumAmp2 += amp * amp; amp *= gain; }
+        float mean = 0.5f * sumAmp / 1.5f, spread = 0.14f * std::sqrt(sumAmp2) / 1.5f;
+
+        if (M == N) {   // map in place, no second N^3 buffer
+            jobs().parallelFor(0, N, [&](int z0, int z1) {
+                for (size_t i = size_t(z0) * N * N; i < size_t(z1) * N * N; ++i)
+                    spec[i] = std::min(1.0f, std::max(0.0f, mean + spread * spec[i]));
+            });
+            return spec;
+        }
+
+        std::vector<float> vol(size_t(N) * N * N);
+        float toM = float(M) / float(N);
+        jobs().parallelFor(0, N, [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z)
+                for (int y = 0; y < N; ++y)
+                    for (int x = 0; x < N; ++x) {
+                        // periodic trilinear
+                        float p[3] = { x * toM, y * toM, z * toM };
+                        int i0[3], i1[3]; float t[3];
+                        for (int a = 0; a < 3; ++a) {
+                            int f = (int)std::floor(p[a]);
+                            t[a] = p[a] - f; i0[a] = f % M; i1[a] = (f + 1) % M;
+                        }
+                        auto at = [&](int xi, int yi, int zi) { return spec[(size_t(zi) * M + yi) * M + xi]; };
+                        float v = lerp(lerp(lerp(at(i0[0], i0[1], i0[2]), at(i1[0], i0[1], i0[2]), t[0]),
+                                            lerp(at(i0[0], i1[1], i0[2]), at(i1[0], i1[1], i0[2]), t[0]), t[1]),
+                                       lerp(lerp(at(i0[0], i0[1], i1[2]), at(i1[0], i0[1], i1[2]), t[0]),
+                                            lerp(at(i0[0], i1[1], i1[2]), at(i1[0], i1[1], i1[2]), t[0]), t[1]), t[2]);
+                        vol[(size_t(z) * N + y) * N + x] = std::min(1.0f, std::max(0.0f, mean + spread * v));
+                    }
+        });
+        return vol;
+    }
+
+    std::vector<float> vol(size_t(N) * N * N);
+    float invN = 1.0f / float(N);
+
+    if (basis == NoiseBasis::Perlin) {
+        Perlin3D per(seed);
+        jobs().parallelFor(0, N, [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z)
+                for (int y = 0; y < N; ++y)
+                    for (int x = 0; x < N; ++x) {
+                        float fx = x * invN, fy = y * invN, fz = z * invN;
+                        float f = 0.0f, amp = 1.0f, freq = 1.0f;
+                        for (int o = 0; o < octaves; ++o) {
+                            f += amp * per.noise(fx * freq * 8.0f, fy * freq * 8.0f, fz * freq * 8.0f);
+                            freq *= lacunarity; amp *= gain;
+                        }
+                        vol[(size_t(z) * N + y) * N + x] = std::min(1.0f, std::max(0.0f, f / 1.5f)); // normalize a bit
+                    }
+        });
+        return vol;
+    }
+
+    std::vector<WaveletNoise3D> bands;
+    std::vector<float> amps;
+    float amp = 1.0f, freq = 1.0f, dropped = 0.0f;
+    for (int o = 0; o < octaves; ++o) {
+        int cells = 2 * std::max(1, (int)std::lround(4.0f * freq));
+        if (cells <= N) {
+            bands.emplace_back(cells, seed + 977u * unsigned(o));
+            amps.push_back(amp);
+        } else {
+            dropped += amp;   // band above Nyquist: keep its mean, not its detail
+        }
+        freq *= lacunarity; amp *= gain;
+    }
+    jobs().parallelFor(0, N, [&](int z0, int z1) {
+        for (int z = z0; z < z1; ++z)
+            for (int y = 0; y < N; ++y)
+                for (int x = 0; x < N; ++x) {
+                    float f = 0.5f * dropped;
+                    for (size_t b = 0; b < bands.size(); ++b) {
+                        float s = float(bands[b].n) * invN;
+                        f += amps[b] * bands[b].noise(x * s, y * s, z * s);
+                    }
+                    vol[(size_t(z) * N + y) * N + x] = std::min(1.0f, std::max(0.0f, f / 1.5f));
+                }
+    });
+    return vol;
+}
+
+// The noise texture's texels, RG8: R = fBm, G = Gabor streaks, both baked
+// side by side. dither: blue-noise volume (ditherN^3, tiled) spreading the
+// 8-bit rounding error; the two channels read it half a tile apart so their
+// errors do not correlate. The two volumes are baked one after the other,
+// each over the whole pool: a parallelFor nested in a job runs inline, so
+// baking them as two jobs would leave each on one thread. Packing runs over
+// z-slabs in parallel.
+static std::vector<unsigned char> bakeNoiseTexels(int N, int octaves, float lacunarity, float gain, unsigned seed,
+                                                  const std::vector<unsigned char>& dither, int ditherN,
+                                                  NoiseBasis basis = NoiseBasis::Perlin) {
+    FIRE_TRACE("bakeNoiseTexels", "bake");
+    std::vector<float> fbm = bakeFbmVolume(N, octaves, lacunarity, gain, seed, basis);
+    std::vector<float> gabor = bakeGaborVolume(N, GaborParams());
+    std::vector<unsigned char> vox(size_t(2) * N * N * N);
+    const int half = ditherN / 2;
+    jobs().parallelFor(0, N, [&](int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            for (int y = 0; y < N; ++y) {
+                for (int x = 0; x < N; ++x) {
+                    size_t i = (size_t(z) * N + y) * N + x;
+                    float f = fbm[i];
+                    float g = std::min(1.0f, std::max(0.0f, 0.5f + 0.18f * gabor[i]));
+                    float d0 = (dither[((z % ditherN) * ditherN + y % ditherN) * ditherN + x % ditherN] + 0.5f) / 256.0f;
+                    float d1 = (dither[(((z + half) % ditherN) * ditherN + (y + half) % ditherN) * ditherN + (x + half) % ditherN] + 0.5f) / 256.0f;
+                    vox[2 * i + 0] = (unsigned char)std::min(255.0f, std::floor(f * 255.0f + d0));
+                    vox[2 * i + 1] = (unsigned char)std::min(255.0f, std::floor(g * 255.0f + d1));
+                }
+            }
+        }
+    });
+    return vox;
+}
@@ -0,0 +1,305 @@
+﻿// NoiseBench.cpp — micro-benchmarks for the CPU noise and the noise-texture bake (no window, no GL)
+// g++ NoiseBench.cpp -pthread -std=c++14 -O2 -o noisebench   (Linux/Mac)
+// cl /std:c++14 /O2 /EHsc NoiseBench.cpp                         (Windows)
+//
+// noisebench [--sizes 32,64,128,256] [--octaves 1,3,5] [--threads 1,2,4,...]
+//            [--min-ms 200] [--json <file>] [--no-counters]
+// Prints a table and writes the same results as JSON (to stdout after the
+// table when no file is given). Where the machine has them, hardware
+// counters of the fastest run (PerfCounters.h) go next to each time, per
+// sample or voxel; --no-counters leaves them out.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Noise.h"
+#include "PerfCounters.h"
+
+static double msSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// counted around every timed run when set (main() opens them, and runBakes
+// again whenever the pool changes)
+static PerfCounters* benchCounters = nullptr;
+
+// repeats fn until minMs have passed (at least twice, the first run
+// warming caches and the pool) and returns the fastest run in ms, with
+// its counters in *perf
+static double bestOf(const std::function<void()>& fn, double minMs, PerfSample* perf) {
+    fn();
+    double best = 1e30, spent = 0.0;
+    int runs = 0;
+    while (runs < 1 || spent < minMs) {
+        if (benchCounters) benchCounters->start();
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        double ms = msSince(t0);
+        PerfSample s = benchCounters ? benchCounters->stop() : PerfSample();
+        if (ms < best) { best = ms; *perf = s; }
+        spent += ms;
+        ++runs;
+    }
+    return best;
+}
+
+// keeps results alive so the timed loops are not optimized away
+static volatile float benchSink;
+
+struct MicroResult {
+    const char* name;
+    long long samples;
+    double nsPerSample;
+    PerfSample perf;
+};
+
+struct BakeResult {
+    const char* kind;
+    int N, octaves, threads;
+    double ms;
+    PerfSample perf;
+    double nsPerVoxel() const { return ms * 1e6 / (double(N) * N * N); }
+    double voxelsPerSecond() const { return double(N) * N * N / (ms * 1e-3); }
+};
+
+// the counters of one run per sample (or voxel), ending the table row
+static void printPerf(const PerfSample& s, double samples, double ms) {
+    if (benchCounters) printPerfColumns(stdout, s, samples, ms);
+    printf("\n");
+}
+
+static void writePerfJson(FILE* f, const PerfSample& s, double samples) {
+    bool any = false;
+    for (int e = 0; e < kPerfEvents; ++e) any = any || s.has[e];
+    if (!any) { fprintf(f, "null"); return; }
+    fprintf(f, "{");
+    bool first = true;
+    for (int e = 0; e < kPerfEvents; ++e) {
+        if (!s.has[e]) continue;
+        fprintf(f, "%s \"%s\": %.4f", first ? "" : ",", perfEventName(e), s.count[e] / samples);
+        first = false;
+    }
+    if (s.ipc() > 0.0) fprintf(f, ", \"ipc\": %.3f", s.ipc());
+    fprintf(f, " }");
+}
+
+// Scattered points walk a diagonal with irrational steps, so every call
+// lands in a different cell at a different fraction and the gradient
+// selection cannot be predicted. Row points are a 128^3 grid in x-major
+// order at 16 voxels per cell, the way the bake visits them.
+static const int kMicroSamples = 1 << 20;
+
+static std::vector<float> microInputs(bool rows) {
+    std::vector<float> v(size_t(kMicroSamples) * 3);
+    for (int i = 0; i < kMicroSamples; ++i) {
+        if (rows) {
+            v[3 * i + 0] = (i & 127) / 16.0f;
+            v[3 * i + 1] = ((i >> 7) & 127) / 16.0f;
+            v[3 * i + 2] = (i >> 14) / 16.0f;
+        } else {
+            v[3 * i + 0] = 8.0f * std::fmod(i * 0.6180339887f, 1.0f) + i * 0.013f;
+            v[3 * i + 1] = 8.0f * std::fmod(i * 0.7548776662f, 1.0f) + i * 0.007f;
+            v[3 * i + 2] = 8.0f * std::fmod(i * 0.5698402910f, 1.0f) + i * 0.011f;
+        }
+    }
+    return v;
+}
+
+// single-threaded kernels: the fade curve, the gradient dot product, and
+// Perlin3D::noise one point at a time and (with SSE2) four at a time, at
+// scattered points and along rows
+static void runNoise(const Perlin3D& per, const std::vector<float>& in, bool rows, double minMs,
+                     std::vector<MicroResult>& out) {
+    const double n = double(kMicroSamples);
+    PerfSample perf;
+    double ms = bestOf([&] {
+        float s = 0.0f;
+        for (int i = 0; i < kMicroSamples; ++i) s += per.noise(in[3 * i], in[3 * i + 1], in[3 * i + 2]);
+        benchSink = s;
+    }, minMs, &perf);
+    out.push_back({ rows ? "noise-row" : "noise", kMicroSamples, ms * 1e6 / n, perf });
+#ifdef FIRE_SSE2
+    // the same points, transposed to SoA once outside the timed loop
+    std::vector<float> xs(kMicroSamples), ys(kMicroSamples), zs(kMicroSamples);
+    for (int i = 0; i < kMicroSamples; ++i) { xs[i] = in[3 * i]; ys[i] = in[3 * i + 1]; zs[i] = in[3 * i + 2]; }
+    ms = bestOf([&] {
+        __m128 s = _mm_setzero_ps();
+        for (int i = 0; i < kMicroSamples; i += 4)
+            s = _mm_add_ps(s, per.noise4(_mm_loadu_ps(&xs[i]), _mm_loadu_ps(&ys[i]), _mm_loadu_ps(&zs[i])));
+        benchSink = _mm_cvtss_f32(s);
+    }, minMs, &perf);
+    out.push_back({ rows ? "noise4-row" : "noise4", kMicroSamples, ms * 1e6 / n, perf });
+#endif
+}
+
+static std::vector<MicroResult> runMicro(double minMs) {
+    std::vector<MicroResult> out;
+    const Perlin3D per(42);
+    const std::vector<float> in = microInputs(false);
+    const double n = double(kMicroSamples);
+    PerfSample perf;
+
+    double ms = bestOf([&] {
+        float s = 0.0f;
+        for (int i = 0; i < kMicroSamples; ++i) s += fade(in[3 * i] - std::floor(in[3 * i]));
+        benchSink = s;
+    }, minMs, &perf);
+    out.push_back({ "fade", kMicroSamples, ms * 1e6 / n, perf });
+
+    ms = bestOf([&] {
+        float s = 0.0f;
+        for (int i = 0; i < kMicroSamples; ++i) s += grad(per.p[i & 511], in[3 * i], in[3 * i + 1], in[3 * i + 2]);
+        benchSink = s;
+    }, minMs, &perf);
+    out.push_back({ "grad", kMicroSamples, ms * 1e6 / n, perf });
+
+    runNoise(per, in, false, minMs, out);
+    runNoise(per, microInputs(true), true, minMs, out);
+    return out;
+}
+
+// The bakes at every size x octaves x thread count:
+// fbm     bakeFbmVolume, Perlin basis (the octave sum alone)
+// texture bakeNoiseTexels with the settings make3DNoiseTex uses, i.e. fBm
+//         and Gabor side by side plus the dithered RG8 pack. The dither is
+//         a hashed 32^3 volume instead of the blue noise, which costs the
+//         same to read and needs no void-and-cluster run first.
+static std::vector<BakeResult> runBakes(const std::vector<int>& sizes, const std::vector<int>& octaves,
+                                        const std::vector<int>& threads, double minMs) {
+    const int ditherN = 32;
+    std::vector<unsigned char> dither(size_t(ditherN) * ditherN * ditherN);
+    for (size_t i = 0; i < dither.size(); ++i) {
+        uint32_t h = uint32_t(i) * 2654435761u;
+        h ^= h >> 15; h *= 2246822519u; h ^= h >> 13;
+        dither[i] = (unsigned char)(h >> 24);
+    }
+    std::vector<BakeResult> out;
+    auto print = [](const BakeResult& b) {
+        printf("%8s %6d %8d %8d %12.2f %12.2f %14.3e", b.kind, b.N, b.octaves, b.threads, b.ms, b.nsPerVoxel(),
+               b.voxelsPerSecond());
+        printPerf(b.perf, double(b.N) * b.N * b.N, b.ms);
+        fflush(stdout);
+    };
+    for (int t : threads) {
+        jobs().resize(t);
+        if (benchCounters) benchCounters->open();   // on the new workers too
+        for (int N : sizes) {
+            for (int o : octaves) {
+                PerfSample perf;
+                double ms = bestOf([&] { benchSink = bakeFbmVolume(N, o, 2.01f, 0.52f, 42, NoiseBasis::Perlin)[0]; }, minMs, &perf);
+                out.push_back({ "fbm", N, o, t, ms, perf });
+                print(out.back());
+                ms = bestOf([&] { benchSink = bakeNoiseTexels(N, o, 2.01f, 0.52f, 42, dither, ditherN)[0]; }, minMs, &perf);
+                out.push_back({ "texture", N, o, t, ms, perf });
+                print(out.back());
+            }
+        }
+    }
+    jobs().resize(0);
+    return out;
+}
+
+static void writeJson(FILE* f, const std::vector<MicroResult>& micro, const std::vector<BakeResult>& bakes) {
+    fprintf(f, "{\n  \"hardwareThreads\": %u,\n", std::max(1u, std::thread::hardware_concurrency()));
+    if (!benchCounters) fprintf(f, "  \"counters\": \"off\",\n");
+    else if (!benchCounters->available()) fprintf(f, "  \"counters\": \"unavailable (%s)\",\n", benchCounters->why());
+    else fprintf(f, "  \"counters\": \"per sample or voxel, fastest run\",\n");
+#ifdef FIRE_SSE2
+    fprintf(f, "  \"simd\": \"sse2\",\n");
+#else
+    fprintf(f, "  \"simd\": \"scalar\",\n");
+#endif
+    fprintf(f, "  \"micro\": [\n");
+    for (size_t i = 0; i < micro.size(); ++i) {
+        fprintf(f, "    { \"name\": \"%s\", \"samples\": %lld, \"nsPerSample\": %.4f, \"counters\": ", micro[i].name,
+                micro[i].samples, micro[i].nsPerSample);
+        writePerfJson(f, micro[i].perf, double(micro[i].samples));
+        fprintf(f, " }%s\n", i + 1 < micro.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"bake\": [\n");
+    for (size_t i = 0; i < bakes.size(); ++i) {
+        const BakeResult& b = bakes[i];
+        fprintf(f, "    { \"kind\": \"%s\", \"N\": %d, \"octaves\": %d, \"threads\": %d, \"ms\": %.3f, "
+                   "\"nsPerVoxel\": %.3f, \"voxelsPerSecond\": %.6e, \"counters\": ",
+                b.kind, b.N, b.octaves, b.threads, b.ms, b.nsPerVoxel(), b.voxelsPerSecond());
+        writePerfJson(f, b.perf, double(b.N) * b.N * b.N);
+        fprintf(f, " }%s\n", i + 1 < bakes.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// "32,64,128" -> { 32, 64, 128 }; non-positive entries are dropped
+static std::vector<int> parseList(const char* s) {
+    std::vector<int> v;
+    while (*s) {
+        int x = std::atoi(s);
+        if (x > 0) v.push_back(x);
+        const char* comma = std::strchr(s, ',');
+        if (!comma) break;
+        s = comma + 1;
+    }
+    return v;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes = { 32, 64, 128, 256 }, octaves = { 1, 3, 5 }, threads = { 1, 2, 4 };
+    int hw = std::max(1u, std::thread::hardware_concurrency());
+    if (hw > 4) threads.push_back(hw);
+    double minMs = 200.0;
+    const char* jsonPath = nullptr;
+    bool counters = true;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) sizes = parseList(argv[++i]);
+        else if (std::strcmp(argv[i], "--octaves") == 0 && i + 1 < argc) octaves = parseList(argv[++i]);
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = parseList(argv[++i]);
+        else if (std::strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) minMs = std::max(0.0, std::atof(argv[++i]));
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) jsonPath = argv[++i];
+        else if (std::strcmp(argv[i], "--no-counters") == 0) counters = false;
+        else {
+            fprintf(stderr, "usage: %s [--sizes 32,64,...] [--octaves 1,3,5] [--threads 1,2,4] [--min-ms 200] [--json file] [--no-counters]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    PerfCounters perfCounters;
+    if (counters) {
+        benchCounters = &perfCounters;
+        if (!perfCounters.open()) printf("hardware counters unavailable (%s)\n", perfCounters.why());
+        else if (perfCounters.why()[0]) printf("some hardware counters unavailable (%s)\n", perfCounters.why());
+    }
+
+    printf("noise kernels, 1 thread, %d points\n", kMicroSamples);
+    printf("%10s %12s%s\n", "kernel", "ns/sample", counters ? kPerfColumns : "");
+    std::vector<MicroResult> micro = runMicro(minMs);
+    for (const MicroResult& m : micro) {
+        printf("%10s %12.2f", m.name, m.nsPerSample);
+        printPerf(m.perf, double(m.samples), m.nsPerSample * double(m.samples) * 1e-6);
+    }
+
+    printf("\nbakes, lacunarity 2.01, gain 0.52, %d hardware thread(s), best of >= %.0f ms\n", hw, minMs);
+    printf("%8s %6s %8s %8s %12s %12s %14s%s\n", "kind", "N", "octaves", "threads", "ms", "ns/voxel", "voxels/s",
+           counters ? kPerfColumns : "");
+    std::vector<BakeResult> bakes = runBakes(sizes, octaves, threads, minMs);
+
+    if (!jsonPath) {
+        printf("\n");
+        writeJson(stdout, micro, bakes);
+        return 0;
+    }
+    FILE* f = std::fopen(jsonPath, "w");
+    if (!f) { fprintf(stderr, "cannot write %s\n", jsonPath); return 1; }
+    writeJson(f, micro, bakes);
+    std::fclose(f);
+    printf("\nwrote %s\n", jsonPath);
+    return 0;
+}
@@ -0,0 +1,115 @@
+﻿// Pacing.h — present-to-present intervals against the display's refresh period: histogram, missed vsyncs, long frames
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+// With vsync every present lands on a refresh, so the interval between two
+// presents is a whole number of refresh periods and anything above one is
+// a refresh that showed the previous image again: a visible hitch, however
+// good the average rate looks. Intervals are binned by that number, and a
+// frame is long when its own work, from its start to the swap call, took
+// more than a period, which is what makes it miss the next refresh.
+// Counters cover the window since reset(); the totals the whole run. The
+// samples behind the percentiles are reserved for twice the presents a
+// window holds at the refresh rate, so they fit even at half a period
+// apiece; past that they are counted but not kept, and the max is kept
+// apart from them, so it never misses a late hitch.
+class FramePacing {
+public:
+    static const int Bins = 5;   // <1, 1, 2, 3 and 4+ periods
+
+    // windowSeconds: how often the caller prints and resets
+    explicit FramePacing(double refreshHz = 60.0, double windowSeconds = 5.0) : windowMs_(windowSeconds * 1000.0) {
+        setRefresh(refreshHz);
+    }
+
+    // call outside the frame loop: it sizes the sample buffers
+    void setRefresh(double hz) {
+        periodMs_ = 1000.0 / (hz > 1.0 ? hz : 60.0);
+        size_t n = size_t(2.0 * windowMs_ / periodMs_) + 64;
+        intervals_.reserve(n);
+        sorted_.reserve(n);
+    }
+    double periodMs() const { return periodMs_; }
+
+    void beginFrame() { workStart_ = std::chrono::steady_clock::now(); }
+
+    // call right before the swap, then right after it returns; true when
+    // this present came a refresh or more late
+    void beforeSwap() { workMs_ = msSince(workStart_); }
+    bool presented() {
+        auto now = std::chrono::steady_clock::now();
+        bool hitch = false;
+        if (havePresent_) {
+            double ms = std::chrono::duration<double, std::milli>(now - lastPresent_).count();
+            lastMs_ = ms;
+            double periods = ms / periodMs_;
+            int bin = periods < 0.5 ? 0 : std::min(Bins - 1, int(std::lround(periods)));
+            ++histogram_[bin];
+            if (intervals_.size() < intervals_.capacity()) intervals_.push_back(ms);
+            else ++unkept_;
+            maxMs_ = std::max(maxMs_, ms);
+            if (periods >= 1.5) {
+                long long missed = std::lround(periods) - 1;
+                missed_ += missed;
+                totalMissed_ += missed;
+                ++hitches_;
+                ++totalHitches_;
+                hitch = true;
+            }
+            if (workMs_ > periodMs_) { ++long_; ++totalLong_; }
+        }
+        lastPresent_ = now;
+        havePresent_ = true;
+        return hitch;
+    }
+    // a swap outside the measured frames (a minimized window's): the next
+    // present starts a new baseline instead of an interval spanning the gap
+    void skip() { havePresent_ = false; }
+
+    // e.g. "pacing 60 Hz: 298 presents, p50 16.7 p99 33.4 max 50.1 ms,
+    // 2 hitches (3 missed vsyncs), 1 long frame; periods <1:0 1:296 2:1 3:1 4+:0"
+    void print(FILE* f) const {
+        long long presents = 0;
+        for (long long c : histogram_) presents += c;
+        std::vector<double>& v = sorted_;
+        v.assign(intervals_.begin(), intervals_.end());
+        std::sort(v.begin(), v.end());
+        auto at = [&](double p) { return v.empty() ? 0.0 : v[std::min(v.size() - 1, size_t(p * double(v.size())))]; };
+        fprintf(f, "pacing %.0f Hz: %lld presents, p50 %.1f p99 %.1f max %.1f ms, %lld hitches (%lld missed vsyncs), "
+                   "%lld long frames; periods <1:%lld 1:%lld 2:%lld 3:%lld 4+:%lld; run total %lld hitches, %lld missed, %lld long",
+                1000.0 / periodMs_, presents, at(0.5), at(0.99), maxMs_, hitches_, missed_, long_,
+                histogram_[0], histogram_[1], histogram_[2], histogram_[3], histogram_[4], totalHitches_, totalMissed_, totalLong_);
+        if (unkept_) fprintf(f, "; percentiles over the first %zu", v.size());
+        fprintf(f, "\n");
+    }
+
+    void reset() {
+        for (long long& c : histogram_) c = 0;
+        intervals_.clear();
+        hitches_ = missed_ = long_ = 0;
+        unkept_ = 0;
+        maxMs_ = 0.0;
+    }
+
+    double lastIntervalMs() const { return lastMs_; }
+
+private:
+    static double msSince(std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+    }
+
+    double windowMs_, periodMs_ = 1000.0 / 60.0, workMs_ = 0.0, lastMs_ = 0.0, maxMs_ = 0.0;
+    std::chrono::steady_clock::time_point workStart_, lastPresent_;
+    bool havePresent_ = false;
+    long long histogram_[Bins] = {};
+    std::vector<double> intervals_;
+    mutable std::vector<double> sorted_;   // print()'s copy, reserved like intervals_ so it never allocates
+    long long unkept_ = 0;                 // intervals past the reserve: in the counts, not the percentiles
+    long long hitches_ = 0, missed_ = 0, long_ = 0;
+    long long totalHitches_ = 0, totalMissed_ = 0, totalLong_ = 0;
+};
@@ -0,0 +1,170 @@
+﻿// PerfCounters.h — hardware counters (cycles, instructions, cache and branch misses) around a region, via perf_event_open on Linux
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// What a kernel is limited by shows in the counters rather than the wall
+// clock: few instructions per cycle with many cache misses is memory,
+// many branch misses is prediction, a high IPC with neither is arithmetic.
+// Every event is opened on every thread the process has when open() runs
+// (so the job pool must exist by then; later threads are not counted) and
+// summed over them, user space only. Events are opened one by one rather
+// than as a group, so a machine missing some (a VM often has no hardware
+// counters at all, or perf_event_paranoid forbids them) still gets the
+// rest; when the kernel multiplexes, counts are scaled by the time each
+// event actually ran. On other systems nothing opens and every event
+// reads as unavailable. Task clock is a software event and nearly always
+// there: CPU time summed over the threads, against the region's wall time.
+enum class PerfEvent { Cycles, Instructions, L1dMisses, LlcMisses, BranchMisses, TaskClock, Count };
+
+static const int kPerfEvents = int(PerfEvent::Count);
+
+static const char* perfEventName(int e) {
+    static const char* names[] = { "cycles", "instructions", "l1dMisses", "llcMisses", "branchMisses", "taskClockNs" };
+    return names[e];
+}
+
+// counts of one region; has[e] false for an event that could not be opened
+struct PerfSample {
+    double count[kPerfEvents] = {};
+    bool has[kPerfEvents] = {};
+
+    double ipc() const {
+        const int c = int(PerfEvent::Cycles), i = int(PerfEvent::Instructions);
+        return has[c] && has[i] && count[c] > 0.0 ? count[i] / count[c] : 0.0;
+    }
+};
+
+class PerfCounters {
+public:
+    PerfCounters() {}
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters() { close(); }
+
+    // true if at least one hardware event opened; why() says what failed
+    bool open() {
+        close();
+#ifdef __linux__
+        std::vector<int> tids;
+        if (DIR* d = opendir("/proc/self/task")) {
+            while (dirent* e = readdir(d)) if (e->d_name[0] != '.') tids.push_back(std::atoi(e->d_name));
+            closedir(d);
+        }
+        if (tids.empty()) tids.push_back(0);   // no /proc: this thread alone
+        static const uint32_t types[kPerfEvents] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                                      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE };
+        static const uint64_t configs[kPerfEvents] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_TASK_CLOCK };
+        for (int e = 0; e < kPerfEvents; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[e];
+            attr.config = configs[e];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            for (int tid : tids) {
+                int fd = int(syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0));
+                if (fd >= 0) {
+                    fds_[e].push_back(fd);
+                } else if (tid == tids.front()) {
+                    if (!why_[0]) std::snprintf(why_, sizeof(why_), "%s: %s", perfEventName(e), std::strerror(errno));
+                    break;   // the event is missing, not the thread
+                }
+                // other failures: a thread that exited meanwhile
+            }
+        }
+#else
+        std::snprintf(why_, sizeof(why_), "perf_event_open is Linux only");
+#endif
+        for (int e = 0; e < int(PerfEvent::TaskClock); ++e) if (!fds_[e].empty()) return true;
+        return false;
+    }
+
+    void close() {
+#ifdef __linux__
+        for (std::vector<int>& v : fds_) {
+            for (int fd : v) ::close(fd);
+            v.clear();
+        }
+#endif
+        why_[0] = 0;
+    }
+
+    bool available() const {
+        for (int e = 0; e < int(PerfEvent::TaskClock); ++e) if (!fds_[e].empty()) return true;
+        return false;
+    }
+    // the first event that failed to open and why, "" if none did
+    const char* why() const { return why_; }
+
+    void start() {
+#ifdef __linux__
+        for (const std::vector<int>& v : fds_)
+            for (int fd : v) { ioctl(fd, PERF_EVENT_IOC_RESET, 0); ioctl(fd, PERF_EVENT_IOC_ENABLE, 0); }
+#endif
+    }
+
+    PerfSample stop() {
+        PerfSample s;
+#ifdef __linux__
+        for (const std::vector<int>& v : fds_)
+            for (int fd : v) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        for (int e = 0; e < kPerfEvents; ++e) {
+            for (int fd : fds_[e]) {
+                uint64_t r[3];   // value, time enabled, time running
+                if (read(fd, r, sizeof(r)) != ssize_t(sizeof(r))) continue;
+                if (r[2] == 0) continue;   // never scheduled: that thread did not run
+                s.count[e] += double(r[0]) * (double(r[1]) / double(r[2]));
+            }
+            if (!fds_[e].empty()) s.has[e] = true;
+        }
+#endif
+        return s;
+    }
+
+private:
+    std::vector<int> fds_[kPerfEvents];
+    char why_[96] = "";
+};
+
+// Table columns for a sample: counts per unit (sample, voxel, cell), IPC,
+// and the CPU time of all threads over the wall time; "-" where an event
+// is missing. No newline, so they can follow a row's own columns.
+static const char* kPerfColumns = "   cycles    instrs   IPC  L1d miss  LLC miss  br miss  cpu/wall";
+
+static inline void printPerfColumns(FILE* f, const PerfSample& s, double units, double ms) {
+    const int counts[] = { int(PerfEvent::Cycles), int(PerfEvent::Instructions) };
+    for (int e : counts) {
+        if (s.has[e]) fprintf(f, " %9.1f", s.count[e] / units);
+        else fprintf(f, " %9s", "-");
+    }
+    if (s.ipc() > 0.0) fprintf(f, " %5.2f", s.ipc());
+    else fprintf(f, " %5s", "-");
+    const int misses[] = { int(PerfEvent::L1dMisses), int(PerfEvent::LlcMisses), int(PerfEvent::BranchMisses) };
+    for (int e : misses) {
+        if (s.has[e]) fprintf(f, " %9.3f", s.count[e] / units);
+        else fprintf(f, " %9s", "-");
+    }
+    const int clock = int(PerfEvent::TaskClock);
+    if (s.has[clock] && ms > 0.0) fprintf(f, " %9.2f", s.count[clock] * 1e-6 / ms);
+    else fprintf(f, " %9s", "-");
+}
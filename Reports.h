@@ -0,0 +1,757 @@
+﻿// Reports.h — headless measurements behind `--report <topic>` (no window, no GL)
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Noise.h"
+#include "GaborNoise.h"
+#include "Fluid.h"
+#include "Turbulence.h"
+#include "Upload.h"
+#include "Checkpoint.h"
+#include "Vortex.h"
+#include "Lbm.h"
+#include "PerfCounters.h"
+
+static double msSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// fastest of `reps` runs, in ms
+static double bestOf(int reps, const std::function<void()>& fn) {
+    double ms = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        ms = std::min(ms, msSince(t0));
+    }
+    return ms;
+}
+
+// the same, with the counters of the fastest run in *perf
+static double bestOf(int reps, const std::function<void()>& fn, PerfCounters& counters, PerfSample* perf) {
+    double ms = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        counters.start();
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        double t = msSince(t0);
+        PerfSample s = counters.stop();
+        if (t < ms) { ms = t; *perf = s; }
+    }
+    return ms;
+}
+
+// RMS error of point-sampling an N^3 bake against a 4x supersampled,
+// box-filtered bake of the same field, relative to the field's spread.
+// Content above the volume's Nyquist rate shows up here as aliasing.
+static double aliasingError(int N, NoiseBasis basis) {
+    const int S = 4, M = N * S;
+    std::vector<float> lo = bakeFbmVolume(N, 5, 2.01f, 0.52f, 42, basis);
+    std::vector<float> hi = bakeFbmVolume(M, 5, 2.01f, 0.52f, 42, basis);
+    double err = 0.0, mean = 0.0, var = 0.0;
+    for (int z = 0; z < N; ++z)
+        for (int y = 0; y < N; ++y)
+            for (int x = 0; x < N; ++x) {
+                // cell centred on voxel (x,y,z) of the coarse grid
+                double box = 0.0;
+                for (int dz = -S / 2; dz < S / 2; ++dz)
+                    for (int dy = -S / 2; dy < S / 2; ++dy)
+                        for (int dx = -S / 2; dx < S / 2; ++dx) {
+                            int hx = (x * S + dx + M) % M, hy = (y * S + dy + M) % M, hz = (z * S + dz + M) % M;
+                            box += hi[(size_t(hz) * M + hy) * M + hx];
+                        }
+                box /= double(S * S * S);
+                double v = lo[(size_t(z) * N + y) * N + x];
+                err += (v - box) * (v - box);
+                mean += v; var += v * v;
+            }
+    double count = double(N) * N * N;
+    mean /= count; var = var / count - mean * mean;
+    return std::sqrt(err / count / std::max(var, 1e-12));
+}
+
+static void reportNoise() {
+    printf("fBm bake, 5 octaves, lacunarity 2.01, gain 0.52, %d thread(s)\n", jobs().threads());
+    printf("%8s %12s %12s %12s %14s\n", "N", "perlin ms", "wavelet ms", "gabor ms", "gabor/perlin");
+    for (int N : { 64, 96, 128 }) {
+        auto t0 = std::chrono::steady_clock::now();
+        bakeFbmVolume(N, 5, 2.01f, 0.52f, 42, NoiseBasis::Perlin);
+        double perlinMs = msSince(t0);
+        t0 = std::chrono::steady_clock::now();
+        bakeFbmVolume(N, 5, 2.01f, 0.52f, 42, NoiseBasis::Wavelet);
+        double waveletMs = msSince(t0);
+        t0 = std::chrono::steady_clock::now();
+        bakeGaborVolume(N, GaborParams());
+        double gaborMs = msSince(t0);
+        printf("%8d %12.1f %12.1f %12.1f %14.2f\n", N, perlinMs, waveletMs, gaborMs, gaborMs / perlinMs);
+    }
+    printf("\naliasing (point sample vs 4x box filter, RMS / stddev)\n");
+    printf("%8s %12s %12s\n", "N", "perlin", "wavelet");
+    for (int N : { 32, 64 })
+        printf("%8d %12.3f %12.3f\n", N, aliasingError(N, NoiseBasis::Perlin), aliasingError(N, NoiseBasis::Wavelet));
+}
+
+// spectral synthesis vs. the octave sum, growing N
+static void reportSpectral() {
+    printf("fBm bake, 5 octaves, lacunarity 2.01, gain 0.52, %d thread(s)\n", jobs().threads());
+    printf("%8s %14s %14s\n", "N", "spectral ms", "perlin ms");
+    double perlinPerVoxel = 0.0;
+    for (int N : { 128, 256, 512 }) {
+        auto t0 = std::chrono::steady_clock::now();
+        bakeFbmVolume(N, 5, 2.01f, 0.52f, 42, NoiseBasis::Spectral);
+        double specMs = msSince(t0);
+        if (N <= 256) {
+            t0 = std::chrono::steady_clock::now();
+            bakeFbmVolume(N, 5, 2.01f, 0.52f, 42, NoiseBasis::Perlin);
+            double perlinMs = msSince(t0);
+            perlinPerVoxel = perlinMs / (double(N) * N * N);
+            printf("%8d %14.1f %14.1f\n", N, specMs, perlinMs);
+        } else {   // the octave sum is linear in voxels; 512^3 would take minutes
+            printf("%8d %14.1f %14.1f (est.)\n", N, specMs, perlinPerVoxel * double(N) * N * N);
+        }
+    }
+}
+
+// ms per solver step against grid size and worker count
+static void reportFluid() {
+    int hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> counts = { 1, 2, 4 };
+    if (hw > 4) counts.push_back(hw);
+    printf("stable fluids, %d multigrid V-cycles, %d hardware thread(s)\n", FluidParams().vcycles, hw);
+    printf("%8s %8s %10s %10s %10s %10s\n", "N", "threads", "ms/step", "advect", "forces", "project");
+    for (int N : { 64, 96, 128 }) {
+        for (int t : counts) {
+            jobs().resize(t);
+            FluidSim sim(N);
+            for (int i = 0; i < 5; ++i) sim.step(1.0f / 30.0f);   // let the plume fill some of the grid
+            sim.timings = FluidTimings();
+            int steps = N >= 128 ? 4 : 8;
+            for (int i = 0; i < steps; ++i) sim.step(1.0f / 30.0f);
+            const FluidTimings& ft = sim.timings;
+            printf("%8d %8d %10.1f %10.1f %10.1f %10.1f\n", N, jobs().threads(), ft.total() / steps,
+                   ft.advect / steps, ft.forces / steps, ft.project / steps);
+        }
+    }
+    jobs().resize(0);
+}
+
+// residual reduction per ms: Jacobi and red-black GS sweeps vs. V-cycles,
+// all from p = 0 on the divergence of a developed plume
+static void reportMultigrid() {
+    printf("pressure Poisson solve, %d thread(s)\n", jobs().threads());
+    FluidParams dense;
+    dense.sparse = false;   // the whole box, as the smoke fills it eventually
+    for (int N : { 64, 128 }) {
+        FluidSim sim(N, dense);
+        for (int i = 0; i < 30; ++i) sim.step(1.0f / 30.0f);
+        PoissonGrid& g = sim.pressure.finest();
+        sim.computeDivergence(g);
+        const std::vector<float> rhs = g.b;
+        std::fill(g.p.begin(), g.p.end(), 0.0f);
+        double r0 = computeResidual(g);
+        printf("\nN = %d, %zu levels, initial residual %.3e\n", N, sim.pressure.levels.size(), r0);
+        printf("%12s %8s %10s %12s %12s\n", "method", "iters", "ms", "r / r0", "orders/ms");
+        auto run = [&](const char* name, int iters, int kind) {
+            g.b = rhs;
+            std::fill(g.p.begin(), g.p.end(), 0.0f);
+            std::vector<float> scratch(g.p.size());
+            auto t0 = std::chrono::steady_clock::now();
+            for (int it = 0; it < iters; ++it) {
+                if (kind == 0) { std::swap(g.p, scratch); relaxJacobi(g, scratch); }
+                else if (kind == 1) relaxRedBlack(g, 1);
+                else sim.pressure.vcycle();
+            }
+            double ms = msSince(t0);
+            double ratio = computeResidual(g) / r0;
+            printf("%12s %8d %10.1f %12.3e %12.4f\n", name, iters, ms, ratio, -std::log10(ratio) / ms);
+        };
+        for (int it : { 10, 40, 160 }) run("jacobi", it, 0);
+        for (int it : { 10, 40, 160 }) run("red-black", it, 1);
+        for (int it : { 1, 2, 4, 8 }) run("multigrid", it, 2);
+    }
+}
+
+// tile-sparse vs. every tile allocated, as the plume rises
+static void reportTiles() {
+    printf("stable fluids on 8^3 tiles, %d thread(s)\n", jobs().threads());
+    for (int N : { 64, 128 }) {
+        printf("\nN = %d (%d tiles)\n", N, (N / 8) * (N / 8) * (N / 8));
+        printf("%8s %10s %10s %12s %12s %12s\n", "steps", "tiles", "% of box", "sparse MB", "sparse ms", "dense ms");
+        FluidParams dp;
+        dp.sparse = false;
+        FluidSim sparse(N), dense(N, dp);
+        const int window = 15;
+        for (int s = window; s <= 90; s += window) {
+            sparse.timings = FluidTimings();
+            dense.timings = FluidTimings();
+            for (int i = 0; i < window; ++i) {
+                sparse.step(1.0f / 30.0f);
+                dense.step(1.0f / 30.0f);
+            }
+            int total = sparse.tiles.T * sparse.tiles.T * sparse.tiles.T;
+            printf("%8d %10zu %10.1f %12.1f %12.2f %12.2f\n", s, sparse.tiles.active.size(),
+                   100.0 * sparse.tiles.active.size() / total, sparse.bytes() / 1048576.0,
+                   sparse.timings.total() / window, dense.timings.total() / window);
+        }
+        printf("%8s %10s %10s %12.1f (dense MB)\n", "", "", "", dense.bytes() / 1048576.0);
+    }
+}
+
+// achieved bandwidth of the grid kernels on a dense plume, against a STREAM
+// triad over arrays well past the last-level cache. Bytes are the
+// compulsory traffic per cell (every field read or written once); a kernel
+// above the triad rate is reusing data in cache across passes.
+static void reportStencil() {
+    printf("grid stencil kernels, %d thread(s)\n", jobs().threads());
+
+    const size_t count = size_t(1) << 26;   // 256 MB per array
+    std::vector<float> a(count), b(count, 1.0f), c(count, 2.0f);
+    double triadMs = bestOf(5, [&] {
+        jobs().parallelFor(0, int(count >> 12), [&](int lo, int hi) {
+            for (size_t i = size_t(lo) << 12; i < size_t(hi) << 12; ++i) a[i] = b[i] + 3.0f * c[i];
+        });
+    });
+    double stream = 12.0 * count / (triadMs * 1e6);
+    printf("stream triad: %.1f GB/s\n", stream);
+
+    // opened once the triad has started the pool, so its workers are counted
+    PerfCounters counters;
+    if (!counters.open()) printf("hardware counters unavailable (%s)\n", counters.why());
+
+    FluidParams dense;
+    dense.sparse = false;
+    for (int N : { 64, 128 }) {
+        FluidSim sim(N, dense);
+        for (int i = 0; i < 10; ++i) sim.step(1.0f / 30.0f);
+        PoissonGrid& g = sim.pressure.finest();
+        sim.computeDivergence(g);
+        const size_t total = size_t(N) * N * N;
+        const double cells = double(total);
+        const int reps = N <= 64 ? 20 : 5;
+        printf("\nN = %d\n", N);
+        printf("%16s %10s %10s %10s %10s%s\n", "kernel", "B/cell", "ms", "GB/s", "% stream", kPerfColumns);
+        auto row = [&](const char* name, double bytes, const std::function<void()>& fn) {
+            PerfSample perf;
+            double ms = bestOf(reps, fn, counters, &perf);
+            double gbs = bytes * cells / (ms * 1e6);
+            printf("%16s %10.0f %10.2f %10.1f %10.0f", name, bytes, ms, gbs, 100.0 * gbs / stream);
+            printPerfColumns(stdout, perf, cells, ms);   // per cell
+            printf("\n");
+        };
+
+        // the same Jacobi sweep as a plain triple loop over flat arrays
+        std::vector<float> fp(total, 0.0f), fprev(total, 0.0f), fb(total), finv(total);
+        for (int z = 0; z < N; ++z)
+            for (int y = 0; y < N; ++y)
+                for (int x = 0; x < N; ++x) {
+                    size_t i = (size_t(z) * N + y) * N + x;
+                    fb[i] = g.tiles.fetch(g.b, x, y, z);
+                    finv[i] = g.tiles.fetch(g.invDiag, x, y, z);
+                }
+        row("naive jacobi", 16, [&] {
+            jobs().parallelFor(0, N, [&](int z0, int z1) {
+                for (int z = z0; z < z1; ++z)
+                    for (int y = 0; y < N; ++y)
+                        for (int x = 0; x < N; ++x) {
+                            size_t i = (size_t(z) * N + y) * N + x;
+                            float s = (x > 0 ? fprev[i - 1] : 0.0f) + (x < N - 1 ? fprev[i + 1] : 0.0f)
+                                    + (y > 0 ? fprev[i - N] : 0.0f) + (y < N - 1 ? fprev[i + N] : 0.0f)
+                                    + (z > 0 ? fprev[i - size_t(N) * N] : 0.0f) + (z < N - 1 ? fprev[i + size_t(N) * N] : 0.0f);
+                            fp[i] = (s + fb[i]) * finv[i];
+                        }
+            });
+            std::swap(fp, fprev);
+        });
+
+        std::vector<float> scratch(g.p.size(), 0.0f);
+        row("jacobi", 16, [&] { std::swap(g.p, scratch); relaxJacobi(g, scratch); });
+        row("red-black", 32, [&] { relaxRedBlack(g, 1); });
+        row("red-black x2", 64, [&] { relaxRedBlack(g, 2); });
+        row("wavefront x2", 64, [&] { relaxRedBlackWavefront(g, 2); });
+        row("residual", 20, [&] { computeResidual(g); });
+        row("divergence", 16, [&] { sim.computeDivergence(g); });
+        row("gradient", 28, [&] { sim.subtractGradient(g); });
+    }
+}
+
+// coarse simulation + procedural detail per frame vs. simulating the output
+// resolution directly; both from the same start, timed over the second second
+static void reportDetail() {
+    printf("wavelet-turbulence detail vs. full-resolution simulation, %d thread(s)\n", jobs().threads());
+    printf("%6s %6s %8s %10s %10s %10s %10s %10s %10s\n", "n", "M", "bricks", "sim ms", "advect ms",
+           "detail ms", "frame ms", "full ms", "speedup");
+    const float dt = 1.0f / 30.0f;
+    const int warm = 30, frames = 30;
+    for (int n : { 32, 48 }) {
+        FluidSim coarse(n);
+        FluidDetail detail(coarse.N);
+        std::vector<Half> bricks;
+        double simMs = 0.0, advMs = 0.0, detailMs = 0.0;
+        size_t liveSum = 0;
+        for (int f = 0; f < warm + frames; ++f) {
+            auto t0 = std::chrono::steady_clock::now();
+            coarse.step(dt);
+            auto t1 = std::chrono::steady_clock::now();
+            detail.advance(coarse, dt);
+            auto t2 = std::chrono::steady_clock::now();
+            detail.select(coarse);
+            bricks.resize(std::max<size_t>(detail.dirty.size(), 1) * TileMap::B3 * 2);
+            detail.synthesize(coarse, bricks.data());
+            if (f < warm) continue;
+            simMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+            advMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+            detailMs += msSince(t2);
+            liveSum += detail.live.size();
+        }
+        FluidSim full(detail.M);
+        for (int f = 0; f < warm; ++f) full.step(dt);
+        full.timings = FluidTimings();
+        for (int f = 0; f < frames; ++f) full.step(dt);
+        double frameMs = (simMs + advMs + detailMs) / frames, fullMs = full.timings.total() / frames;
+        printf("%6d %6d %8zu %10.2f %10.2f %10.2f %10.2f %10.2f %10.1f\n", n, detail.M, liveSum / frames,
+               simMs / frames, advMs / frames, detailMs / frames, frameMs, fullMs, fullMs / frameMs);
+    }
+}
+
+// L1 error of a ball of density carried diagonally across the box at a
+// constant velocity (exact departure points, so only the interpolation
+// blurs it), relative to its mass
+static double translationError(int N, Advection scheme) {
+    FluidParams p;
+    p.sparse = false;
+    p.advection = scheme;
+    FluidSim sim(N, p);
+    const int steps = 60;
+    const float dir[3] = { 0.25f, 0.2f, 0.15f };   // domain units over the whole run
+    auto ball = [&](std::vector<float>& d, float t) {
+        const float R = 0.12f * sim.N;
+        forTiles(sim.tiles, [&](int, size_t base, int ox, int oy, int oz) {
+            for (int i = 0; i < TileMap::B3; ++i) {
+                float x = ox + i % 8 - (0.35f + t * dir[0]) * sim.N, y = oy + i / 8 % 8 - (0.35f + t * dir[1]) * sim.N;
+                float z = oz + i / 64 - (0.4f + t * dir[2]) * sim.N;
+                d[base + i] = std::min(std::max(R - std::sqrt(x * x + y * y + z * z) + 0.5f, 0.0f), 1.0f);   // 1-cell edge
+            }
+        });
+    };
+    ball(sim.density, 0.0f);
+    const float dt = 1.0f / 30.0f, T = steps * dt;
+    for (int s = 0; s < steps; ++s) {
+        std::fill(sim.u.begin(), sim.u.end(), dir[0] * sim.N / T);
+        std::fill(sim.v.begin(), sim.v.end(), dir[1] * sim.N / T);
+        std::fill(sim.w.begin(), sim.w.end(), dir[2] * sim.N / T);
+        sim.advect(dt);
+    }
+    std::vector<float> exact(sim.density.size());
+    ball(exact, 1.0f);
+    double err = 0.0, mass = 0.0;
+    for (size_t i = 0; i < exact.size(); ++i) { err += std::fabs(sim.density[i] - exact[i]); mass += exact[i]; }
+    return err / mass;
+}
+
+// float vs. Half pools for the pressure hierarchy: kernel times on a dense
+// plume, what the rounding does to a solve, and how far a plume drifts
+static void reportHalf() {
+    printf("half-precision pressure storage, %d thread(s), F16C %s\n", jobs().threads(), kHasF16C ? "yes" : "no");
+    FluidParams dense;
+    dense.sparse = false;
+    for (int N : { 64, 128 }) {
+        FluidSim sim(N, dense);
+        for (int i = 0; i < 10; ++i) sim.step(1.0f / 30.0f);
+        PoissonGrid& g = sim.pressure.finest();
+        MultigridSolverT<Half> halfSolver(sim.N);
+        PoissonGridT<Half>& h = halfSolver.finest();
+        h.allocateAll();
+        halfSolver.sync();
+
+        // the same right-hand side, two V-cycles each
+        sim.computeDivergence(g);
+        sim.computeDivergence(h);
+        std::fill(g.p.begin(), g.p.end(), 0.0f);
+        std::fill(h.p.begin(), h.p.end(), Half(0));
+        double r0 = computeResidual(g);
+        for (int c = 0; c < 2; ++c) { sim.pressure.vcycle(); halfSolver.vcycle(); }
+        double rf = computeResidual(g) / r0, rh = computeResidual(h) / r0;
+        double diff = 0.0, norm = 0.0;
+        for (size_t i = 0; i < g.p.size(); ++i) {
+            double d = toFloat(h.p[i]) - g.p[i];
+            diff += d * d;
+            norm += double(g.p[i]) * g.p[i];
+        }
+        printf("\nN = %d, 2 V-cycles: r/r0 float %.3e, half %.3e; |p half - p float| / |p| = %.2e\n",
+               N, rf, rh, std::sqrt(diff / std::max(norm, 1e-30)));
+
+        const int reps = N <= 64 ? 20 : 5;
+        printf("%16s %10s %10s %10s\n", "kernel", "float ms", "half ms", "speedup");
+        auto row = [&](const char* name, const std::function<void()>& f, const std::function<void()>& hf) {
+            double a = bestOf(reps, f), b = bestOf(reps, hf);
+            printf("%16s %10.2f %10.2f %10.2f\n", name, a, b, a / b);
+        };
+        g.prev.assign(g.p.size(), 0.0f);
+        h.prev.assign(h.p.size(), Half(0));
+        row("jacobi", [&] { std::swap(g.p, g.prev); relaxJacobi(g, g.prev); },
+                      [&] { std::swap(h.p, h.prev); relaxJacobi(h, h.prev); });
+        row("red-black", [&] { relaxRedBlack(g, 1); }, [&] { relaxRedBlack(h, 1); });
+        row("residual", [&] { computeResidual(g); }, [&] { computeResidual(h); });
+        row("divergence", [&] { sim.computeDivergence(g); }, [&] { sim.computeDivergence(h); });
+        row("gradient", [&] { sim.subtractGradient(g); }, [&] { sim.subtractGradient(h); });
+        row("2 V-cycles", [&] { sim.pressure.vcycle(); sim.pressure.vcycle(); },
+                          [&] { halfSolver.vcycle(); halfSolver.vcycle(); });
+    }
+
+    // a whole plume: the half run against the float one, next to the change
+    // a third V-cycle makes (the size of the solver's own error)
+    const int N = 64, steps = 60;
+    printf("\nplume N = %d after %d steps, density RMS difference from float / 2 V-cycles\n", N, steps);
+    printf("%16s %10s %12s\n", "run", "ms/step", "rel. diff");
+    FluidParams base;
+    FluidSim ref(N, base);
+    for (int i = 0; i < steps; ++i) ref.step(1.0f / 30.0f);
+    printf("%16s %10.2f %12s\n", "float", ref.timings.total() / steps, "-");
+    for (int k = 0; k < 2; ++k) {
+        FluidParams p;
+        if (k == 0) p.halfPressure = true;
+        else p.vcycles = 3;
+        FluidSim sim(N, p);
+        for (int i = 0; i < steps; ++i) sim.step(1.0f / 30.0f);
+        double diff = 0.0, norm = 0.0;
+        for (int z = 0; z < N; ++z)
+            for (int y = 0; y < N; ++y)
+                for (int x = 0; x < N; ++x) {
+                    double a = ref.tiles.fetch(ref.density, x, y, z), d = sim.tiles.fetch(sim.density, x, y, z) - a;
+                    diff += d * d;
+                    norm += a * a;
+                }
+        printf("%16s %10.2f %12.3e\n", k == 0 ? "half" : "float, 3 cycles", sim.timings.total() / steps,
+               std::sqrt(diff / std::max(norm, 1e-30)));
+    }
+}
+
+// semi-Lagrangian vs. MacCormack: sharpness per grid size, cost of a plume step
+static void reportAdvection() {
+    printf("advection schemes, %d thread(s)\n", jobs().threads());
+    printf("ball carried across the box (L1 error / mass), plume ms/step\n");
+    printf("%6s %12s %12s %12s %12s\n", "N", "SL error", "MC error", "SL ms", "MC ms");
+    const int sizes[] = { 32, 48, 64, 96, 128 };
+    double err[2][5], ms[2][5];
+    for (int k = 0; k < 5; ++k) {
+        for (int s = 0; s < 2; ++s) {
+            Advection scheme = s ? Advection::MacCormack : Advection::SemiLagrangian;
+            err[s][k] = translationError(sizes[k], scheme);
+            FluidParams p;
+            p.advection = scheme;
+            FluidSim plume(sizes[k], p);
+            for (int i = 0; i < 30; ++i) plume.step(1.0f / 30.0f);
+            plume.timings = FluidTimings();
+            for (int i = 0; i < 15; ++i) plume.step(1.0f / 30.0f);
+            ms[s][k] = plume.timings.total() / 15;
+        }
+        printf("%6d %12.3f %12.3f %12.2f %12.2f\n", sizes[k], err[0][k], err[1][k], ms[0][k], ms[1][k]);
+    }
+    // the semi-Lagrangian grid as sharp as each MacCormack one, log-interpolated between sizes
+    printf("\nequal sharpness\n");
+    for (int k = 0; k < 5; ++k) {
+        int j = 0;
+        while (j < 5 && err[0][j] > err[1][k]) ++j;
+        if (j == 0) { printf("  MC %3d: SL %d or less\n", sizes[k], sizes[0]); continue; }
+        if (j == 5) { printf("  MC %3d: SL beyond %d\n", sizes[k], sizes[4]); continue; }
+        double t = std::log(err[0][j - 1] / err[1][k]) / std::log(err[0][j - 1] / err[0][j]);
+        double n = sizes[j - 1] * std::pow(double(sizes[j]) / sizes[j - 1], t);
+        printf("  MC %3d (%6.2f ms/step) ~ SL %3.0f (%6.2f..%6.2f ms/step)\n", sizes[k], ms[1][k], n, ms[0][j - 1], ms[0][j]);
+    }
+}
+
+// field texture traffic per frame, after a second of warm-up: re-specifying
+// the whole volume, one call per allocated (or freed) brick as before, and
+// BrickUploader's changed bricks in merged regions, without a budget and
+// within a tight one (bricks wait, the frame's bytes stay bounded). cpu ms
+// covers offering, planning and staging; packing and hashing happen on the
+// simulation's side.
+static void reportUpload() {
+    printf("field texture uploads (RG16F, %zu B per brick), %d thread(s)\n", BrickUploader::BrickBytes, jobs().threads());
+    printf("%12s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "run", "volume KB", "all KB", "all calls",
+           "dirty KB", "calls", "256K: KB", "calls", "waiting", "cpu ms");
+    const float dt = 1.0f / 30.0f;
+    const int warm = 30, frames = 120;
+    const size_t budget = 256 * 1024;
+    for (int k = 0; k < 3; ++k) {
+        const int n = k == 0 ? 64 : k == 1 ? 128 : 32;
+        double kb[2] = {}, calls[2] = {}, cpu = 0.0, allKB = 0.0, allCalls = 0.0;
+        size_t waiting = 0;
+        int M = n;
+        for (int run = 0; run < 2; ++run) {   // the simulation is deterministic, so both runs see the same frames
+            FluidSim sim(n);
+            std::unique_ptr<FluidDetail> detail;
+            if (k == 2) detail.reset(new FluidDetail(sim.N));
+            M = detail ? detail->M : sim.N;
+            BrickUploader up(M / TileMap::B, run ? budget : 0);
+            FieldFrame frame;
+            std::vector<Half> staging;
+            for (int f = 0; f < warm + frames; ++f) {
+                sim.step(dt);
+                if (detail) detail->advance(sim, dt);
+                size_t offered;
+                if (detail) {
+                    packDetailFrame(sim, *detail, frame);
+                    offered = detail->dirty.size() + detail->cleared.size();
+                } else {
+                    offered = sim.tiles.active.size() + sim.tiles.released.size();
+                    packFieldFrame(sim, frame);
+                }
+                auto t0 = std::chrono::steady_clock::now();
+                offerFrame(up, frame);
+                up.plan();
+                staging.resize(up.bytes() / sizeof(Half));
+                up.write(staging.data());
+                if (f < warm) continue;
+                if (run == 0) cpu += msSince(t0);
+                kb[run] += up.bytes() / 1024.0;
+                calls[run] += double(up.regions.size());
+                if (run == 0) { allKB += offered * BrickUploader::BrickBytes / 1024.0; allCalls += double(offered); }
+                else waiting = std::max(waiting, up.deferred);
+            }
+        }
+        char name[32];
+        if (k == 2) snprintf(name, sizeof(name), "detail %d", M);
+        else snprintf(name, sizeof(name), "sim %d", M);
+        printf("%12s %10.0f %10.0f %10.0f %10.0f %10.1f %10.0f %10.1f %10zu %10.2f\n", name,
+               double(M) * M * M * 2 * sizeof(Half) / 1024.0, allKB / frames, allCalls / frames,
+               kb[0] / frames, calls[0] / frames, kb[1] / frames, calls[1] / frames, waiting, cpu / frames);
+    }
+}
+
+// Save and restore through the mapped checkpoint after three seconds of
+// plume: cost and size, whether the restored run continues bit for bit, and
+// how much smoke the first frame shows against a cold start.
+static void reportCheckpoint() {
+    printf("checkpoint save / warm start, %d thread(s)\n", jobs().threads());
+    printf("%12s %8s %10s %10s %10s %12s %14s\n", "run", "tiles", "MB", "save ms", "load ms", "continues", "smoke vs cold");
+    const float dt = 1.0f / 30.0f;
+    const char* path = "report_checkpoint.tmp.ckpt";
+    for (int k = 0; k < 3; ++k) {
+        const int n = k == 0 ? 64 : k == 1 ? 128 : 32, amplify = k == 2 ? 4 : 0;
+        DetailParams dp;
+        dp.amplify = amplify ? amplify : 2;
+        FluidSim a(n);
+        std::unique_ptr<FluidDetail> da(amplify ? new FluidDetail(a.N, dp) : nullptr);
+        for (int i = 0; i < 90; ++i) { a.step(dt); if (da) da->advance(a, dt); }
+        auto t0 = std::chrono::steady_clock::now();
+        bool saved = saveCheckpoint(path, a, da.get(), 90);
+        double saveMs = msSince(t0);
+        FluidSim b(n), cold(n);
+        std::unique_ptr<FluidDetail> db(amplify ? new FluidDetail(b.N, dp) : nullptr);
+        t0 = std::chrono::steady_clock::now();
+        long long steps = saved ? loadCheckpoint(path, b, db.get()) : -1;
+        double loadMs = msSince(t0);
+        std::remove(path);
+        if (steps != 90) { printf("%12d checkpoint failed\n", n); continue; }
+        auto mass = [](const FluidSim& s) {
+            double m = 0.0;
+            for (int t : s.tiles.active)
+                for (int i = 0; i < TileMap::B3; ++i) m += s.density[s.tiles.base(t) + i];
+            return m;
+        };
+        double ratio = 0.0;
+        for (int i = 0; i < 30; ++i) {
+            a.step(dt);
+            b.step(dt);
+            if (da) { da->advance(a, dt); db->advance(b, dt); }
+            if (i == 0) { cold.step(dt); ratio = mass(b) / std::max(mass(cold), 1e-30); }   // the first frame
+        }
+        bool same = a.tiles.active == b.tiles.active && a.frameSeed == b.frameSeed;
+        for (int t : a.tiles.active)
+            for (int i = 0; i < TileMap::B3 && same; ++i)
+                same = a.density[a.tiles.base(t) + i] == b.density[b.tiles.base(t) + i]
+                    && a.u[a.tiles.base(t) + i] == b.u[b.tiles.base(t) + i];
+        if (da) same = same && da->coords[0] == db->coords[0] && da->amp == db->amp;
+        CheckpointLayout L(a.N, amplify, int(a.tiles.active.size()));
+        char name[32];
+        if (amplify) snprintf(name, sizeof(name), "detail %dx%d", n, amplify);
+        else snprintf(name, sizeof(name), "sim %d", n);
+        printf("%12s %8zu %10.2f %10.2f %10.2f %12s %13.1fx\n", name, a.tiles.active.size(), L.total / 1048576.0,
+               saveMs, loadMs, same ? "exactly" : "NO", ratio);
+    }
+}
+
+// Biot–Savart velocities of n vortex particles in a tall plume (a column
+// widening upwards, strength mostly swirling round its axis) by the octree
+// against the O(n^2) direct sum, 10k to 1M particles. The tree error is
+// the RMS over 2048 sampled particles relative to the exact velocities;
+// the direct sum is timed in full up to 40k and from those samples
+// (scaled by n / 2048) above. Then the opening angle at 100k, and the
+// vortex smoke itself.
+static void reportVortex() {
+    const int samples = 2048;
+    auto uniform = [](uint32_t i) { return float(hash32(i) >> 8) * (1.0f / 16777216.0f); };
+    struct Cloud { std::vector<float> x, y, z, ax, ay, az; float core; };
+    auto makeCloud = [&](int n) {
+        Cloud c;
+        for (std::vector<float>* v : { &c.x, &c.y, &c.z, &c.ax, &c.ay, &c.az }) v->resize(n);
+        const float mag = 2e-4f * 10000.0f / n;
+        for (int i = 0; i < n; ++i) {
+            uint32_t s = uint32_t(i) * 8u;
+            float y = 0.05f + 0.95f * uniform(s), r = (0.04f + 0.12f * y) * std::sqrt(uniform(s + 1));
+            float phi = 6.28318531f * uniform(s + 2), cs = std::cos(phi), sn = std::sin(phi);
+            c.x[i] = 0.5f + r * cs; c.y[i] = y; c.z[i] = 0.5f + r * sn;
+            float j = 0.3f * mag;
+            c.ax[i] = mag * sn + j * (2.0f * uniform(s + 3) - 1.0f);
+            c.ay[i] = j * (2.0f * uniform(s + 4) - 1.0f);
+            c.az[i] = -mag * cs + j * (2.0f * uniform(s + 5) - 1.0f);
+        }
+        c.core = std::cbrt(0.03f / n);     // about the particle spacing
+        return c;
+    };
+    // exact velocities at every (n / samples)-th particle, and the ms that took
+    struct Exact { std::vector<int> at; std::vector<float> u[3]; double ms; };
+    auto exact = [&](const Cloud& c, int n) {
+        Exact e;
+        const int m = std::min(n, samples);
+        std::vector<float> t[3];
+        for (int k = 0; k < m; ++k) {
+            int i = int(int64_t(k) * n / m);
+            e.at.push_back(i);
+            t[0].push_back(c.x[i]); t[1].push_back(c.y[i]); t[2].push_back(c.z[i]);
+        }
+        VortexSources all;
+        for (int i = 0; i < n; ++i) all.push(c.x[i], c.y[i], c.z[i], c.ax[i], c.ay[i], c.az[i]);
+        all.pad();
+        for (std::vector<float>& v : e.u) v.resize(m);
+        const float* tp[3] = { t[0].data(), t[1].data(), t[2].data() };
+        float* up[3] = { e.u[0].data(), e.u[1].data(), e.u[2].data() };
+        auto t0 = std::chrono::steady_clock::now();
+        directVelocity(all, tp, m, c.core, up);
+        e.ms = msSince(t0);
+        return e;
+    };
+    auto rmsError = [](const Exact& e, const std::vector<float> u[3]) {
+        double err = 0.0, ref = 0.0;
+        for (size_t k = 0; k < e.at.size(); ++k)
+            for (int c = 0; c < 3; ++c) {
+                double d = u[c][e.at[k]] - e.u[c][k];
+                err += d * d;
+                ref += double(e.u[c][k]) * e.u[c][k];
+            }
+        return std::sqrt(err / std::max(ref, 1e-300));
+    };
+    // tree build and sum at opening angle theta
+    struct Run { double buildMs, sumMs, pairs, error; };
+    auto runTree = [&](const Cloud& c, int n, float theta, const Exact& e) {
+        Run r;
+        VortexTree tree;
+        const float* p[3] = { c.x.data(), c.y.data(), c.z.data() };
+        const float* a[3] = { c.ax.data(), c.ay.data(), c.az.data() };
+        std::vector<float> u[3];
+        for (std::vector<float>& v : u) v.resize(n);
+        float* up[3] = { u[0].data(), u[1].data(), u[2].data() };
+        auto t0 = std::chrono::steady_clock::now();
+        tree.build(p, a, n);
+        r.buildMs = msSince(t0);
+        t0 = std::chrono::steady_clock::now();
+        r.pairs = double(tree.evaluate(p, n, c.core, theta, up)) / n;
+        r.sumMs = msSince(t0);
+        r.error = rmsError(e, u);
+        return r;
+    };
+
+    const float theta = VortexParams().theta;
+    printf("vortex particles, Barnes-Hut (theta %.1f, first moments) vs direct sum, %d thread(s)\n", theta, jobs().threads());
+    printf("%9s %10s %10s %12s %12s %10s %12s\n", "n", "build ms", "sum ms", "pairs/part", "direct ms", "speedup", "rms error");
+    for (int n : { 10000, 30000, 100000, 300000, 1000000 }) {
+        Cloud c = makeCloud(n);
+        Exact e = exact(c, n);
+        double direct = e.ms * n / double(e.at.size());
+        bool measured = n <= 40000;
+        if (measured) {
+            std::vector<float> u[3];
+            for (std::vector<float>& v : u) v.resize(n);
+            float* up[3] = { u[0].data(), u[1].data(), u[2].data() };
+            const float* p[3] = { c.x.data(), c.y.data(), c.z.data() };
+            VortexSources all;
+            for (int i = 0; i < n; ++i) all.push(c.x[i], c.y[i], c.z[i], c.ax[i], c.ay[i], c.az[i]);
+            all.pad();
+            auto t0 = std::chrono::steady_clock::now();
+            directVelocity(all, p, n, c.core, up);
+            direct = msSince(t0);
+        }
+        Run r = runTree(c, n, theta, e);
+        printf("%9d %10.1f %10.1f %12.0f %12.0f%s %9.1fx %12.2e\n", n, r.buildMs, r.sumMs, r.pairs, direct,
+               measured ? "     " : " est.", direct / (r.buildMs + r.sumMs), r.error);
+    }
+
+    printf("\nopening angle at n = 100000\n");
+    printf("%9s %10s %12s %12s\n", "theta", "sum ms", "pairs/part", "rms error");
+    {
+        Cloud c = makeCloud(100000);
+        Exact e = exact(c, 100000);
+        for (float th : { 0.3f, 0.45f, 0.6f, 0.8f, 1.0f }) {
+            Run r = runTree(c, 100000, th, e);
+            printf("%9.2f %10.1f %12.0f %12.2e\n", th, r.sumMs, r.pairs, r.error);
+        }
+    }
+
+    printf("\nvortex smoke, 64^3 field, 10 s at 30 steps/s\n");
+    printf("%9s %10s %10s %10s %10s %10s %10s\n", "seconds", "vortices", "markers", "ms/step", "tree", "velocity", "splat");
+    VortexSim sim(64);
+    for (int s = 0; s < 10; ++s) {
+        sim.timings = VortexTimings();
+        for (int i = 0; i < 30; ++i) sim.step(1.0f / 30.0f);
+        if (s % 3 != 2 && s != 9) continue;
+        const VortexTimings& vt = sim.timings;
+        printf("%9d %10d %10d %10.1f %10.1f %10.1f %10.1f\n", s + 1, sim.vortexCount(), sim.markerCount(),
+               vt.total() / vt.steps, vt.tree / vt.steps, vt.velocity / vt.steps, vt.splat / vt.steps);
+    }
+}
+
+// Lattice-Boltzmann throughput in million lattice updates per second
+// against grid size and worker count, after a second of plume, with
+// the memory the in-place AA pattern needs against two lattices
+static void reportLbm() {
+    int hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> counts = { 1, 2, 4 };
+    if (hw > 4) counts.push_back(hw);
+    printf("D3Q19 lattice-Boltzmann, AA pattern in place, %d hardware thread(s), %d lattice steps per second\n",
+           hw, int(LbmParams().stepsPerSecond));
+    printf("%8s %8s %10s %10s %10s %12s %12s\n", "N", "threads", "MLUPS", "ms/frame", "smoke ms", "lattice MB", "two-lat. MB");
+    for (int N : { 64, 96, 128 }) {
+        for (int t : counts) {
+            jobs().resize(t);
+            LbmSim sim(N);
+            for (int i = 0; i < 30; ++i) sim.step(1.0f / 30.0f);
+            sim.timings = LbmTimings();
+            const int frames = N >= 128 ? 4 : 10;
+            for (int i = 0; i < frames; ++i) sim.step(1.0f / 30.0f);
+            const LbmTimings& lt = sim.timings;
+            const double cellsPadded = double(sim.cells);
+            printf("%8d %8d %10.1f %10.1f %10.1f %12.1f %12.1f\n", N, jobs().threads(), lt.mlups(), lt.total() / frames,
+                   lt.scalars / frames, cellsPadded * LbmSim::bytesPerCell() / 1048576.0,
+                   cellsPadded * LbmSim::bytesPerCellTwoLattice() / 1048576.0);
+        }
+    }
+    jobs().resize(0);
+}
+
+// returns a process exit code
+static int runReport(const char* topic) {
+    if (std::strcmp(topic, "noise") == 0) { reportNoise(); return 0; }
+    if (std::strcmp(topic, "spectral") == 0) { reportSpectral(); return 0; }
+    if (std::strcmp(topic, "fluid") == 0) { reportFluid(); return 0; }
+    if (std::strcmp(topic, "multigrid") == 0) { reportMultigrid(); return 0; }
+    if (std::strcmp(topic, "tiles") == 0) { reportTiles(); return 0; }
+    if (std::strcmp(topic, "stencil") == 0) { reportStencil(); return 0; }
+    if (std::strcmp(topic, "detail") == 0) { reportDetail(); return 0; }
+    if (std::strcmp(topic, "advection") == 0) { reportAdvection(); return 0; }
+    if (std::strcmp(topic, "half") == 0) { reportHalf(); return 0; }
+    if (std::strcmp(topic, "upload") == 0) { reportUpload(); return 0; }
+    if (std::strcmp(topic, "checkpoint") == 0) { reportCheckpoint(); return 0; }
+    if (std::strcmp(topic, "vortex") == 0) { reportVortex(); return 0; }
+    if (std::strcmp(topic, "lbm") == 0) { reportLbm(); return 0; }
+    fprintf(stderr, "unknown report '%s' (available: noise, spectral, fluid, multigrid, tiles, stencil, detail, advection, half, upload, checkpoint, vortex, lbm)\n", topic);
+    return 1;
+}
@@ -0,0 +1,158 @@
+﻿// SimThread.h — the fluid simulation stepped on its own thread at a fixed rate, frames handed over through a triple buffer
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "Jobs.h"
+#include "Fluid.h"
+#include "Turbulence.h"
+#include "Vortex.h"
+#include "Lbm.h"
+#include "Upload.h"
+#include "Checkpoint.h"
+
+// Steps a FluidSim (and its FluidDetail, if any) every 1/rate seconds of
+// wall time with dt = 1/rate, on a thread of its own that shares the job
+// pool for the passes. After each step the frame is packed into the back
+// buffer and swapped with the ready one. The renderer swaps ready with its
+// front buffer whenever there is a newer frame: neither side ever waits for
+// the other beyond the swap itself, and a frame the renderer was too slow
+// to see is simply replaced. A step that overruns its slot pushes the
+// schedule back rather than trying to catch up.
+// With a checkpoint path the state is restored from it when it fits (see
+// Checkpoint.h) and written back every `saveEvery` steps between two steps,
+// so the next start resumes a developed fire instead of ramping up; the
+// restored state is packed before the thread starts, every detail brick at
+// once, so the first frame already shows it.
+// The other constructors step the vortex-particle smoke (Vortex.h) or the
+// lattice-Boltzmann smoke (Lbm.h) instead; they have no checkpoint.
+class SimThread {
+public:
+    SimThread(int n, int detailAmp, float rate, const std::string& checkpoint = std::string(), bool resume = true,
+              int saveEvery = 150)
+        : period_(1.0 / rate), checkpoint_(checkpoint), saveEvery_(saveEvery) {
+        sim_.reset(new FluidSim(n));
+        if (detailAmp) {
+            DetailParams dp;
+            dp.amplify = detailAmp;
+            detail_.reset(new FluidDetail(sim_->N, dp));
+        }
+        if (!checkpoint_.empty() && resume) resumed_ = loadCheckpoint(checkpoint_.c_str(), *sim_, detail_.get());
+        if (resumed_ >= 0) {
+            FieldFrame& out = frames_[ready_];
+            if (detail_) packDetailFrame(*sim_, *detail_, out, true);
+            else packFieldFrame(*sim_, out);
+            fresh_ = true;
+        }
+        thread_ = std::thread([this] { run(); });
+    }
+    SimThread(int n, const VortexParams& params, float rate) : period_(1.0 / rate), saveEvery_(0) {
+        vortex_.reset(new VortexSim(n));
+        vortex_->params = params;
+        thread_ = std::thread([this] { run(); });
+    }
+    SimThread(int n, const LbmParams& params, float rate) : period_(1.0 / rate), saveEvery_(0) {
+        lbm_.reset(new LbmSim(n));
+        lbm_->params = params;
+        thread_ = std::thread([this] { run(); });
+    }
+    // the state at exit is the freshest checkpoint
+    ~SimThread() {
+        quit_ = true;
+        thread_.join();
+        if (!checkpoint_.empty() && steps_ > 0) save();
+    }
+
+    // edge of the field texture the frames are for
+    int textureSize() const { return vortex_ ? vortex_->N : lbm_ ? lbm_->N : detail_ ? detail_->M : sim_->N; }
+
+    void setPaused(bool paused) { paused_ = paused; }
+
+    // the newest frame since the last call, or null
+    const FieldFrame* latest() {
+        std::lock_guard<std::mutex> lk(swap_);
+        if (!fresh_) return nullptr;
+        std::swap(front_, ready_);
+        fresh_ = false;
+        return &frames_[front_];
+    }
+
+    // steps so far and the wall time they took, for rates
+    long long steps() const { return steps_; }
+    double busyMs() const { return busyUs_ / 1000.0; }
+
+    // steps the checkpoint had taken, -1 if it started from scratch
+    long long resumedSteps() const { return resumed_; }
+    // checkpoints written, and how long the last one took
+    int saves() const { return saves_; }
+    double lastSaveMs() const { return lastSaveUs_ / 1000.0; }
+
+private:
+    void run() {
+        traceThreadName("sim");
+        const float dt = float(period_);
+        auto next = std::chrono::steady_clock::now();
+        const auto slot = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(period_));
+        while (!quit_) {
+            std::this_thread::sleep_until(next);
+            next += slot;
+            auto t0 = std::chrono::steady_clock::now();
+            if (next < t0) next = t0;   // overran: no catching up
+            if (paused_) continue;
+            FIRE_TRACE("sim frame", "sim");
+            FieldFrame& out = frames_[back_];
+            if (vortex_) {
+                vortex_->step(dt);
+                packVortexFrame(*vortex_, out);
+            } else if (lbm_) {
+                lbm_->step(dt);
+                packLbmFrame(*lbm_, out);
+            } else {
+                sim_->step(dt);
+                if (detail_) {
+                    detail_->advance(*sim_, dt);
+                    packDetailFrame(*sim_, *detail_, out);
+                } else {
+                    packFieldFrame(*sim_, out);
+                }
+            }
+            out.serial = uint64_t(++steps_);
+            {
+                std::lock_guard<std::mutex> lk(swap_);
+                std::swap(back_, ready_);
+                fresh_ = true;
+            }
+            busyUs_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+            if (!checkpoint_.empty() && saveEvery_ > 0 && steps_ % saveEvery_ == 0) save();
+        }
+    }
+
+    void save() {
+        FIRE_TRACE("checkpoint save", "sim");
+        auto t0 = std::chrono::steady_clock::now();
+        if (!saveCheckpoint(checkpoint_.c_str(), *sim_, detail_.get(), uint64_t(std::max(0LL, resumed_.load()) + steps_))) return;
+        lastSaveUs_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+        ++saves_;
+    }
+
+    double period_;
+    std::string checkpoint_;
+    int saveEvery_;
+    std::unique_ptr<FluidSim> sim_;
+    std::unique_ptr<FluidDetail> detail_;
+    std::unique_ptr<VortexSim> vortex_;
+    std::unique_ptr<LbmSim> lbm_;
+    FieldFrame frames_[3];
+    int back_ = 0, ready_ = 1, front_ = 2;
+    bool fresh_ = false;
+    std::mutex swap_;
+    std::atomic<bool> quit_{ false }, paused_{ false };
+    std::atomic<long long> steps_{ 0 }, busyUs_{ 0 }, resumed_{ -1 }, lastSaveUs_{ 0 };
+    std::atomic<int> saves_{ 0 };
+    std::thread thread_;
+};
@@ -0,0 +1,211 @@
+﻿// Simd.h — SSE2 helpers shared by the CPU kernels (scalar fallbacks elsewhere)
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// SSE2 is baseline on x64 (and on MSVC x86 since VS2012); other targets
+// (e.g. arm64 Macs) take the scalar paths
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FIRE_SSE2 1
+#include <emmintrin.h>
+
+// floor() without SSE4.1 round
+static inline __m128 floor_ps(__m128 x) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmplt_ps(x, t), _mm_set1_ps(1.0f)));
+}
+
+// e^x for x in roughly [-87, 88]; ~2e-6 relative error
+static inline __m128 exp_ps(__m128 x) {
+    x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(88.0f)), _mm_set1_ps(-87.0f));
+    __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));    // log2(e)
+    __m128 n = floor_ps(t);
+    __m128 f = _mm_sub_ps(t, n);                           // [0,1)
+    // 2^f, minimax degree 5
+    __m128 p = _mm_set1_ps(1.8775767e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(8.9893397e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5826318e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4015361e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9315308e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.9999994e-1f));
+    __m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(e));
+}
+
+// cos(x) for any x: reduce to [-pi, pi], then even Taylor series to x^16
+// (~1e-6 absolute error)
+static inline __m128 cos_ps(__m128 x) {
+    const __m128 inv2pi = _mm_set1_ps(0.15915494f), twoPi = _mm_set1_ps(6.28318531f);
+    __m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, inv2pi)));   // round to nearest
+    x = _mm_sub_ps(x, _mm_mul_ps(k, twoPi));
+    __m128 z = _mm_mul_ps(x, x);
+    __m128 p = _mm_set1_ps(4.7794773e-14f);                // 1/16!
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-1.1470746e-11f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(2.0876757e-9f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-2.7557319e-7f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(2.4801587e-5f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-1.3888889e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(4.1666668e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-0.5f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.0f));
+    return p;
+}
+
+static inline float hsum_ps(__m128 v) {
+    __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+#endif
+
+// Flush denormals to zero (FTZ + DAZ) on this thread while in scope. Fields
+// that decay towards zero otherwise spend most of their time in microcode.
+struct DenormalGuard {
+#ifdef FIRE_SSE2
+    unsigned saved;
+    DenormalGuard() : saved(_mm_getcsr()) { _mm_setcsr(saved | 0x8040u); }
+    ~DenormalGuard() { _mm_setcsr(saved); }
+#else
+    DenormalGuard() {}
+#endif
+};
+
+// ---------- half precision storage ----------
+// IEEE binary16 bits. Pools of Half halve the traffic of bandwidth-bound
+// kernels; arithmetic always happens in float.
+typedef uint16_t Half;
+
+// F16C converts 4 or 8 values per instruction. MSVC emits the intrinsics
+// without /arch, and GCC and Clang compile them into functions marked with
+// the f16c target, so a build without -mf16c has them too; either way the
+// CPU is asked once at startup. With -mf16c (or -march=...) the helpers
+// inline into the kernels; without, each is a call, still far cheaper than
+// the bit twiddling below.
+#if defined(FIRE_SSE2) && (defined(__F16C__) || defined(_MSC_VER) || defined(__GNUC__))
+#define FIRE_F16C 1
+#include <immintrin.h>
+#if defined(__F16C__) || defined(_MSC_VER)
+#define FIRE_F16C_TARGET
+#else
+#define FIRE_F16C_TARGET __attribute__((target("f16c")))
+#endif
+#if defined(__F16C__)
+static inline bool cpuHasF16C() { return true; }
+#elif defined(_MSC_VER)
+#include <intrin.h>
+static inline bool cpuHasF16C() { int r[4]; __cpuid(r, 1); return (r[2] >> 29 & 1) != 0; }
+#else
+static inline bool cpuHasF16C() { __builtin_cpu_init(); return __builtin_cpu_supports("f16c") != 0; }
+#endif
+static const bool kHasF16C = cpuHasF16C();
+
+static inline FIRE_F16C_TARGET float halfToFloatF16C(Half h) { return _cvtsh_ss(h); }
+static inline FIRE_F16C_TARGET Half floatToHalfF16C(float f) { return Half(_cvtss_sh(f, 0)); }   // 0: round to nearest even
+static inline FIRE_F16C_TARGET __m128 load4F16C(const Half* p) { return _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)p)); }
+static inline FIRE_F16C_TARGET void store4F16C(Half* p, __m128 v) { _mm_storel_epi64((__m128i*)p, _mm_cvtps_ph(v, 0)); }
+static inline FIRE_F16C_TARGET void halfToFloatF16C(const Half* in, float* out, int n) {
+    for (int i = 0; i < n; i += 4) _mm_storeu_ps(out + i, load4F16C(in + i));
+}
+static inline FIRE_F16C_TARGET void floatToHalfF16C(const float* in, Half* out, int n) {
+    for (int i = 0; i < n; i += 4) store4F16C(out + i, _mm_loadu_ps(in + i));
+}
+#else
+static const bool kHasF16C = false;
+#endif
+
+// round to nearest even, with subnormals, infinities and NaN
+static inline Half floatToHalfSoft(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000u;
+    x &= 0x7FFFFFFFu;
+    if (x >= 0x7F800000u) return Half(sign | (x > 0x7F800000u ? 0x7E00u : 0x7C00u));
+    if (x >= 0x477FF000u) return Half(sign | 0x7C00u);              // rounds past 65504
+    if (x < 0x38800000u) {                                           // below 2^-14: subnormal
+        if (x < 0x33000000u) return Half(sign);                      // below half the smallest subnormal
+        uint32_t m = (x & 0x7FFFFFu) | 0x800000u;
+        int shift = 126 - int(x >> 23);
+        uint32_t q = m >> shift, rem = m & ((1u << shift) - 1), tie = 1u << (shift - 1);
+        if (rem > tie || (rem == tie && (q & 1))) ++q;
+        return Half(sign | q);
+    }
+    uint32_t h = (x - 0x38000000u) >> 13, rem = x & 0x1FFFu;
+    if (rem > 0x1000u || (rem == 0x1000u && (h & 1))) ++h;          // a carry into the exponent is right
+    return Half(sign | h);
+}
+
+static inline float halfToFloatSoft(Half h) {
+    uint32_t sign = uint32_t(h & 0x8000u) << 16, e = (h >> 10) & 0x1Fu, m = h & 0x3FFu, x;
+    if (e == 0) {
+        if (m == 0) x = sign;
+        else {
+            e = 113;
+            while (!(m & 0x400u)) { m <<= 1; --e; }
+            x = sign | (e << 23) | ((m & 0x3FFu) << 13);
+        }
+    } else if (e == 31) x = sign | 0x7F800000u | (m << 13);
+    else x = sign | ((e + 112) << 23) | (m << 13);
+    float f;
+    std::memcpy(&f, &x, 4);
+    return f;
+}
+
+static inline float halfToFloat(Half h) {
+#ifdef FIRE_F16C
+    if (kHasF16C) return halfToFloatF16C(h);
+#endif
+    return halfToFloatSoft(h);
+}
+
+static inline Half floatToHalf(float f) {
+#ifdef FIRE_F16C
+    if (kHasF16C) return floatToHalfF16C(f);
+#endif
+    return floatToHalfSoft(f);
+}
+
+// n values, n a multiple of 4
+static inline void halfToFloat(const Half* in, float* out, int n) {
+#ifdef FIRE_F16C
+    if (kHasF16C) { halfToFloatF16C(in, out, n); return; }
+#endif
+    for (int i = 0; i < n; ++i) out[i] = halfToFloatSoft(in[i]);
+}
+
+static inline void floatToHalf(const float* in, Half* out, int n) {
+#ifdef FIRE_F16C
+    if (kHasF16C) { floatToHalfF16C(in, out, n); return; }
+#endif
+    for (int i = 0; i < n; ++i) out[i] = floatToHalfSoft(in[i]);
+}
+
+// pool element <-> float, so kernels can be written once for both storages
+static inline float toFloat(float x) { return x; }
+static inline float toFloat(Half h) { return halfToFloat(h); }
+static inline void fromFloat(float x, float& out) { out = x; }
+static inline void fromFloat(float x, Half& out) { out = floatToHalf(x); }
+static inline void toFloat(const float* in, float* out, int n) { std::memcpy(out, in, n * sizeof(float)); }
+static inline void toFloat(const Half* in, float* out, int n) { halfToFloat(in, out, n); }
+static inline void fromFloat(const float* in, float* out, int n) { std::memcpy(out, in, n * sizeof(float)); }
+static inline void fromFloat(const float* in, Half* out, int n) { floatToHalf(in, out, n); }
+
+#ifdef FIRE_SSE2
+// four pool elements as floats, and back
+static inline __m128 load4(const float* p) { return _mm_loadu_ps(p); }
+static inline __m128 load4(const Half* p) {
+#ifdef FIRE_F16C
+    if (kHasF16C) return load4F16C(p);
+#endif
+    return _mm_setr_ps(halfToFloatSoft(p[0]), halfToFloatSoft(p[1]), halfToFloatSoft(p[2]), halfToFloatSoft(p[3]));
+}
+static inline void store4(float* p, __m128 v) { _mm_storeu_ps(p, v); }
+static inline void store4(Half* p, __m128 v) {
+#ifdef FIRE_F16C
+    if (kHasF16C) { store4F16C(p, v); return; }
+#endif
+    float t[4];
+    _mm_storeu_ps(t, v);
+    for (int i = 0; i < 4; ++i) p[i] = floatToHalfSoft(t[i]);
+}
+#endif
@@ -0,0 +1,157 @@
+﻿// SpectralNoise.h — noise volumes by spectral synthesis (threaded radix-2 3D FFT)
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <complex>
+#include <vector>
+#include <algorithm>
+
+#include "Jobs.h"
+
+typedef std::complex<float> cfloat;
+
+// In-place radix-2 FFT plan for one length (power of two).
+struct Fft1D {
+    int n = 0, logn = 0;
+    std::vector<int> bitrev;
+    std::vector<cfloat> twiddle;   // exp(-2*pi*i*k/n), k < n/2
+
+    explicit Fft1D(int size) : n(size) {
+        while ((1 << logn) < n) ++logn;
+        bitrev.resize(n);
+        for (int i = 0; i < n; ++i) {
+            int r = 0;
+            for (int b = 0; b < logn; ++b) r |= ((i >> b) & 1) << (logn - 1 - b);
+            bitrev[i] = r;
+        }
+        twiddle.resize(std::max(1, n / 2));
+        for (int k = 0; k < n / 2; ++k) {
+            double a = -2.0 * 3.14159265358979323846 * k / n;
+            twiddle[k] = cfloat(float(std::cos(a)), float(std::sin(a)));
+        }
+    }
+
+    // unnormalized; inverse uses conjugate twiddles
+    void run(cfloat* d, bool inverse) const {
+        for (int i = 0; i < n; ++i)
+            if (i < bitrev[i]) std::swap(d[i], d[bitrev[i]]);
+        for (int len = 2; len <= n; len <<= 1) {
+            int half = len >> 1, step = n / len;
+            for (int i = 0; i < n; i += len) {
+                for (int k = 0; k < half; ++k) {
+                    // complex multiply spelled out: operator* on std::complex
+                    // goes through the NaN-checking library call without -ffast-math
+                    float wr = twiddle[k * step].real(), wi = twiddle[k * step].imag();
+                    if (inverse) wi = -wi;
+                    cfloat& a = d[i + k];
+                    cfloat& b = d[i + k + half];
+                    float br = b.real() * wr - b.imag() * wi;
+                    float bi = b.real() * wi + b.imag() * wr;
+                    b = cfloat(a.real() - br, a.imag() - bi);
+                    a = cfloat(a.real() + br, a.imag() + bi);
+                }
+            }
+        }
+    }
+};
+
+// 3D FFT of an N^3 grid, index (z*N + y)*N + x. Lines along each axis are
+// transformed in parallel; y and z lines are gathered 8 at a time so every
+// read pulls a whole cache line of neighbouring x.
+static void fft3D(std::vector<cfloat>& grid, int N, bool inverse) {
+    const Fft1D plan(N);
+    const int B = std::min(8, N);
+
+    jobs().parallelFor(0, N * N, [&](int lo, int hi) {
+        for (int r = lo; r < hi; ++r) plan.run(&grid[size_t(r) * N], inverse);
+    }, 16);
+
+    for (int axis = 1; axis <= 2; ++axis) {
+        const size_t stride = axis == 1 ? size_t(N) : size_t(N) * N;
+        const size_t outer = axis == 1 ? size_t(N) * N : size_t(N);   // step between line groups
+        // groups: (other coordinate, block of B x's)
+        const int groups = N * (N / B);
+        jobs().parallelFor(0, groups, [&](int lo, int hi) {
+            std::vector<cfloat> lines(size_t(B) * N);
+            for (int g = lo; g < hi; ++g) {
+                int other = g / (N / B), x0 = (g % (N / B)) * B;
+                size_t base = size_t(other) * outer + x0;
+                for (int i = 0; i < N; ++i)
+                    for (int b = 0; b < B; ++b) lines[size_t(b) * N + i] = grid[base + i * stride + b];
+                for (int b = 0; b < B; ++b) plan.run(&lines[size_t(b) * N], inverse);
+                for (int i = 0; i < N; ++i)
+                    for (int b = 0; b < B; ++b) grid[base + i * stride + b] = lines[size_t(b) * N + i];
+            }
+        });
+    }
+}
+
+// stateless hash -> [0,1), so the spectrum fill is the same for any thread count
+static float hashUniform(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return float(x >> 40) / 16777216.0f;
+}
+
+// Periodic N^3 volume (N a power of two) with amplitude |k|^-beta for
+// kMin <= |k| <= kMax (in cycles per volume) and uniformly random phases.
+// Normalized to zero mean and unit variance. O(N^3 log N), tiles by construction.
+static std::vector<float> synthesizeSpectralVolume(int N, float beta, float kMin, float kMax, unsigned seed) {
+    FIRE_TRACE("synthesizeSpectralVolume", "bake");
+    const size_t count = size_t(N) * N * N;
+    std::vector<cfloat> grid(count);
+
+    // amplitude depends on the integer |k|^2 only, phases come from a
+    // 4096-entry phasor table: no pow/sin/cos per bin
+    const int maxK2 = 3 * (N / 2) * (N / 2);
+    std::vector<float> ampByK2(maxK2 + 1, 0.0f);
+    for (int k2 = 1; k2 <= maxK2; ++k2) {
+        float k = std::sqrt(float(k2));
+        if (k >= kMin && k <= kMax) ampByK2[k2] = std::pow(k, -beta);
+    }
+    std::vector<cfloat> phasor(4096);
+    for (int i = 0; i < 4096; ++i) {
+        double a = 2.0 * 3.14159265358979323846 * i / 4096.0;
+        phasor[i] = cfloat(float(std::cos(a)), float(std::sin(a)));
+    }
+
+    jobs().parallelFor(0, N, [&](int z0, int z1) {
+        for (int z = z0; z < z1; ++z)
+            for (int y = 0; y < N; ++y)
+                for (int x = 0; x < N; ++x) {
+                    // signed frequencies of the DFT bins
+                    int kx = x <= N / 2 ? x : x - N, ky = y <= N / 2 ? y : y - N, kz = z <= N / 2 ? z : z - N;
+                    size_t i = (size_t(z) * N + y) * N + x;
+                    float amp = ampByK2[kx * kx + ky * ky + kz * kz];
+                    grid[i] = amp * phasor[int(hashUniform((uint64_t(seed) << 40) ^ i) * 4096.0f) & 4095];
+                }
+    });
+
+    fft3D(grid, N, /*inverse*/true);
+
+    // the real part of a random-phase spectrum is a real field with the same
+    // power spectrum (the imaginary part is an independent second copy)
+    std::vector<float> vol(count);
+    std::vector<double> sums(size_t(N) * 2, 0.0);
+    jobs().parallelFor(0, N, [&](int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            double s = 0.0, s2 = 0.0;
+            for (size_t i = size_t(z) * N * N; i < size_t(z + 1) * N * N; ++i) {
+                float v = grid[i].real();
+                vol[i] = v; s += v; s2 += double(v) * v;
+            }
+            sums[2 * z] = s; sums[2 * z + 1] = s2;
+        }
+    });
+    double s = 0.0, s2 = 0.0;
+    for (int z = 0; z < N; ++z) { s += sums[2 * z]; s2 += sums[2 * z + 1]; }
+    double mean = s / double(count), var = s2 / double(count) - mean * mean;
+    float inv = var > 0.0 ? float(1.0 / std::sqrt(var)) : 0.0f;
+    jobs().parallelFor(0, N, [&](int z0, int z1) {
+        for (size_t i = size_t(z0) * N * N; i < size_t(z1) * N * N; ++i) vol[i] = (vol[i] - float(mean)) * inv;
+    });
+    return vol;
+}
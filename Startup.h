@@ -0,0 +1,70 @@
+﻿// Startup.h — time from launch to the first presented frame, phase by phase, as a table and as JSON
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#include "Trace.h"
+
+// Phases run back to back: next() closes the open one and opens the
+// following one at the same instant, so the phases add up to the time to
+// the first frame. Times are on the trace clock, and a phase that closes
+// while a capture runs goes into it as a "startup" event as well. Drivers
+// may compile shaders lazily, at the first draw with them, so part of
+// what makeProgram seems to cost can show up in the first frame instead.
+class StartupTimeline {
+public:
+    explicit StartupTimeline(const char* first) : origin_(traceNow()) { phases_.reserve(32); next(first); }
+
+    void next(const char* name) {
+        int64_t now = traceNow();
+        close(now);
+        phases_.push_back(Phase{ name, now, now });
+        open_ = true;
+    }
+    void end() { close(traceNow()); }
+    bool running() const { return open_; }
+
+    // from construction to the end of the last phase closed
+    double totalMs() const { return phases_.empty() ? 0.0 : double(phases_.back().end - origin_) * 1e-6; }
+
+    void print(FILE* f) const {
+        fprintf(f, "startup: %.1f ms to the first frame\n", totalMs());
+        fprintf(f, "  %-24s %9s %9s %6s\n", "phase", "at ms", "ms", "%");
+        const double total = totalMs();
+        for (const Phase& p : phases_) {
+            double ms = double(p.end - p.start) * 1e-6;
+            fprintf(f, "  %-24s %9.2f %9.2f %5.1f%%\n", p.name, double(p.start - origin_) * 1e-6, ms,
+                    total > 0.0 ? 100.0 * ms / total : 0.0);
+        }
+    }
+
+    void writeJson(FILE* f) const {
+        fprintf(f, "{\n  \"timeToFirstFrameMs\": %.4f,\n  \"phases\": [", totalMs());
+        for (size_t i = 0; i < phases_.size(); ++i) {
+            const Phase& p = phases_[i];
+            fprintf(f, "%s\n    { \"name\": \"%s\", \"startMs\": %.4f, \"ms\": %.4f }", i ? "," : "", p.name,
+                    double(p.start - origin_) * 1e-6, double(p.end - p.start) * 1e-6);
+        }
+        fprintf(f, "\n  ]\n}\n");
+    }
+
+private:
+    struct Phase {
+        const char* name;   // string literals only, as for trace events
+        int64_t start, end;
+    };
+
+    void close(int64_t now) {
+        if (!open_) return;
+        Phase& p = phases_.back();
+        p.end = now;
+        if (traceOn()) traceRecord(p.name, "startup", p.start, p.end);
+        open_ = false;
+    }
+
+    int64_t origin_;
+    std::vector<Phase> phases_;
+    bool open_ = false;
+};
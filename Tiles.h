@@ -0,0 +1,138 @@
+﻿// Tiles.h — 8^3 tile map over an n^3 grid with a slot pool for sparse fields
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+#include "Simd.h"
+
+// what gatherHalo() puts beyond the domain
+enum class Apron { Clamp, OpenTop, Zero };
+
+// Fields that share a TileMap are flat pools of B3 floats per slot. Only
+// allocated tiles have a slot; everything else reads as 0. Freed slots are
+// reused, so the pools grow to the largest active set and never churn.
+struct TileMap {
+    static const int B = 8, B3 = B * B * B;
+
+    int n = 0, T = 0;
+    std::vector<int> slot;          // per tile, -1 = not allocated
+    std::vector<int> active;        // allocated tiles, ascending
+    std::vector<int> released;      // tiles freed since the caller last cleared this
+    std::vector<int> freeSlots;
+    int slots = 0;                  // pool size in tiles (high-water mark)
+
+    explicit TileMap(int size = 0) : n(size), T(size / B) { slot.assign(size_t(T) * T * T, -1); }
+
+    int tileIndex(int tx, int ty, int tz) const { return (tz * T + ty) * T + tx; }
+    int tileAt(int x, int y, int z) const { return tileIndex(x >> 3, y >> 3, z >> 3); }
+    void tileOrigin(int t, int& ox, int& oy, int& oz) const {
+        ox = (t % T) * B; oy = (t / T % T) * B; oz = (t / (T * T)) * B;
+    }
+    static int local(int x, int y, int z) { return ((z & 7) * B + (y & 7)) * B + (x & 7); }
+    size_t base(int t) const { return size_t(slot[t]) * B3; }
+
+    template<typename V>
+    float fetch(const std::vector<V>& f, int x, int y, int z) const {
+        int s = slot[tileAt(x, y, z)];
+        return s < 0 ? 0.0f : toFloat(f[size_t(s) * B3 + local(x, y, z)]);
+    }
+
+    // Make exactly the flagged tiles allocated. Surviving tiles keep their
+    // data, new ones start at zero in every pool. Returns true on any change.
+    bool assign(const std::vector<unsigned char>& want, std::initializer_list<std::vector<float>*> pools) {
+        bool changed = false;
+        for (int t : active)
+            if (!want[t]) { freeSlots.push_back(slot[t]); slot[t] = -1; released.push_back(t); changed = true; }
+        active.clear();
+        int grown = slots;
+        for (int t = 0; t < T * T * T; ++t) {
+            if (!want[t]) continue;
+            active.push_back(t);
+            if (slot[t] >= 0) continue;
+            changed = true;
+            if (!freeSlots.empty()) { slot[t] = freeSlots.back(); freeSlots.pop_back(); }
+            else slot[t] = grown++;
+            for (std::vector<float>* f : pools) {
+                if (f->size() < size_t(grown) * B3) f->resize(size_t(grown) * B3);
+                std::fill(f->begin() + base(t), f->begin() + base(t) + B3, 0.0f);
+            }
+        }
+        slots = grown;
+        // a tile released and re-allocated in one go still has to be redrawn, not cleared
+        released.erase(std::remove_if(released.begin(), released.end(),
+                                      [&](int t) { return slot[t] >= 0; }), released.end());
+        return changed;
+    }
+
+    // f around tile t into a 10^3 block with a one-cell apron on the six
+    // faces; edges and corners are left alone, 7-point stencils never read
+    // them. Outside the domain the apron repeats the edge cell (Clamp,
+    // Neumann), or reads 0 above the top (OpenTop) or everywhere (Zero).
+    // Unallocated tiles read 0. Each face is one 8x8 layer of a neighbour;
+    // `axes` (bit 0 = x) picks the faces a one-sided caller needs. Half
+    // pools are widened to float on the way. With parity >= 0 only apron
+    // cells with (x + y + z) % 2 == parity are read from neighbours and the
+    // rest are 0, so a red-black half-sweep never touches the cells other
+    // tiles are writing at the same time.
+    template<typename V>
+    void gatherHalo(const std::vector<V>& f, int t, float* halo, Apron apron = Apron::Clamp, int axes = 7,
+                    int parity = -1) const {
+        const int H = B + 2;
+        const V* own = &f[base(t)];
+        for (int z = 0; z < B; ++z)
+            for (int y = 0; y < B; ++y)
+                toFloat(own + (z * B + y) * B, halo + ((z + 1) * H + y + 1) * H + 1, B);
+        const int tc[3] = { t % T, t / T % T, t / (T * T) };
+        for (int a = 0; a < 3; ++a)
+            for (int side = 0; side < 2 && (axes >> a & 1); ++side) {
+                int nc[3] = { tc[0], tc[1], tc[2] };
+                nc[a] += side ? 1 : -1;
+                const V* src = nullptr;         // the layer to copy, in a tile's layout
+                if (nc[a] < 0 || nc[a] >= T) {
+                    bool zero = apron == Apron::Zero || (apron == Apron::OpenTop && a == 1 && side);
+                    if (!zero) src = own + (side ? B - 1 : 0) * (a == 0 ? 1 : a == 1 ? B : B * B);
+                } else {
+                    int s = slot[tileIndex(nc[0], nc[1], nc[2])];
+                    if (s >= 0) src = &f[size_t(s) * B3] + (side ? 0 : B - 1) * (a == 0 ? 1 : a == 1 ? B : B * B);
+                }
+                const int at = side ? B + 1 : 0;
+                // local parity is global parity (B is even), -1 and B included
+                const int face = at - 1;
+                if (a == 0) {           // one cell per row
+                    for (int z = 0; z < B; ++z)
+                        for (int y = 0; y < B; ++y) {
+                            bool skip = parity >= 0 && ((face + y + z) & 1) != parity;
+                            halo[((z + 1) * H + y + 1) * H + at] = src && !skip ? toFloat(src[(z * B + y) * B]) : 0.0f;
+                        }
+                    continue;
+                }
+                // y and z faces are made of whole rows
+                for (int k = 0; k < B; ++k) {
+                    float* dst = halo + (a == 1 ? (k + 1) * H + at : at * H + k + 1) * H + 1;
+                    const V* row = src ? src + k * (a == 1 ? B * B : B) : nullptr;
+                    if (!row) {
+                        std::fill(dst, dst + B, 0.0f);
+                    } else if (parity < 0) {
+                        toFloat(row, dst, B);
+                    } else {
+                        for (int x = 0; x < B; ++x)
+                            dst[x] = ((face + k + x) & 1) == parity ? toFloat(row[x]) : 0.0f;
+                    }
+                }
+            }
+    }
+};
+
+// the 10^3 halo index of local cell (x, y, z)
+static inline int haloIndex(int x, int y, int z) { return ((z + 1) * 10 + (y + 1)) * 10 + (x + 1); }
+
+// 32-bit integer hash (lowbias32) for per-cell and per-step random numbers
+// in the solvers
+static inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16; x *= 0x7FEB352Du;
+    x ^= x >> 15; x *= 0x846CA68Bu;
+    return x ^ (x >> 16);
+}
@@ -0,0 +1,186 @@
+﻿// Trace.h — scoped CPU trace events in per-thread buffers, written as Chrome trace JSON (chrome://tracing, Perfetto)
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// Every thread appends to a buffer of its own, so recording takes no lock
+// and no atomic read-modify-write: the owner writes an event, then
+// publishes it by storing the new count with release order, and the writer
+// of the JSON reads only as far as the count it acquires. A capture is a
+// generation: starting one bumps the generation, and a buffer from an
+// older one is emptied by its own thread before the next event, never by
+// another. While no capture runs a scope costs one relaxed load and a
+// branch; defining FIRE_NO_TRACE compiles the FIRE_TRACE scopes out.
+struct TraceEvent {
+    const char* name;       // string literals only: stored, not copied
+    const char* cat;
+    int64_t start, dur;     // ns since the trace epoch
+};
+
+struct TraceBuffer {
+    static const uint32_t Capacity = 1 << 15;
+    TraceEvent events[Capacity];
+    std::atomic<uint32_t> count{ 0 }, generation{ 0 }, overflow{ 0 };   // written by the owner only
+    int tid = 0;
+    char name[32] = "";
+};
+
+struct TraceRegistry {
+    std::atomic<bool> enabled{ false };
+    std::atomic<uint32_t> generation{ 0 };
+    std::mutex mutex;                                   // guards buffers, taken once per thread
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+static inline TraceRegistry& traceRegistry() { static TraceRegistry r; return r; }
+
+static inline bool traceOn() { return traceRegistry().enabled.load(std::memory_order_relaxed); }
+
+static inline int64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceRegistry().epoch).count();
+}
+
+// what this thread is called in the trace, kept apart from the buffer so
+// naming a thread that never records costs nothing
+static inline char* traceThreadLabel() { static thread_local char label[32] = ""; return label; }
+
+// this thread's buffer, made and registered on its first event
+static inline TraceBuffer*& traceBufferSlot() { static thread_local TraceBuffer* buf = nullptr; return buf; }
+
+static inline TraceBuffer& traceBuffer() {
+    TraceBuffer*& buf = traceBufferSlot();
+    if (!buf) {
+        TraceRegistry& r = traceRegistry();
+        std::lock_guard<std::mutex> lk(r.mutex);
+        r.buffers.emplace_back(new TraceBuffer());
+        buf = r.buffers.back().get();
+        buf->tid = int(r.buffers.size());
+        if (traceThreadLabel()[0]) std::snprintf(buf->name, sizeof(buf->name), "%s", traceThreadLabel());
+        else std::snprintf(buf->name, sizeof(buf->name), "thread %d", buf->tid);
+    }
+    return *buf;
+}
+
+// The innermost open scope on this thread, so the job pool can label the
+// chunks it runs on its workers with what the submitting thread was doing.
+static inline const char*& traceCurrent() { static thread_local const char* name = nullptr; return name; }
+
+static inline void traceRecord(const char* name, const char* cat, int64_t start, int64_t end) {
+    TraceBuffer& b = traceBuffer();
+    uint32_t gen = traceRegistry().generation.load(std::memory_order_acquire);
+    if (b.generation.load(std::memory_order_relaxed) != gen) {
+        b.count.store(0, std::memory_order_relaxed);
+        b.overflow.store(0, std::memory_order_relaxed);
+        b.generation.store(gen, std::memory_order_release);
+    }
+    uint32_t n = b.count.load(std::memory_order_relaxed);
+    if (n == TraceBuffer::Capacity) {
+        b.overflow.store(b.overflow.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    b.events[n] = TraceEvent{ name, cat, start, end - start };
+    b.count.store(n + 1, std::memory_order_release);
+}
+
+// names the calling thread in the trace ("main", "sim", "worker 3", ...)
+static inline void traceThreadName(const char* fmt, int i = 0) {
+    std::snprintf(traceThreadLabel(), 32, fmt, i);
+    if (TraceBuffer* b = traceBufferSlot()) std::snprintf(b->name, sizeof(b->name), "%s", traceThreadLabel());
+}
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, const char* cat = "main") {
+        if (!traceOn()) return;
+        name_ = name;
+        cat_ = cat;
+        prev_ = traceCurrent();
+        traceCurrent() = name;
+        start_ = traceNow();
+    }
+    ~TraceScope() { end(); }
+
+    // closes this event and opens the next one at the same instant, for a
+    // run of phases in one block
+    void next(const char* name) {
+        if (!name_) return;   // tracing was off when the scope opened
+        int64_t now = traceNow();
+        traceRecord(name_, cat_, start_, now);
+        name_ = name;
+        traceCurrent() = name;
+        start_ = now;
+    }
+    // closes it before the block does
+    void end() {
+        if (!name_) return;
+        traceRecord(name_, cat_, start_, traceNow());
+        traceCurrent() = prev_;
+        name_ = nullptr;
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_ = nullptr;
+    const char* cat_ = nullptr;
+    const char* prev_ = nullptr;
+    int64_t start_ = 0;
+};
+
+#define FIRE_TRACE_CAT2(a, b) a##b
+#define FIRE_TRACE_CAT(a, b) FIRE_TRACE_CAT2(a, b)
+#ifdef FIRE_NO_TRACE
+#define FIRE_TRACE(...) ((void)0)
+#else
+// FIRE_TRACE("name") or FIRE_TRACE("name", "category"): the rest of the enclosing block
+#define FIRE_TRACE(...) TraceScope FIRE_TRACE_CAT(traceScope, __LINE__)(__VA_ARGS__)
+#endif
+
+// starts a capture; events recorded before it are dropped
+static inline void traceStart() {
+    TraceRegistry& r = traceRegistry();
+    r.generation.fetch_add(1, std::memory_order_acq_rel);
+    r.enabled.store(true, std::memory_order_relaxed);
+}
+
+static inline void traceStop() { traceRegistry().enabled.store(false, std::memory_order_relaxed); }
+
+// The events of the last capture as Chrome trace JSON: complete ("X")
+// events in microseconds plus a thread_name record per thread. A scope
+// still open on another thread when this runs is simply not in it.
+// Returns the number of events written, or -1 if the file failed.
+static inline long long traceWrite(const char* path) {
+    TraceRegistry& r = traceRegistry();
+    FILE* f = std::fopen(path, "w");
+    if (!f) return -1;
+    const uint32_t gen = r.generation.load(std::memory_order_acquire);
+    long long written = 0, dropped = 0;
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::lock_guard<std::mutex> lk(r.mutex);
+    bool first = true;
+    for (const std::unique_ptr<TraceBuffer>& b : r.buffers) {
+        std::fprintf(f, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+                     first ? "" : ",\n", b->tid, b->name);
+        first = false;
+        if (b->generation.load(std::memory_order_acquire) != gen) continue;
+        uint32_t n = b->count.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < n; ++i) {
+            const TraceEvent& e = b->events[i];
+            std::fprintf(f, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\",\"cat\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+                         b->tid, e.name, e.cat, e.start * 1e-3, e.dur * 1e-3);
+        }
+        written += n;
+        dropped += b->overflow.load(std::memory_order_relaxed);
+    }
+    std::fprintf(f, "\n],\"otherData\":{\"droppedEvents\":%lld}}\n", dropped);
+    std::fclose(f);
+    return written;
+}
@@ -0,0 +1,262 @@
+﻿// Turbulence.h — procedural sub-grid detail over a coarse FluidSim (CPU, threaded)
+// Kim, Thürey, James, Gross, "Wavelet Turbulence for Fluid Simulation", SIGGRAPH 2008;
+// Neyret, "Advected Textures", SCA 2003.
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+#include "Noise.h"
+#include "Fluid.h"
+
+struct DetailParams {
+    int amplify = 4;            // output cells per coarse cell along each axis: 2, 4 or 8
+    float strength = 1.1f;      // noise amplitude at the reference speed
+    float refSpeed = 0.5f;      // coarse speed (domain units / s) that gets the full amplitude
+    float period = 1.5f;        // seconds a set of texture coordinates lives before its reset
+    int refreshFrames = 3;      // every brick with smoke in it is redone within this many frames
+};
+
+// Detail for an (amplify * n)^3 volume over an n^3 FluidSim. Two sets of
+// texture coordinates ride the coarse velocity and are reset half a period
+// apart; the noise is read through both and cross-faded, so no reset is
+// visible. Noise bands run from the coarse cell size down to two output
+// cells with Kolmogorov amplitudes (2^(-5/6) per octave), scaled by the
+// local speed (the square root of the kinetic energy), and modulate the
+// interpolated density and temperature.
+// The output is 8^3 bricks: select() picks this frame's share of the bricks
+// whose footprint holds smoke, synthesize() fills them in parallel.
+struct FluidDetail {
+    static const int B = TileMap::B;
+    DetailParams params;
+    int n = 0, M = 0, T = 0;                  // coarse size, output size, output bricks per axis
+    std::vector<float> coords[6];             // two sets of (x, y, z), dense n^3, in coarse cells
+    std::vector<float> scratch[6];
+    std::vector<float> amp;                   // detail amplitude per coarse cell
+    float time = 0.0f, weight[2] = { 1.0f, 0.0f };
+    uint32_t resets = 0;
+    Perlin3D perlin;
+
+    std::vector<int> live;                    // bricks whose footprint holds smoke, ascending
+    std::vector<int> dirty;                   // bricks to synthesize and upload this frame
+    std::vector<int> cleared;                 // bricks shown before that have to go back to 0
+    std::vector<unsigned char> shown;
+    size_t cursor = 0;
+
+    FluidDetail(int coarse, const DetailParams& p = DetailParams())
+        : params(p), n(coarse), M(coarse * p.amplify), T(coarse * p.amplify / B), perlin(4242) {
+        for (int k = 0; k < 6; ++k) { coords[k].resize(size_t(n) * n * n); scratch[k].resize(coords[k].size()); }
+        amp.assign(size_t(n) * n * n, 0.0f);
+        shown.assign(size_t(T) * T * T, 0);
+        reset(0);
+        reset(1);
+    }
+
+    void brickOrigin(int b, int& ox, int& oy, int& oz) const {
+        ox = (b % T) * B; oy = (b / T % T) * B; oz = (b / (T * T)) * B;
+    }
+
+    // back to the cell centres, shifted so each reset shows a different patch of noise
+    void reset(int set) {
+        uint32_t h = hash32(++resets * 0x9E3779B9u);
+        float off[3] = { float(h & 1023) * 0.173f, float(h >> 10 & 1023) * 0.131f, float(h >> 20 & 1023) * 0.157f };
+        jobs().parallelFor(0, n, [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z)
+                for (int y = 0; y < n; ++y)
+                    for (int x = 0; x < n; ++x) {
+                        size_t i = (size_t(z) * n + y) * n + x;
+                        coords[3 * set][i] = x + 0.5f + off[0];
+                        coords[3 * set + 1][i] = y + 0.5f + off[1];
+                        coords[3 * set + 2][i] = z + 0.5f + off[2];
+                    }
+        });
+    }
+
+    // after sim.step(dt): age and reset the coordinate sets, advect them, refresh the amplitude
+    void advance(const FluidSim& sim, float dt) {
+        FIRE_TRACE("detail advance", "sim");
+        float before = time / params.period;
+        time += dt;
+        float after = time / params.period;
+        for (int set = 0; set < 2; ++set) {
+            float shift = 0.5f * set;
+            if (std::floor(after + shift) != std::floor(before + shift)) reset(set);
+            float age = after + shift - std::floor(after + shift);
+            weight[set] = 1.0f - std::fabs(2.0f * age - 1.0f);   // 0 at a reset; the two sum to 1
+        }
+        for (int k = 0; k < 6; ++k) std::swap(coords[k], scratch[k]);
+        const float hi = float(n - 1), ampScale = params.strength / (params.refSpeed * n);
+        jobs().parallelFor(0, n, [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z)
+                for (int y = 0; y < n; ++y)
+                    for (int x = 0; x < n; ++x) {
+                        size_t i = (size_t(z) * n + y) * n + x;
+                        float vx = sim.tiles.fetch(sim.u, x, y, z), vy = sim.tiles.fetch(sim.v, x, y, z);
+                        float vz = sim.tiles.fetch(sim.w, x, y, z);
+                        amp[i] = std::min(params.strength, ampScale * std::sqrt(vx * vx + vy * vy + vz * vz));
+                        float px = std::min(std::max(x - dt * vx, 0.0f), hi);
+                        float py = std::min(std::max(y - dt * vy, 0.0f), hi);
+                        float pz = std::min(std::max(z - dt * vz, 0.0f), hi);
+                        int ix = std::min(int(px), n - 2), iy = std::min(int(py), n - 2), iz = std::min(int(pz), n - 2);
+                        float fx = px - ix, fy = py - iy, fz = pz - iz;
+                        size_t o = (size_t(iz) * n + iy) * n + ix;
+                        const size_t sy = n, sz = size_t(n) * n;
+                        for (int k = 0; k < 6; ++k) {
+                            const float* c = scratch[k].data() + o;
+                            float a = lerp(lerp(c[0], c[1], fx), lerp(c[sy], c[sy + 1], fx), fy);
+                            float b = lerp(lerp(c[sz], c[sz + 1], fx), lerp(c[sz + sy], c[sz + sy + 1], fx), fy);
+                            coords[k][i] = lerp(a, b, fz);
+                        }
+                    }
+        });
+    }
+
+    // the footprint of output brick b: coarse cells lo..lo+L-1 per axis (clamped on reads)
+    int footprint() const { return B / params.amplify + 2; }
+    void footprintOrigin(int b, int& lx, int& ly, int& lz) const {
+        int ox, oy, oz;
+        brickOrigin(b, ox, oy, oz);
+        lx = ox / params.amplify - 1; ly = oy / params.amplify - 1; lz = oz / params.amplify - 1;
+    }
+
+    // this frame's bricks: a 1/refreshFrames share of the live ones, round-robin
+    // (all of them with `all`), plus every brick that was shown and has lost its smoke
+    void select(const FluidSim& sim, bool all = false) {
+        const int a = params.amplify, L = footprint(), per = B / a;   // coarse cells per brick
+        const float eps = sim.params.activeThreshold;
+        live.clear();
+        for (int t : sim.tiles.active) {
+            int cx, cy, cz;
+            sim.tiles.tileOrigin(t, cx, cy, cz);
+            for (int k = 0; k < a * a * a; ++k) {
+                int bx = (cx * a) / B + k % a, by = (cy * a) / B + k / a % a, bz = (cz * a) / B + k / (a * a);
+                int b = (bz * T + by) * T + bx, lx = bx * per - 1, ly = by * per - 1, lz = bz * per - 1;
+                bool smoke = false;
+                for (int i = 0; i < L * L * L && !smoke; ++i) {
+                    int x = std::min(std::max(lx + i % L, 0), n - 1), y = std::min(std::max(ly + i / L % L, 0), n - 1);
+                    int z = std::min(std::max(lz + i / (L * L), 0), n - 1);
+                    smoke = sim.tiles.fetch(sim.density, x, y, z) > eps || sim.tiles.fetch(sim.temperature, x, y, z) > eps;
+                }
+                if (smoke) live.push_back(b);
+            }
+        }
+        std::sort(live.begin(), live.end());
+        cleared.clear();
+        for (int b = 0; b < T * T * T; ++b)
+            if (shown[b] && !std::binary_search(live.begin(), live.end(), b)) { shown[b] = 0; cleared.push_back(b); }
+        dirty.clear();
+        if (live.empty()) return;
+        size_t budget = all ? live.size() : (live.size() + params.refreshFrames - 1) / params.refreshFrames;
+        for (size_t k = 0; k < budget; ++k) {
+            int b = live[(cursor + k) % live.size()];
+            dirty.push_back(b);
+            shown[b] = 1;
+        }
+        cursor = (cursor + budget) % live.size();
+    }
+
+    // (density, temperature) pairs of each dirty brick, x fastest, B3 * 2 halves apiece
+    void synthesize(const FluidSim& sim, Half* out) const {
+        jobs().parallelFor(0, int(dirty.size()), [&](int d0, int d1) {
+            DenormalGuard ftz;
+            for (int d = d0; d < d1; ++d) synthesizeBrick(sim, dirty[d], out + size_t(d) * TileMap::B3 * 2);
+        });
+    }
+
+    void synthesizeBrick(const FluidSim& sim, int b, Half* out) const {
+        const int a = params.amplify, L = footprint();
+        float local[9][6 * 6 * 6];   // density, temperature, amp, two coordinate sets; L <= 6
+        int lx, ly, lz;
+        footprintOrigin(b, lx, ly, lz);
+        for (int i = 0; i < L * L * L; ++i) {
+            int x = std::min(std::max(lx + i % L, 0), n - 1), y = std::min(std::max(ly + i / L % L, 0), n - 1);
+            int z = std::min(std::max(lz + i / (L * L), 0), n - 1);
+            size_t c = (size_t(z) * n + y) * n + x;
+            local[0][i] = sim.tiles.fetch(sim.density, x, y, z);
+            local[1][i] = sim.tiles.fetch(sim.temperature, x, y, z);
+            local[2][i] = amp[c];
+            for (int k = 0; k < 6; ++k) local[3 + k][i] = coords[k][c];
+        }
+        // per axis: footprint cell and weight of each output cell (coarse cell centres at k + 0.5)
+        int ox, oy, oz;
+        brickOrigin(b, ox, oy, oz);
+        int i0[3][B];
+        float f0[3][B];
+        const int org[3] = { ox, oy, oz }, lorg[3] = { lx, ly, lz };
+        for (int ax = 0; ax < 3; ++ax)
+            for (int k = 0; k < B; ++k) {
+                float c = std::min(std::max((org[ax] + k + 0.5f) / a - 0.5f, 0.0f), float(n - 1)) - lorg[ax];
+                i0[ax][k] = std::min(int(c), L - 2);
+                f0[ax][k] = c - i0[ax][k];
+            }
+        const float norm = 1.0f / std::sqrt(weight[0] * weight[0] + weight[1] * weight[1]);
+        const float eps = sim.params.activeThreshold;
+        for (int z = 0; z < B; ++z)
+            for (int y = 0; y < B; ++y) {
+                float v[9][B];   // one row of interpolated fields
+                for (int x = 0; x < B; ++x) {
+                    int o = (i0[2][z] * L + i0[1][y]) * L + i0[0][x];
+                    float fx = f0[0][x], fy = f0[1][y], fz = f0[2][z];
+                    for (int k = 0; k < 9; ++k) {
+                        const float* c = local[k] + o;
+                        float p = lerp(lerp(c[0], c[1], fx), lerp(c[L], c[L + 1], fx), fy);
+                        float q = lerp(lerp(c[L * L], c[L * L + 1], fx), lerp(c[L * L + L], c[L * L + L + 1], fx), fy);
+                        v[k][x] = lerp(p, q, fz);
+                    }
+                }
+                float detail[B] = {};
+                for (int x = 0; x < B; x += 4) {
+                    bool visible = false;   // nothing to see below the threshold
+                    for (int k = x; k < x + 4; ++k) visible = visible || v[0][k] > eps || v[1][k] > eps;
+                    if (!visible) continue;
+                    for (int set = 0; set < 2; ++set) {
+                        if (weight[set] <= 1e-3f) continue;
+                        const float* c = v[3 + 3 * set];
+#ifdef FIRE_SSE2
+                        __m128 d = bands4(_mm_loadu_ps(c + x), _mm_loadu_ps(c + B + x), _mm_loadu_ps(c + 2 * B + x));
+                        _mm_storeu_ps(detail + x, _mm_add_ps(_mm_loadu_ps(detail + x), _mm_mul_ps(_mm_set1_ps(weight[set]), d)));
+#else
+                        for (int k = x; k < x + 4; ++k) detail[k] += weight[set] * bands(c[k], c[B + k], c[2 * B + k]);
+#endif
+                    }
+                }
+                float row[2 * B];
+                for (int x = 0; x < B; ++x) {
+                    float gain = std::max(0.0f, 1.0f + v[2][x] * detail[x] * norm);
+                    row[2 * x] = v[0][x] * gain;
+                    row[2 * x + 1] = v[1][x] * gain;
+                }
+                floatToHalf(row, out + 2 * (z * B + y) * B, 2 * B);
+            }
+    }
+
+    // zero-mean noise octaves from one lattice cell per coarse cell down to two output cells
+    float bands(float x, float y, float z) const {
+        float sum = 0.0f, amplitude = 1.0f;
+        for (int s = 1; 2 * s <= params.amplify; s *= 2) {
+            float o = 19.7f * s;   // decorrelate the octaves
+            sum += amplitude * 4.0f * (perlin.noise(x * s + o, y * s + o, z * s + o) - 0.5f);
+            amplitude *= 0.5612f;  // 2^(-5/6)
+        }
+        return sum;
+    }
+
+#ifdef FIRE_SSE2
+    __m128 bands4(__m128 x, __m128 y, __m128 z) const {
+        __m128 sum = _mm_setzero_ps();
+        float amplitude = 1.0f;
+        for (int s = 1; 2 * s <= params.amplify; s *= 2) {
+            const __m128 scale = _mm_set1_ps(float(s)), o = _mm_set1_ps(19.7f * s);
+            __m128 nz = perlin.noise4(_mm_add_ps(_mm_mul_ps(x, scale), o), _mm_add_ps(_mm_mul_ps(y, scale), o),
+                                      _mm_add_ps(_mm_mul_ps(z, scale), o));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(4.0f * amplitude), _mm_sub_ps(nz, _mm_set1_ps(0.5f))));
+            amplitude *= 0.5612f;
+        }
+        return sum;
+    }
+#endif
+};
@@ -0,0 +1,273 @@
+﻿// Upload.h — dirty-brick tracking and coalesced upload plans for the field texture (no GL)
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+#include "Tiles.h"
+#include "Fluid.h"
+#include "Turbulence.h"
+#include "Vortex.h"
+#include "Lbm.h"
+
+// Mirrors which contents each 8^3 brick of an RG16F volume texture holds,
+// as a 64-bit hash per brick. Each frame the producer offers bricks (freshly
+// packed, or null for a cleared one); offer() stages only those whose bits
+// differ from what the texture already has. plan() takes the longest-waiting
+// staged bricks up to the byte budget and merges them into boxes, greedily:
+// a run along x, grown in y while every row below is staged too, then in z.
+// Each box is one glTexSubImage3D; write() lays their texels out back to
+// back in texture order. Bricks over the budget stay staged and go first
+// next frame.
+struct BrickUploader {
+    static const int B = TileMap::B, BrickHalves = TileMap::B3 * 2;
+    static const size_t BrickBytes = BrickHalves * sizeof(Half);
+
+    struct Region { int x, y, z, w, h, d; size_t offset; };   // in bricks; byte offset into the staging copy
+
+    int T = 0;                          // bricks per axis
+    size_t budget = 0;                  // bytes per frame, 0 = no limit
+    std::vector<Region> regions;        // this frame's plan
+
+    // bricks of the last plan(), and the ones offered before it that the
+    // texture already had; running totals since construction
+    size_t planned = 0, deferred = 0, unchanged = 0;
+    size_t totalBytes = 0, totalCalls = 0;
+    int frames = 0;
+
+    explicit BrickUploader(int bricks = 0, size_t bytesPerFrame = 0) : T(bricks), budget(bytesPerFrame) {
+        const size_t count = size_t(T) * T * T;
+        shown.assign(count, zeroHash());
+        staged.assign(count, -1);
+        since.assign(count, 0);
+        mark.assign(count, 0);
+        // a brick is staged once at most, so none of these outgrow the
+        // count and a frame never reallocates them (the pool's pages are
+        // only touched as slots come into use)
+        waiting.reserve(count);
+        chosen.reserve(count);
+        freeSlots.reserve(count);
+        regions.reserve(count);
+        pool.reserve(count * BrickHalves);
+        stagedHash.reserve(count);
+    }
+
+    static uint64_t hashBrick(const Half* data) {
+        uint64_t h = 0x84222325CBF29CE4ull;
+        for (int i = 0; i < BrickHalves; i += 4) {
+            uint64_t w;
+            std::memcpy(&w, data + i, 8);
+            h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+            h ^= h >> 29;
+        }
+        return h;
+    }
+    static uint64_t zeroHash() {
+        static const uint64_t h = [] { std::vector<Half> z(BrickHalves, 0); return hashBrick(z.data()); }();
+        return h;
+    }
+
+    // brick b should show `data` (BrickHalves values, x fastest; null = zero)
+    // with hash h; not thread-safe, hash in parallel beforehand
+    void offer(int b, const Half* data, uint64_t h) {
+        if (h == shown[b]) {                 // back to what is on screen: drop a stale copy
+            if (staged[b] >= 0) unstage(b);
+            ++matched;
+            return;
+        }
+        if (staged[b] < 0) {
+            if (freeSlots.empty()) {
+                freeSlots.push_back(int(slots++));
+                pool.resize(slots * BrickHalves);
+                stagedHash.resize(slots);
+            }
+            staged[b] = freeSlots.back();
+            freeSlots.pop_back();
+            since[b] = frames;
+            waiting.push_back(b);
+        }
+        Half* dst = &pool[size_t(staged[b]) * BrickHalves];
+        if (data) std::memcpy(dst, data, BrickBytes);
+        else std::fill(dst, dst + BrickHalves, Half(0));
+        stagedHash[staged[b]] = h;
+    }
+    void offer(int b, const Half* data) { offer(b, data, data ? hashBrick(data) : zeroHash()); }
+
+    // offers a cleared brick for everything outside `keep` (ascending) that
+    // is not already clear
+    void clearExcept(const std::vector<int>& keep) {
+        size_t k = 0;
+        for (int b = 0; b < T * T * T; ++b) {
+            while (k < keep.size() && keep[k] < b) ++k;
+            if (k < keep.size() && keep[k] == b) continue;
+            if (shown[b] != zeroHash() || staged[b] >= 0) offer(b, nullptr, zeroHash());
+        }
+    }
+
+    // picks this frame's bricks and boxes; bytes() of texels follow
+    void plan() {
+        regions.clear();
+        ++frames;
+        // oldest first, ties by brick: std::sort needs no buffer where stable_sort would allocate one
+        std::sort(waiting.begin(), waiting.end(), [&](int a, int b) { return since[a] != since[b] ? since[a] < since[b] : a < b; });
+        size_t take = waiting.size();
+        if (budget) take = std::min(take, std::max<size_t>(1, budget / BrickBytes));
+        chosen.assign(waiting.begin(), waiting.begin() + take);
+        waiting.erase(waiting.begin(), waiting.begin() + take);
+        std::sort(chosen.begin(), chosen.end());
+        for (int b : chosen) mark[b] = 1;
+        size_t offset = 0;
+        auto at = [&](int x, int y, int z) { return (z * T + y) * T + x; };
+        for (int b : chosen) {
+            if (!mark[b]) continue;          // inside an earlier box
+            Region r = { b % T, b / T % T, b / (T * T), 1, 1, 1, offset };
+            while (r.x + r.w < T && mark[at(r.x + r.w, r.y, r.z)]) ++r.w;
+            auto full = [&](int y, int z) {
+                for (int x = r.x; x < r.x + r.w; ++x) if (!mark[at(x, y, z)]) return false;
+                return true;
+            };
+            while (r.y + r.h < T && full(r.y + r.h, r.z)) ++r.h;
+            auto slab = [&](int z) {
+                for (int y = r.y; y < r.y + r.h; ++y) if (!full(y, z)) return false;
+                return true;
+            };
+            while (r.z + r.d < T && slab(r.z + r.d)) ++r.d;
+            for (int z = r.z; z < r.z + r.d; ++z)
+                for (int y = r.y; y < r.y + r.h; ++y)
+                    for (int x = r.x; x < r.x + r.w; ++x) mark[at(x, y, z)] = 0;
+            offset += size_t(r.w) * r.h * r.d * BrickBytes;
+            regions.push_back(r);
+        }
+        planned = chosen.size();
+        deferred = waiting.size();
+        unchanged = matched;
+        matched = 0;
+        totalBytes += bytes();
+        totalCalls += regions.size();
+    }
+
+    size_t bytes() const { return planned * BrickBytes; }
+
+    // the planned texels, region after region, each x fastest; the bricks
+    // then count as shown
+    void write(void* dst) {
+        Half* out = static_cast<Half*>(dst);
+        for (const Region& r : regions) {
+            Half* o = out + r.offset / sizeof(Half);
+            for (int z = 0; z < r.d * B; ++z)
+                for (int y = 0; y < r.h * B; ++y)
+                    for (int x = 0; x < r.w; ++x) {
+                        int b = ((r.z + z / B) * T + r.y + y / B) * T + r.x + x;
+                        const Half* src = &pool[size_t(staged[b]) * BrickHalves + ((z % B) * B + y % B) * B * 2];
+                        std::memcpy(o, src, B * 2 * sizeof(Half));
+                        o += B * 2;
+                    }
+        }
+        for (int b : chosen) {
+            shown[b] = stagedHash[staged[b]];
+            freeSlots.push_back(staged[b]);
+            staged[b] = -1;
+        }
+        chosen.clear();
+    }
+
+private:
+    std::vector<uint64_t> shown;        // per brick: hash of the texture's contents
+    std::vector<int> staged;            // per brick: pool slot of the contents to upload, -1 none
+    std::vector<int> since;             // per brick: frame it was first staged
+    std::vector<unsigned char> mark;    // scratch for plan()
+    std::vector<int> waiting, chosen, freeSlots;
+    std::vector<Half> pool;             // staged bricks
+    std::vector<uint64_t> stagedHash;   // per pool slot
+    size_t slots = 0, matched = 0;
+
+    void unstage(int b) {
+        freeSlots.push_back(staged[b]);
+        staged[b] = -1;
+        waiting.erase(std::find(waiting.begin(), waiting.end(), b));
+    }
+};
+
+// One simulation frame as texture bricks: the packed ones, and every brick
+// that may show smoke. Whatever the texture holds outside `keep` is cleared,
+// so a consumer that skips frames still ends up with the right bricks.
+struct FieldFrame {
+    std::vector<int> bricks;            // texture brick per packed brick
+    std::vector<Half> data;             // BrickHalves per packed brick
+    std::vector<uint64_t> hashes;
+    std::vector<int> keep;              // ascending
+    uint64_t serial = 0;                // simulation steps so far
+};
+
+// every allocated tile of the simulation
+static void packFieldFrame(FluidSim& sim, FieldFrame& out) {
+    const int brick = BrickUploader::BrickHalves;
+    const std::vector<int>& active = sim.tiles.active;
+    out.bricks = active;
+    out.keep = active;
+    out.data.resize(active.size() * brick);
+    out.hashes.resize(active.size());
+    jobs().parallelFor(0, int(active.size()), [&](int lo, int hi) {
+        for (int a = lo; a < hi; ++a) {
+            sim.packTileRG(active[a], &out.data[size_t(a) * brick]);
+            out.hashes[a] = BrickUploader::hashBrick(&out.data[size_t(a) * brick]);
+        }
+    });
+    sim.tiles.released.clear();   // `keep` covers them
+}
+
+// this frame's share of the detail bricks (Turbulence.h), or every live one
+// with `all`; the rest of the live ones keep what they show
+static void packDetailFrame(FluidSim& sim, FluidDetail& detail, FieldFrame& out, bool all = false) {
+    const int brick = BrickUploader::BrickHalves;
+    detail.select(sim, all);
+    out.bricks = detail.dirty;
+    out.keep = detail.live;
+    out.data.resize(detail.dirty.size() * brick);
+    out.hashes.resize(detail.dirty.size());
+    detail.synthesize(sim, out.data.data());
+    jobs().parallelFor(0, int(detail.dirty.size()), [&](int lo, int hi) {
+        for (int d = lo; d < hi; ++d) out.hashes[d] = BrickUploader::hashBrick(&out.data[size_t(d) * brick]);
+    });
+    sim.tiles.released.clear();   // the simulation's own tiles are not shown
+}
+
+// every brick the vortex smoke was splatted into
+static void packVortexFrame(const VortexSim& sim, FieldFrame& out) {
+    const int brick = BrickUploader::BrickHalves;
+    out.bricks = sim.bricks;
+    out.keep = sim.bricks;
+    out.data.resize(sim.bricks.size() * brick);
+    out.hashes.resize(sim.bricks.size());
+    jobs().parallelFor(0, int(sim.bricks.size()), [&](int lo, int hi) {
+        for (int k = lo; k < hi; ++k) {
+            sim.packBrickRG(sim.bricks[k], &out.data[size_t(k) * brick]);
+            out.hashes[k] = BrickUploader::hashBrick(&out.data[size_t(k) * brick]);
+        }
+    });
+}
+
+// every brick of the lattice-Boltzmann smoke that holds smoke or heat
+static void packLbmFrame(const LbmSim& sim, FieldFrame& out) {
+    const int brick = BrickUploader::BrickHalves;
+    sim.smokeBricks(out.bricks);
+    out.keep = out.bricks;
+    out.data.resize(out.bricks.size() * brick);
+    out.hashes.resize(out.bricks.size());
+    jobs().parallelFor(0, int(out.bricks.size()), [&](int lo, int hi) {
+        for (int k = lo; k < hi; ++k) {
+            sim.packBrickRG(out.bricks[k], &out.data[size_t(k) * brick]);
+            out.hashes[k] = BrickUploader::hashBrick(&out.data[size_t(k) * brick]);
+        }
+    });
+}
+
+static void offerFrame(BrickUploader& up, const FieldFrame& frame) {
+    for (size_t k = 0; k < frame.bricks.size(); ++k)
+        up.offer(frame.bricks[k], &frame.data[k * BrickUploader::BrickHalves], frame.hashes[k]);
+    up.clearExcept(frame.keep);
+}
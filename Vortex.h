@@ -0,0 +1,618 @@
+﻿// Vortex.h — vortex-particle smoke: Biot–Savart velocities from a Barnes–Hut octree, splatted into a field
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "Jobs.h"
+#include "Simd.h"
+#include "Tiles.h"
+
+// ---------- Biot–Savart sums ----------
+// Sources with vector strength a_j (vorticity times volume) at x_j induce
+//   u(x) = 1/(4 pi) sum_j a_j x r / (|r|^2 + s^2)^(3/2),   r = x - x_j
+// with core radius s (the regularised kernel of Cottet & Koumoutsakos,
+// "Vortex Methods", 2000). A target that is itself a vortex with strength
+// a also gets the stretching term (a . grad) u, which tilts and stretches
+// it with the flow:
+//   (a . grad) u = 1/(4 pi) sum_j K_j (a_j x a - 3 (a . r) / (|r|^2 + s^2) a_j x r)
+
+// a source list, structure of arrays; sums take four at a time, so pad()
+// before summing
+struct VortexSources {
+    std::vector<float> x, y, z, ax, ay, az;
+
+    int size() const { return int(x.size()); }
+    void clear() { x.clear(); y.clear(); z.clear(); ax.clear(); ay.clear(); az.clear(); }
+    void push(float px, float py, float pz, float sx, float sy, float sz) {
+        x.push_back(px); y.push_back(py); z.push_back(pz);
+        ax.push_back(sx); ay.push_back(sy); az.push_back(sz);
+    }
+    // up to a multiple of 4 with sources of zero strength
+    void pad() { while (x.size() & 3) push(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f); }
+};
+
+// u (and with Stretch, st) at target t with strength ta, summed over all of s
+template<bool Stretch>
+static inline void biotSavart(const VortexSources& s, const float t[3], const float ta[3], float core2,
+                              float u[3], float st[3]) {
+    const float k = 0.0795774715f;     // 1/(4 pi)
+    const int n = s.size();
+#ifdef FIRE_SSE2
+    const __m128 tx = _mm_set1_ps(t[0]), ty = _mm_set1_ps(t[1]), tz = _mm_set1_ps(t[2]);
+    const __m128 bx = _mm_set1_ps(ta[0]), by = _mm_set1_ps(ta[1]), bz = _mm_set1_ps(ta[2]);
+    const __m128 c2 = _mm_set1_ps(core2), half = _mm_set1_ps(0.5f), threeHalf = _mm_set1_ps(1.5f);
+    __m128 ux = _mm_setzero_ps(), uy = ux, uz = ux, sx = ux, sy = ux, sz = ux;
+    for (int j = 0; j < n; j += 4) {
+        __m128 rx = _mm_sub_ps(tx, _mm_loadu_ps(&s.x[j]));
+        __m128 ry = _mm_sub_ps(ty, _mm_loadu_ps(&s.y[j]));
+        __m128 rz = _mm_sub_ps(tz, _mm_loadu_ps(&s.z[j]));
+        __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_add_ps(_mm_mul_ps(rz, rz), c2));
+        __m128 inv = _mm_rsqrt_ps(r2);     // one Newton step: ~23 bits
+        inv = _mm_mul_ps(inv, _mm_sub_ps(threeHalf, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+        __m128 inv2 = _mm_mul_ps(inv, inv), K = _mm_mul_ps(inv2, inv);
+        __m128 ax = _mm_loadu_ps(&s.ax[j]), ay = _mm_loadu_ps(&s.ay[j]), az = _mm_loadu_ps(&s.az[j]);
+        __m128 cx = _mm_sub_ps(_mm_mul_ps(ay, rz), _mm_mul_ps(az, ry));
+        __m128 cy = _mm_sub_ps(_mm_mul_ps(az, rx), _mm_mul_ps(ax, rz));
+        __m128 cz = _mm_sub_ps(_mm_mul_ps(ax, ry), _mm_mul_ps(ay, rx));
+        ux = _mm_add_ps(ux, _mm_mul_ps(cx, K));
+        uy = _mm_add_ps(uy, _mm_mul_ps(cy, K));
+        uz = _mm_add_ps(uz, _mm_mul_ps(cz, K));
+        if (Stretch) {
+            __m128 q = _mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(inv2,
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, rx), _mm_mul_ps(by, ry)), _mm_mul_ps(bz, rz))));
+            __m128 dx = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)), _mm_mul_ps(q, cx));
+            __m128 dy = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)), _mm_mul_ps(q, cy));
+            __m128 dz = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx)), _mm_mul_ps(q, cz));
+            sx = _mm_add_ps(sx, _mm_mul_ps(dx, K));
+            sy = _mm_add_ps(sy, _mm_mul_ps(dy, K));
+            sz = _mm_add_ps(sz, _mm_mul_ps(dz, K));
+        }
+    }
+    u[0] = k * hsum_ps(ux); u[1] = k * hsum_ps(uy); u[2] = k * hsum_ps(uz);
+    if (Stretch) { st[0] = k * hsum_ps(sx); st[1] = k * hsum_ps(sy); st[2] = k * hsum_ps(sz); }
+#else
+    float acc[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int j = 0; j < n; ++j) {
+        float rx = t[0] - s.x[j], ry = t[1] - s.y[j], rz = t[2] - s.z[j];
+        float r2 = rx * rx + ry * ry + rz * rz + core2;
+        float inv2 = 1.0f / r2, K = inv2 / std::sqrt(r2);
+        float ax = s.ax[j], ay = s.ay[j], az = s.az[j];
+        float cx = ay * rz - az * ry, cy = az * rx - ax * rz, cz = ax * ry - ay * rx;
+        acc[0] += cx * K; acc[1] += cy * K; acc[2] += cz * K;
+        if (Stretch) {
+            float q = 3.0f * inv2 * (ta[0] * rx + ta[1] * ry + ta[2] * rz);
+            acc[3] += K * (ay * ta[2] - az * ta[1] - q * cx);
+            acc[4] += K * (az * ta[0] - ax * ta[2] - q * cy);
+            acc[5] += K * (ax * ta[1] - ay * ta[0] - q * cz);
+        }
+    }
+    u[0] = k * acc[0]; u[1] = k * acc[1]; u[2] = k * acc[2];
+    if (Stretch) { st[0] = k * acc[3]; st[1] = k * acc[4]; st[2] = k * acc[5]; }
+#endif
+}
+
+// Cells of the tree stand for their sources by the total strength A at
+// the centre c plus the first moment M = sum_j a_j (x_j - c)^T, which
+// takes the error of the far field from O(edge / distance) to its square:
+//   u += K (3 (M r) x r / (|r|^2 + s^2) - w),   w = sum_j a_j x (x_j - c)
+// The stretching of a target uses A alone.
+struct VortexCells : VortexSources {
+    std::vector<float> m[9], w[3];      // M row major, w
+
+    void clear() {
+        VortexSources::clear();
+        for (std::vector<float>& v : m) v.clear();
+        for (std::vector<float>& v : w) v.clear();
+    }
+    void push(float px, float py, float pz, const float a[3], const float mm[9]) {
+        VortexSources::push(px, py, pz, a[0], a[1], a[2]);
+        for (int k = 0; k < 9; ++k) m[k].push_back(mm[k]);
+        w[0].push_back(mm[5] - mm[7]);
+        w[1].push_back(mm[6] - mm[2]);
+        w[2].push_back(mm[1] - mm[3]);
+    }
+    void pad() {
+        const float zero[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        while (x.size() & 3) push(0.0f, 0.0f, 0.0f, zero, zero);
+    }
+};
+
+// u (and with Stretch, st) at target t with strength ta from the cells in
+// c; the two velocity terms share one cross product, (A + 3 M r / (|r|^2 +
+// s^2)) x r - w
+template<bool Stretch>
+static inline void biotSavartCells(const VortexCells& c, const float t[3], const float ta[3], float core2,
+                                   float u[3], float st[3]) {
+    const float k = 0.0795774715f;
+    const int n = c.size();
+#ifdef FIRE_SSE2
+    const __m128 tx = _mm_set1_ps(t[0]), ty = _mm_set1_ps(t[1]), tz = _mm_set1_ps(t[2]);
+    const __m128 bx = _mm_set1_ps(ta[0]), by = _mm_set1_ps(ta[1]), bz = _mm_set1_ps(ta[2]);
+    const __m128 c2 = _mm_set1_ps(core2), half = _mm_set1_ps(0.5f), threeHalf = _mm_set1_ps(1.5f), three = _mm_set1_ps(3.0f);
+    __m128 ux = _mm_setzero_ps(), uy = ux, uz = ux, sx = ux, sy = ux, sz = ux;
+    for (int j = 0; j < n; j += 4) {
+        __m128 rx = _mm_sub_ps(tx, _mm_loadu_ps(&c.x[j]));
+        __m128 ry = _mm_sub_ps(ty, _mm_loadu_ps(&c.y[j]));
+        __m128 rz = _mm_sub_ps(tz, _mm_loadu_ps(&c.z[j]));
+        __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_add_ps(_mm_mul_ps(rz, rz), c2));
+        __m128 inv = _mm_rsqrt_ps(r2);
+        inv = _mm_mul_ps(inv, _mm_sub_ps(threeHalf, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+        __m128 inv2 = _mm_mul_ps(inv, inv), K = _mm_mul_ps(inv2, inv), q = _mm_mul_ps(three, inv2);
+        __m128 ax = _mm_loadu_ps(&c.ax[j]), ay = _mm_loadu_ps(&c.ay[j]), az = _mm_loadu_ps(&c.az[j]);
+        auto row = [&](int r, __m128 a) {
+            __m128 mr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&c.m[3 * r][j]), rx), _mm_mul_ps(_mm_loadu_ps(&c.m[3 * r + 1][j]), ry)),
+                                   _mm_mul_ps(_mm_loadu_ps(&c.m[3 * r + 2][j]), rz));
+            return _mm_add_ps(a, _mm_mul_ps(q, mr));
+        };
+        __m128 ex = row(0, ax), ey = row(1, ay), ez = row(2, az);
+        __m128 cx = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ey, rz), _mm_mul_ps(ez, ry)), _mm_loadu_ps(&c.w[0][j]));
+        __m128 cy = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ez, rx), _mm_mul_ps(ex, rz)), _mm_loadu_ps(&c.w[1][j]));
+        __m128 cz = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ex, ry), _mm_mul_ps(ey, rx)), _mm_loadu_ps(&c.w[2][j]));
+        ux = _mm_add_ps(ux, _mm_mul_ps(cx, K));
+        uy = _mm_add_ps(uy, _mm_mul_ps(cy, K));
+        uz = _mm_add_ps(uz, _mm_mul_ps(cz, K));
+        if (Stretch) {
+            __m128 ar = _mm_mul_ps(q, _mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, rx), _mm_mul_ps(by, ry)), _mm_mul_ps(bz, rz)));
+            __m128 dx = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)), _mm_mul_ps(ar, _mm_sub_ps(_mm_mul_ps(ay, rz), _mm_mul_ps(az, ry))));
+            __m128 dy = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)), _mm_mul_ps(ar, _mm_sub_ps(_mm_mul_ps(az, rx), _mm_mul_ps(ax, rz))));
+            __m128 dz = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx)), _mm_mul_ps(ar, _mm_sub_ps(_mm_mul_ps(ax, ry), _mm_mul_ps(ay, rx))));
+            sx = _mm_add_ps(sx, _mm_mul_ps(dx, K));
+            sy = _mm_add_ps(sy, _mm_mul_ps(dy, K));
+            sz = _mm_add_ps(sz, _mm_mul_ps(dz, K));
+        }
+    }
+    u[0] = k * hsum_ps(ux); u[1] = k * hsum_ps(uy); u[2] = k * hsum_ps(uz);
+    if (Stretch) { st[0] = k * hsum_ps(sx); st[1] = k * hsum_ps(sy); st[2] = k * hsum_ps(sz); }
+#else
+    float acc[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int j = 0; j < n; ++j) {
+        float r[3] = { t[0] - c.x[j], t[1] - c.y[j], t[2] - c.z[j] };
+        float r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + core2;
+        float inv2 = 1.0f / r2, K = inv2 / std::sqrt(r2), q = 3.0f * inv2;
+        float a[3] = { c.ax[j], c.ay[j], c.az[j] }, e[3];
+        for (int i = 0; i < 3; ++i) e[i] = a[i] + q * (c.m[3 * i][j] * r[0] + c.m[3 * i + 1][j] * r[1] + c.m[3 * i + 2][j] * r[2]);
+        acc[0] += K * (e[1] * r[2] - e[2] * r[1] - c.w[0][j]);
+        acc[1] += K * (e[2] * r[0] - e[0] * r[2] - c.w[1][j]);
+        acc[2] += K * (e[0] * r[1] - e[1] * r[0] - c.w[2][j]);
+        if (Stretch) {
+            float ar = q * (ta[0] * r[0] + ta[1] * r[1] + ta[2] * r[2]);
+            acc[3] += K * (a[1] * ta[2] - a[2] * ta[1] - ar * (a[1] * r[2] - a[2] * r[1]));
+            acc[4] += K * (a[2] * ta[0] - a[0] * ta[2] - ar * (a[2] * r[0] - a[0] * r[2]));
+            acc[5] += K * (a[0] * ta[1] - a[1] * ta[0] - ar * (a[0] * r[1] - a[1] * r[0]));
+        }
+    }
+    u[0] = k * acc[0]; u[1] = k * acc[1]; u[2] = k * acc[2];
+    if (Stretch) { st[0] = k * acc[3]; st[1] = k * acc[4]; st[2] = k * acc[5]; }
+#endif
+}
+
+// The O(n^2) reference: velocities at n targets from every source in s
+// (padded), one target per lane-set pass over the whole list.
+static void directVelocity(const VortexSources& s, const float* const t[3], int n, float core, float* const u[3]) {
+    const float zero[3] = { 0, 0, 0 };
+    jobs().parallelFor(0, n, [&](int lo, int hi) {
+        for (int i = lo; i < hi; ++i) {
+            float p[3] = { t[0][i], t[1][i], t[2][i] }, v[3];
+            biotSavart<false>(s, p, zero, core * core, v, nullptr);
+            u[0][i] = v[0]; u[1][i] = v[1]; u[2][i] = v[2];
+        }
+    }, 16);
+}
+
+// ---------- Barnes–Hut octree ----------
+// Barnes & Hut, "A hierarchical O(N log N) force-calculation algorithm",
+// Nature 324, 1986. The sources are sorted by a 30-bit Morton code in
+// their bounding cube, so every node is a contiguous range and its children
+// are found by scanning the next three bits. A node keeps its total
+// strength and first moment at the centroid of its sources; seen from the
+// targets under an angle (edge / distance) below theta it counts as that
+// one cell, otherwise it is opened, and a leaf adds its sources one by one. Targets are sorted by
+// the same code and walked in runs of up to GroupSize that share one
+// interaction list, measured from the run's bounding box: the walk is paid
+// per run, and the list is summed four sources at a time for each target.
+struct VortexTree {
+    static const int Levels = 10, LeafSize = 16, GroupSize = 32;
+
+    struct Node {
+        float px, py, pz, edge;     // centroid of the sources, cube edge
+        float a[3], m[9];           // total strength, first moment about the centroid
+        int first, count;           // sources, in sorted order
+        int child, children;        // contiguous; child < 0 for a leaf
+    };
+
+    std::vector<Node> nodes;
+    VortexSources sorted;           // the sources in Morton order (unpadded)
+    float lo[3] = { 0, 0, 0 }, edge = 1.0f;
+
+    void build(const float* const p[3], const float* const a[3], int n) {
+        nodes.clear();
+        sorted.clear();
+        if (n <= 0) return;
+        float hi[3];
+        for (int c = 0; c < 3; ++c) {
+            auto mm = std::minmax_element(p[c], p[c] + n);
+            lo[c] = *mm.first;
+            hi[c] = *mm.second;
+        }
+        edge = std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]) * 1.0001f + 1e-6f;
+        order.resize(n);
+        for (int i = 0; i < n; ++i) order[i] = uint64_t(key(p[0][i], p[1][i], p[2][i])) << 32 | uint32_t(i);
+        std::sort(order.begin(), order.end());
+        keys.resize(n);
+        for (int i = 0; i < n; ++i) {
+            int j = int(order[i] & 0xFFFFFFFFu);
+            keys[i] = uint32_t(order[i] >> 32);
+            sorted.push(p[0][j], p[1][j], p[2][j], a[0][j], a[1][j], a[2][j]);
+        }
+        Node root = {};
+        root.edge = edge;
+        root.count = n;
+        nodes.push_back(root);
+        split(0, 0);
+    }
+
+    // Velocities at n targets into u, and if ta is given the stretching
+    // (ta . grad) u into st. Returns the source-target pairs summed.
+    long long evaluate(const float* const t[3], int n, float core, float theta, float* const u[3],
+                       const float* const ta[3] = nullptr, float* const st[3] = nullptr) {
+        if (n <= 0) return 0;
+        if (nodes.empty()) {
+            for (int c = 0; c < 3; ++c) {
+                std::fill(u[c], u[c] + n, 0.0f);
+                if (ta) std::fill(st[c], st[c] + n, 0.0f);
+            }
+            return 0;
+        }
+        targetOrder.resize(n);
+        for (int i = 0; i < n; ++i) targetOrder[i] = uint64_t(key(t[0][i], t[1][i], t[2][i])) << 32 | uint32_t(i);
+        std::sort(targetOrder.begin(), targetOrder.end());
+        const int groups = (n + GroupSize - 1) / GroupSize;
+        const float theta2 = theta * theta, core2 = core * core;
+        std::atomic<long long> pairs{ 0 };
+        jobs().parallelFor(0, groups, [&](int glo, int ghi) {
+            VortexSources list;
+            VortexCells cells;
+            std::vector<int> stack;
+            long long counted = 0;
+            for (int g = glo; g < ghi; ++g) {
+                const int begin = g * GroupSize, end = std::min(n, begin + GroupSize);
+                float bmin[3] = { 1e30f, 1e30f, 1e30f }, bmax[3] = { -1e30f, -1e30f, -1e30f };
+                for (int k = begin; k < end; ++k) {
+                    int i = int(targetOrder[k] & 0xFFFFFFFFu);
+                    for (int c = 0; c < 3; ++c) { bmin[c] = std::min(bmin[c], t[c][i]); bmax[c] = std::max(bmax[c], t[c][i]); }
+                }
+                list.clear();
+                cells.clear();
+                stack.assign(1, 0);
+                while (!stack.empty()) {
+                    const Node& nd = nodes[stack.back()];
+                    stack.pop_back();
+                    const float pc[3] = { nd.px, nd.py, nd.pz };
+                    float d2 = 0.0f;
+                    for (int c = 0; c < 3; ++c) {
+                        float d = std::max(0.0f, std::max(bmin[c] - pc[c], pc[c] - bmax[c]));
+                        d2 += d * d;
+                    }
+                    if (nd.edge * nd.edge < theta2 * d2) cells.push(nd.px, nd.py, nd.pz, nd.a, nd.m);
+                    else if (nd.child < 0)
+                        for (int j = nd.first; j < nd.first + nd.count; ++j)
+                            list.push(sorted.x[j], sorted.y[j], sorted.z[j], sorted.ax[j], sorted.ay[j], sorted.az[j]);
+                    else
+                        for (int c = 0; c < nd.children; ++c) stack.push_back(nd.child + c);
+                }
+                list.pad();
+                cells.pad();
+                counted += (long long)(list.size() + cells.size()) * (end - begin);
+                for (int k = begin; k < end; ++k) {
+                    int i = int(targetOrder[k] & 0xFFFFFFFFu);
+                    float p[3] = { t[0][i], t[1][i], t[2][i] }, v[3], vc[3], s[3], sc[3];
+                    if (ta) {
+                        float a[3] = { ta[0][i], ta[1][i], ta[2][i] };
+                        biotSavart<true>(list, p, a, core2, v, s);
+                        biotSavartCells<true>(cells, p, a, core2, vc, sc);
+                        st[0][i] = s[0] + sc[0]; st[1][i] = s[1] + sc[1]; st[2][i] = s[2] + sc[2];
+                    } else {
+                        biotSavart<false>(list, p, p, core2, v, nullptr);
+                        biotSavartCells<false>(cells, p, p, core2, vc, nullptr);
+                    }
+                    u[0][i] = v[0] + vc[0]; u[1][i] = v[1] + vc[1]; u[2][i] = v[2] + vc[2];
+                }
+            }
+            pairs += counted;
+        });
+        return pairs;
+    }
+
+private:
+    std::vector<uint64_t> order, targetOrder;   // Morton code << 32 | index
+    std::vector<uint32_t> keys;                 // sorted source codes
+
+    static uint32_t spread(uint32_t v) {        // 10 bits to every third of 30
+        v &= 0x3FF;
+        v = (v | (v << 16)) & 0x030000FFu;
+        v = (v | (v << 8)) & 0x0300F00Fu;
+        v = (v | (v << 4)) & 0x030C30C3u;
+        v = (v | (v << 2)) & 0x09249249u;
+        return v;
+    }
+    uint32_t key(float x, float y, float z) const {
+        const float s = float(1 << Levels) / edge;
+        auto cell = [&](float v, int c) { return uint32_t(std::min(std::max((v - lo[c]) * s, 0.0f), float((1 << Levels) - 1))); };
+        return spread(cell(x, 0)) | spread(cell(y, 1)) << 1 | spread(cell(z, 2)) << 2;
+    }
+
+    // children of node id (at `level`) down to the leaves, then its moments
+    void split(int id, int level) {
+        const int first = nodes[id].first, end = first + nodes[id].count;
+        if (end - first <= LeafSize || level == Levels) {
+            Node& nd = nodes[id];
+            nd.child = -1;
+            double c[3] = { 0, 0, 0 };
+            for (int j = first; j < end; ++j) { c[0] += sorted.x[j]; c[1] += sorted.y[j]; c[2] += sorted.z[j]; }
+            for (double& v : c) v /= end - first;
+            double a[3] = { 0, 0, 0 }, m[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+            for (int j = first; j < end; ++j) {
+                const double aj[3] = { sorted.ax[j], sorted.ay[j], sorted.az[j] };
+                const double d[3] = { sorted.x[j] - c[0], sorted.y[j] - c[1], sorted.z[j] - c[2] };
+                for (int r = 0; r < 3; ++r) {
+                    a[r] += aj[r];
+                    for (int k = 0; k < 3; ++k) m[3 * r + k] += aj[r] * d[k];
+                }
+            }
+            setMoments(nd, c, a, m);
+            return;
+        }
+        const int shift = 3 * (Levels - 1 - level);
+        const int child = int(nodes.size());
+        int children = 0;
+        for (int j = first; j < end;) {
+            const uint32_t oct = keys[j] >> shift & 7;
+            int k = j;
+            while (k < end && (keys[k] >> shift & 7) == oct) ++k;
+            Node c = {};
+            c.edge = nodes[id].edge * 0.5f;
+            c.first = j;
+            c.count = k - j;
+            nodes.push_back(c);
+            ++children;
+            j = k;
+        }
+        nodes[id].child = child;
+        nodes[id].children = children;
+        double c[3] = { 0, 0, 0 };
+        for (int k = 0; k < children; ++k) {
+            split(child + k, level + 1);
+            const Node& cn = nodes[child + k];
+            c[0] += double(cn.count) * cn.px; c[1] += double(cn.count) * cn.py; c[2] += double(cn.count) * cn.pz;
+        }
+        for (double& v : c) v /= end - first;
+        // children's moments shifted to the new centre: M += A (c_child - c)^T
+        double a[3] = { 0, 0, 0 }, m[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        for (int k = 0; k < children; ++k) {
+            const Node& cn = nodes[child + k];
+            const double d[3] = { cn.px - c[0], cn.py - c[1], cn.pz - c[2] };
+            for (int r = 0; r < 3; ++r) {
+                a[r] += cn.a[r];
+                for (int q = 0; q < 3; ++q) m[3 * r + q] += cn.m[3 * r + q] + double(cn.a[r]) * d[q];
+            }
+        }
+        setMoments(nodes[id], c, a, m);
+    }
+    static void setMoments(Node& nd, const double c[3], const double a[3], const double m[9]) {
+        nd.px = float(c[0]); nd.py = float(c[1]); nd.pz = float(c[2]);
+        for (int k = 0; k < 3; ++k) nd.a[k] = float(a[k]);
+        for (int k = 0; k < 9; ++k) nd.m[k] = float(m[k]);
+    }
+};
+
+// ---------- the smoke ----------
+struct VortexParams {
+    float emitX = 0.5f, emitY = 0.06f, emitZ = 0.5f;   // same source as FluidParams
+    float emitRadius = 0.09f;
+    float emitSpeed = 0.5f;        // jet speed the shed vortex sheet carries, domain units per second
+    int ringParticles = 24;        // vortex particles shed around the rim per step
+    int tracersPerStep = 400;      // smoke markers released inside the source per step
+    float jitter = 0.3f;           // random share of the shed strength, breaks the rings up
+    float core = 0.025f;           // Biot–Savart core radius, domain units
+    float theta = 0.6f;            // Barnes–Hut opening angle (0: exact sum)
+    float buoyancy = 0.25f;        // upward drift per unit temperature, domain units per second
+    float cooling = 1.2f;          // temperature decay rate, 1/s
+    float dissipation = 0.12f;     // density decay rate, 1/s
+    float maxStretch = 4.0f;       // cap on |a| relative to the shed strength
+    int maxVortices = 4096, maxTracers = 32768;    // the oldest go first
+};
+
+// wall-clock per phase, accumulated until reset
+struct VortexTimings {
+    double tree = 0.0, velocity = 0.0, splat = 0.0;
+    long long pairs = 0;
+    int steps = 0;
+    double total() const { return tree + velocity + splat; }
+};
+
+// A plume of Lagrangian vortex particles in the unit cube. Each step the
+// source sheds a ring of vortex particles around its rim, the vortex sheet
+// of a jet of emitSpeed, and releases smoke markers inside it. Everything
+// moves with the velocity the vortices induce (the octree above) plus a
+// buoyant drift, the vortices also stretch. Nothing is stored on a grid:
+// the markers are splatted (trilinear) into an N^3 (density, temperature)
+// field each step, kept brick by brick in the layout of the field texture,
+// so only bricks that hold smoke are cleared, packed and uploaded.
+// Particles that leave the cube or fade out are dropped.
+struct VortexSim {
+    int N = 0;
+    VortexParams params;
+    VortexTimings timings;
+    VortexSources vortices;                     // unpadded
+    std::vector<float> vtemp;                   // per vortex
+    std::vector<float> mx, my, mz, mdens, mtemp;   // smoke markers
+    std::vector<float> field;                   // per brick B3 (density, temperature) pairs, x fastest
+    std::vector<int> bricks;                    // bricks with smoke, ascending
+    VortexTree tree;
+    uint32_t frameSeed = 0;
+
+    explicit VortexSim(int n) : N((std::max(16, n) + 7) / 8 * 8) {
+        const int T = N / TileMap::B;
+        field.assign(size_t(T) * T * T * TileMap::B3 * 2, 0.0f);
+        touched.assign(size_t(T) * T * T, 0);
+    }
+
+    int vortexCount() const { return vortices.size(); }
+    int markerCount() const { return int(mx.size()); }
+
+    void step(float dt) {
+        FIRE_TRACE("vortex step", "sim");
+        auto t0 = std::chrono::steady_clock::now();
+        emit(dt);
+        const float* p[3] = { vortices.x.data(), vortices.y.data(), vortices.z.data() };
+        const float* a[3] = { vortices.ax.data(), vortices.ay.data(), vortices.az.data() };
+        tree.build(p, a, vortexCount());
+        auto t1 = std::chrono::steady_clock::now();
+        const int nv = vortexCount(), nm = markerCount();
+        for (std::vector<float>* v : { &vu[0], &vu[1], &vu[2], &stretch[0], &stretch[1], &stretch[2] }) v->resize(nv);
+        for (std::vector<float>& v : mu) v.resize(nm);
+        float* u[3] = { vu[0].data(), vu[1].data(), vu[2].data() };
+        float* st[3] = { stretch[0].data(), stretch[1].data(), stretch[2].data() };
+        timings.pairs += tree.evaluate(p, nv, params.core, params.theta, u, a, st);
+        const float* m[3] = { mx.data(), my.data(), mz.data() };
+        float* um[3] = { mu[0].data(), mu[1].data(), mu[2].data() };
+        timings.pairs += tree.evaluate(m, nm, params.core, params.theta, um);
+        auto t2 = std::chrono::steady_clock::now();
+        move(dt);
+        splat();
+        auto t3 = std::chrono::steady_clock::now();
+        timings.tree += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        timings.velocity += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        timings.splat += std::chrono::duration<double, std::milli>(t3 - t2).count();
+        ++timings.steps;
+        ++frameSeed;
+    }
+
+    // (density, temperature) pairs of texture brick b, x fastest, for a GL_RG16F brick
+    void packBrickRG(int b, Half* out) const {
+        floatToHalf(&field[size_t(b) * TileMap::B3 * 2], out, TileMap::B3 * 2);
+    }
+
+private:
+    std::vector<float> vu[3], stretch[3], mu[3];   // per step, per vortex / marker
+    std::vector<unsigned char> touched;            // per brick, scratch for splat()
+    float shed = 0.0f;                             // |a| of a freshly shed vortex
+    float gain = 1.0f;                             // field density per marker at the source
+
+    // [0, 1) from stream `i` of this step
+    float random(uint32_t i) const { return float(hash32(i ^ frameSeed * 0x9E3779B9u) >> 8) * (1.0f / 16777216.0f); }
+
+    void emit(float dt) {
+        const VortexParams& P = params;
+        const float U = P.emitSpeed, r0 = P.emitRadius, len = U * dt;
+        const float twoPi = 6.28318531f;
+        // a sheet of strength U (the velocity jump across the jet's edge),
+        // rim length 2 pi r0 and length U dt per step, in K pieces
+        const int K = P.ringParticles;
+        shed = U * len * twoPi * r0 / K;
+        uint32_t s = 0;
+        const float turn = random(s++);
+        for (int k = 0; k < K; ++k) {
+            float phi = twoPi * (k + turn) / K;
+            float c = std::cos(phi), sn = std::sin(phi);
+            float mag = -shed * (1.0f + P.jitter * (2.0f * random(s++) - 1.0f));   // negative: the jet rises
+            float side[3] = { 2.0f * random(s++) - 1.0f, 2.0f * random(s++) - 1.0f, 2.0f * random(s++) - 1.0f };
+            float j = P.jitter * shed;
+            vortices.push(P.emitX + r0 * c, P.emitY + len * random(s++), P.emitZ + r0 * sn,
+                          -sn * mag + j * side[0], j * side[1], c * mag + j * side[2]);
+            vtemp.push_back(1.0f);
+        }
+        for (int k = 0; k < P.tracersPerStep; ++k) {
+            float phi = twoPi * random(s++), r = r0 * std::sqrt(random(s++));
+            mx.push_back(P.emitX + r * std::cos(phi));
+            my.push_back(P.emitY + len * random(s++));
+            mz.push_back(P.emitZ + r * std::sin(phi));
+            mdens.push_back(1.0f);
+            mtemp.push_back(1.0f);
+        }
+        // markers per cell where they are released, so the source splats to about 1
+        gain = 3.14159265f * r0 * r0 * len * float(N) * N * N / std::max(1, P.tracersPerStep);
+    }
+
+    void move(float dt) {
+        const VortexParams& P = params;
+        const float keepD = std::exp(-P.dissipation * dt), keepT = std::exp(-P.cooling * dt);
+        const float cap2 = P.maxStretch * P.maxStretch * shed * shed;
+        auto outside = [](float x, float y, float z) {
+            return x < -0.1f || x > 1.1f || y < -0.1f || y > 1.1f || z < -0.1f || z > 1.1f;
+        };
+        // vortices
+        int kept = 0;
+        const int nv = vortexCount();
+        for (int i = 0; i < nv; ++i) {
+            float x = vortices.x[i] + dt * vu[0][i];
+            float y = vortices.y[i] + dt * (vu[1][i] + P.buoyancy * vtemp[i]);
+            float z = vortices.z[i] + dt * vu[2][i];
+            if (outside(x, y, z)) continue;
+            float a[3] = { vortices.ax[i] + dt * stretch[0][i], vortices.ay[i] + dt * stretch[1][i],
+                           vortices.az[i] + dt * stretch[2][i] };
+            float a2 = a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+            if (a2 > cap2) { float f = std::sqrt(cap2 / a2); a[0] *= f; a[1] *= f; a[2] *= f; }
+            vortices.x[kept] = x; vortices.y[kept] = y; vortices.z[kept] = z;
+            vortices.ax[kept] = a[0]; vortices.ay[kept] = a[1]; vortices.az[kept] = a[2];
+            vtemp[kept] = vtemp[i] * keepT;
+            ++kept;
+        }
+        const int dropV = std::max(0, kept - P.maxVortices);
+        for (std::vector<float>* v : { &vortices.x, &vortices.y, &vortices.z, &vortices.ax, &vortices.ay, &vortices.az, &vtemp }) {
+            v->resize(kept);
+            v->erase(v->begin(), v->begin() + dropV);
+        }
+        // markers
+        kept = 0;
+        const int nm = markerCount();
+        for (int i = 0; i < nm; ++i) {
+            float x = mx[i] + dt * mu[0][i];
+            float y = my[i] + dt * (mu[1][i] + P.buoyancy * mtemp[i]);
+            float z = mz[i] + dt * mu[2][i];
+            float d = mdens[i] * keepD;
+            if (outside(x, y, z) || d < 0.02f) continue;
+            mx[kept] = x; my[kept] = y; mz[kept] = z;
+            mdens[kept] = d;
+            mtemp[kept] = mtemp[i] * keepT;
+            ++kept;
+        }
+        const int dropM = std::max(0, kept - P.maxTracers);
+        for (std::vector<float>* v : { &mx, &my, &mz, &mdens, &mtemp }) {
+            v->resize(kept);
+            v->erase(v->begin(), v->begin() + dropM);
+        }
+    }
+
+    void splat() {
+        const int B = TileMap::B, B3 = TileMap::B3, T = N / B;
+        for (int b : bricks) std::fill(&field[size_t(b) * B3 * 2], &field[size_t(b + 1) * B3 * 2], 0.0f);
+        const int nm = markerCount();
+        for (int i = 0; i < nm; ++i) {
+            float g[3] = { mx[i] * N - 0.5f, my[i] * N - 0.5f, mz[i] * N - 0.5f };
+            int c0[3];
+            float f[3];
+            for (int c = 0; c < 3; ++c) { c0[c] = int(std::floor(g[c])); f[c] = g[c] - c0[c]; }
+            const float d = mdens[i] * gain, h = mtemp[i] * gain;
+            for (int corner = 0; corner < 8; ++corner) {
+                int x = c0[0] + (corner & 1), y = c0[1] + (corner >> 1 & 1), z = c0[2] + (corner >> 2);
+                if (x < 0 || y < 0 || z < 0 || x >= N || y >= N || z >= N) continue;
+                float w = (corner & 1 ? f[0] : 1.0f - f[0]) * (corner >> 1 & 1 ? f[1] : 1.0f - f[1])
+                        * (corner >> 2 ? f[2] : 1.0f - f[2]);
+                int b = ((z / B) * T + y / B) * T + x / B;
+                float* cell = &field[(size_t(b) * B3 + TileMap::local(x, y, z)) * 2];
+                cell[0] += w * d;
+                cell[1] += w * h;
+                touched[b] = 1;
+            }
+        }
+        bricks.clear();
+        for (int b = 0; b < T * T * T; ++b)
+            if (touched[b]) { bricks.push_back(b); touched[b] = 0; }
+    }
+};